@@ -28,11 +28,20 @@
 #include "bricklib/utility/system_timer.h"
 
 #include "bricklib/drivers/adc/adc.h"
+#include "bricklib/drivers/pmc/pmc.h"
+#include "bricklib/drivers/usart/usart.h"
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+
+#ifdef PROFILING
+#include "bricklib/utility/profiling.h"
+#endif
 
 #include "bricklet_config.h"
 #include "config.h"
 
 #include <string.h>
+#include <inttypes.h>
 
 uint32_t bricklet_spitfp_baudrate[BRICKLET_NUM] = {
 	#if BRICKLET_NUM > 0
@@ -94,6 +103,58 @@ static uint32_t bricklet_comcu_reset_wait_time[BRICKLET_NUM] = {
 static uint32_t bricklet_comcu_data_last_time = 0;
 static uint32_t bricklet_comcu_data_counter   = 0;
 
+static const CoMCUUSART bricklet_co_mcu_usart[BRICKLET_NUM] = {
+#if BRICKLET_NUM > 0
+#ifdef CO_MCU_USART_A
+	CO_MCU_USART_A,
+#else
+	{NULL, 0, 0},
+#endif
+#endif
+#if BRICKLET_NUM > 1
+#ifdef CO_MCU_USART_B
+	CO_MCU_USART_B,
+#else
+	{NULL, 0, 0},
+#endif
+#endif
+#if BRICKLET_NUM > 2
+#ifdef CO_MCU_USART_C
+	CO_MCU_USART_C,
+#else
+	{NULL, 0, 0},
+#endif
+#endif
+#if BRICKLET_NUM > 3
+#ifdef CO_MCU_USART_D
+	CO_MCU_USART_D
+#else
+	{NULL, 0, 0}
+#endif
+#endif
+};
+
+// Set while a port is polled. A USART transfer yields, the message loop
+// (bricklet_co_mcu_send) or the tick task must not start a second poll of
+// the port in the meantime. The scheduler is cooperative, the flag is
+// only accessed by tasks and needs no lock.
+static bool bricklet_co_mcu_port_busy[BRICKLET_NUM] = {false};
+
+// Clocked out while we only want to receive (the USART needs a buffer for that)
+static uint8_t bricklet_co_mcu_zero[MAX_TFP_MESSAGE_LENGTH] = {0};
+
+#ifdef PROFILING
+#define CO_MCU_PROFILING_INTERVAL 10000 // in ms
+
+// CPU load of a port in 1/100 percent
+#define CO_MCU_PROFILING_LOAD(i) ((uint32_t)((bricklet_co_mcu_profiling_cycles[i]*10000ULL) / ((uint64_t)BOARD_MCK*(CO_MCU_PROFILING_INTERVAL/1000))))
+
+// Transfered bytes and cycles the CPU spent for them per port
+static uint32_t bricklet_co_mcu_profiling_bytes[BRICKLET_NUM];
+static uint64_t bricklet_co_mcu_profiling_cycles[BRICKLET_NUM];
+static uint32_t bricklet_co_mcu_profiling_time = 0;
+#endif
+
 void bricklet_co_mcu_init(const uint8_t bricklet_num) {
 	logd("Initialize CO MCU Bricklet %c\n\r", 'a' + bricklet_num);
 	_Static_assert(sizeof(CoMCUData) <= BRICKLET_CONTEXT_MAX_SIZE, "CoMCUData too big");
@@ -102,15 +163,33 @@ void bricklet_co_mcu_init(const uint8_t bricklet_num) {
 	SPI_SS(bricklet_num).attribute = PIO_DEFAULT;
 	PIO_Configure(&SPI_SS(bricklet_num), 1);
 
-	SPI_CLK(bricklet_num).type = PIO_OUTPUT_1;
+	const CoMCUUSART *usart = &bricklet_co_mcu_usart[bricklet_num];
+	if(usart->usart != NULL) {
+		// Clock idles high and data is sampled with the rising edge, as with bit-banging
+		PMC_EnablePeripheral(usart->id);
+		USART_Configure(usart->usart,
+		                US_MR_USART_MODE_SPI_MASTER | US_MR_USCLKS_MCK | US_MR_CHRL_8_BIT | US_MR_CHMODE_NORMAL | US_MR_CPOL | US_MR_CLKO,
+		                CO_MCU_DEFAULT_BAUDRATE,
+		                BOARD_MCK);
+		usart->usart->US_PTCR = US_PTCR_RXTDIS | US_PTCR_TXTDIS;
+		usart->usart->US_CR = US_CR_RXEN | US_CR_TXEN;
+
+		SPI_CLK(bricklet_num).type = usart->pin_type;
+		SPI_MOSI(bricklet_num).type = usart->pin_type;
+		SPI_MISO(bricklet_num).type = usart->pin_type;
+		logd("Using USART for CO MCU Bricklet %c\n\r", 'a' + bricklet_num);
+	} else {
+		SPI_CLK(bricklet_num).type = PIO_OUTPUT_1;
+		SPI_MOSI(bricklet_num).type = PIO_OUTPUT_1;
+		SPI_MISO(bricklet_num).type = PIO_INPUT;
+	}
+
 	SPI_CLK(bricklet_num).attribute = PIO_DEFAULT;
 	PIO_Configure(&SPI_CLK(bricklet_num), 1);
 
-	SPI_MOSI(bricklet_num).type = PIO_OUTPUT_1;
 	SPI_MOSI(bricklet_num).attribute = PIO_DEFAULT;
 	PIO_Configure(&SPI_MOSI(bricklet_num), 1);
 
-	SPI_MISO(bricklet_num).type = PIO_INPUT;
 	SPI_MISO(bricklet_num).attribute = PIO_PULLDOWN;
 	PIO_Configure(&SPI_MISO(bricklet_num), 1);
 
@@ -128,6 +207,7 @@ void bricklet_co_mcu_init(const uint8_t bricklet_num) {
 	CO_MCU_DATA(bricklet_num)->error_count.error_count_frame            = 0;
 
 	CO_MCU_DATA(bricklet_num)->buffer_send_length = 0;
+	bricklet_co_mcu_port_busy[bricklet_num] = false;
 
 	ringbuffer_init(&CO_MCU_DATA(bricklet_num)->ringbuffer_recv, CO_MCU_BUFFER_SIZE_RECV, CO_MCU_DATA(bricklet_num)->buffer_recv);
 
@@ -195,36 +275,204 @@ uint8_t  bricklet_co_mcu_entry_spibb_transceive_byte(const uint8_t bricklet_num,
 	return recv;
 }
 
+// Transfers the bytes with the PDC of the USART. We yield while waiting,
+// the CPU is only needed to start the transfer. Returns false on timeout.
+bool bricklet_co_mcu_usart_transceive(const uint8_t bricklet_num, const uint8_t *send, uint8_t *recv, const uint8_t length) {
+	Usart *usart = bricklet_co_mcu_usart[bricklet_num].usart;
+	const uint32_t baudrate = MIN(bricklet_spitfp_baudrate[bricklet_num], bricklet_spitfp_baudrate_current);
+
+	usart->US_BRGR = BOARD_MCK / baudrate;
+	usart->US_CR = US_CR_RSTSTA;
+	if(usart->US_CSR & US_CSR_RXRDY) {
+		volatile uint32_t stale = usart->US_RHR;
+		(void)stale;
+	}
+
+	usart->US_RPR = (uint32_t)recv;
+	usart->US_RCR = length;
+	usart->US_TPR = (uint32_t)send;
+	usart->US_TCR = length;
+	usart->US_PTCR = US_PTCR_RXTEN | US_PTCR_TXTEN;
+
+	// Even one byte takes longer than a task switch, ENDRX
+	// is only checked after the first yield
+	const uint32_t start_time = system_timer_get_ms();
+	taskYIELD();
+	while(!(usart->US_CSR & US_CSR_ENDRX)) {
+		if(system_timer_is_time_elapsed_ms(start_time, CO_MCU_USART_TIMEOUT)) {
+			usart->US_PTCR = US_PTCR_RXTDIS | US_PTCR_TXTDIS;
+			logw("USART timeout for CO MCU Bricklet %c\n\r", 'a' + bricklet_num);
+			return false;
+		}
+		taskYIELD();
+	}
+
+	usart->US_PTCR = US_PTCR_RXTDIS | US_PTCR_TXTDIS;
+	return true;
+}
+
+// Transfers a frame with the USART of the port (if there is one) or with
+// bit-banging and adds the received bytes to the ringbuffer
+void bricklet_co_mcu_transceive_frame(const uint8_t bricklet_num, const uint8_t *data, const uint8_t length) {
+	uint8_t recv[MAX_TFP_MESSAGE_LENGTH];
+
+#ifdef PROFILING
+	uint32_t cycles_start = PROFILING_CYCLES_GET();
+#endif
+
+	if(bricklet_co_mcu_usart[bricklet_num].usart != NULL) {
+#ifdef PROFILING
+		// Only the time to start the transfer and to handle the result is counted
+		bricklet_co_mcu_profiling_cycles[bricklet_num] += PROFILING_CYCLES_SINCE(cycles_start);
+#endif
+		if(!bricklet_co_mcu_usart_transceive(bricklet_num, data, recv, length)) {
+			memset(recv, 0, length);
+		}
+#ifdef PROFILING
+		cycles_start = PROFILING_CYCLES_GET();
+#endif
+	} else {
+		for(uint8_t i = 0; i < length; i++) {
+			recv[i] = bricklet_co_mcu_entry_spibb_transceive_byte(bricklet_num, data[i]);
+		}
+	}
+
+	bricklet_comcu_data_counter += length;
+
+	for(uint8_t i = 0; i < length; i++) {
+		if(!ringbuffer_add(&CO_MCU_DATA(bricklet_num)->ringbuffer_recv, recv[i])) {
+			logw("Could not add to ringbuffer\n\r");
+		}
+	}
+
+#ifdef PROFILING
+	bricklet_co_mcu_profiling_cycles[bricklet_num] += PROFILING_CYCLES_SINCE(cycles_start);
+	bricklet_co_mcu_profiling_bytes[bricklet_num] += length;
+#endif
+}
+
+// Same as bricklet_co_mcu_entry_spibb_transceive_byte for several ports at once.
+// CLK, MOSI and MISO of all ports have to be on the same PIO controllers, all
+// ports are clocked by the same register writes and sampled by one PDSR read.
+void bricklet_co_mcu_spibb_transceive_byte_parallel(const uint8_t *bricklets, const uint8_t bricklets_num, const uint8_t *value, uint8_t *recv) {
+	Pio *pin_clk = SPI_CLK(bricklets[0]).pio;
+	Pio *pin_mosi = SPI_MOSI(bricklets[0]).pio;
+	Pio *pin_miso = SPI_MISO(bricklets[0]).pio;
+	uint32_t pin_clk_mask = 0;
+	uint32_t baudrate = bricklet_spitfp_baudrate_current;
+
+	for(uint8_t n = 0; n < bricklets_num; n++) {
+		pin_clk_mask |= SPI_CLK(bricklets[n]).mask;
+		baudrate = MIN(baudrate, bricklet_spitfp_baudrate[bricklets[n]]);
+		recv[n] = 0;
+	}
+
+	const uint32_t sleep_half_bit_ns = SLEEP_HALF_BIT_NS(baudrate);
+
+	for(int8_t i = 7; i >= 0; i--) {
+		uint32_t pin_mosi_set = 0;
+		uint32_t pin_mosi_clear = 0;
+		for(uint8_t n = 0; n < bricklets_num; n++) {
+			if((value[n] >> i) & 1) {
+				pin_mosi_set |= SPI_MOSI(bricklets[n]).mask;
+			} else {
+				pin_mosi_clear |= SPI_MOSI(bricklets[n]).mask;
+			}
+		}
+
+		pin_clk->PIO_CODR = pin_clk_mask;
+		pin_mosi->PIO_SODR = pin_mosi_set;
+		pin_mosi->PIO_CODR = pin_mosi_clear;
+
+		SLEEP_NS(sleep_half_bit_ns);
+		pin_clk->PIO_SODR = pin_clk_mask;
+		const uint32_t pin_miso_state = pin_miso->PIO_PDSR;
+
+		for(uint8_t n = 0; n < bricklets_num; n++) {
+			if(pin_miso_state & SPI_MISO(bricklets[n]).mask) {
+				recv[n] |= (1 << i);
+			}
+		}
+
+		// As with one port, the code between the bytes
+		// takes the time of the last half bit
+		if(i > 0) {
+			SLEEP_NS(sleep_half_bit_ns);
+		}
+	}
+}
+
+// Transfers one frame per port at the same time. A port only gets
+// clocks while it has bytes left, the frames can differ in length.
+void bricklet_co_mcu_transceive_frames_parallel(const uint8_t *bricklets, const uint8_t bricklets_num, const uint8_t **data, const uint8_t *length) {
+#ifdef PROFILING
+	const uint32_t cycles_start = PROFILING_CYCLES_GET();
+#endif
+
+	uint8_t length_max = 0;
+	for(uint8_t n = 0; n < bricklets_num; n++) {
+		length_max = MAX(length_max, length[n]);
+	}
+
+	for(uint8_t i = 0; i < length_max; i++) {
+		uint8_t active[BRICKLET_NUM];
+		uint8_t active_index[BRICKLET_NUM];
+		uint8_t active_num = 0;
+		uint8_t value[BRICKLET_NUM];
+		uint8_t recv[BRICKLET_NUM];
+
+		for(uint8_t n = 0; n < bricklets_num; n++) {
+			if(i < length[n]) {
+				active[active_num] = bricklets[n];
+				active_index[active_num] = n;
+				value[active_num] = data[n][i];
+				active_num++;
+			}
+		}
+
+		bricklet_co_mcu_spibb_transceive_byte_parallel(active, active_num, value, recv);
 
-uint8_t bricklet_co_mcu_transceive(const uint8_t bricklet_num, const uint8_t data) {
-	const uint8_t value = bricklet_co_mcu_entry_spibb_transceive_byte(bricklet_num, data);
-	bricklet_comcu_data_counter++;
+		for(uint8_t n = 0; n < active_num; n++) {
+			if(!ringbuffer_add(&CO_MCU_DATA(bricklets[active_index[n]])->ringbuffer_recv, recv[n])) {
+				logw("Could not add to ringbuffer\n\r");
+			}
+		}
+	}
 
-	if(!ringbuffer_add(&CO_MCU_DATA(bricklet_num)->ringbuffer_recv, value)) {
-		logw("Could not add to ringbuffer\n\r");
+	for(uint8_t n = 0; n < bricklets_num; n++) {
+		bricklet_comcu_data_counter += length[n];
+#ifdef PROFILING
+		bricklet_co_mcu_profiling_bytes[bricklets[n]] += length[n];
+#endif
 	}
 
-	return value;
+#ifdef PROFILING
+	// The CPU time is shared by all ports
+	const uint32_t cycles = PROFILING_CYCLES_SINCE(cycles_start);
+	for(uint8_t n = 0; n < bricklets_num; n++) {
+		bricklet_co_mcu_profiling_cycles[bricklets[n]] += cycles / bricklets_num;
+	}
+#endif
 }
 
 void bricklet_co_mcu_send_ack(const uint8_t bricklet_num, const uint8_t sequence_number) {
-	const uint8_t sequence_number_to_send = sequence_number << 4;
+	uint8_t frame[PROTOCOL_OVERHEAD];
 	uint8_t checksum = 0;
 
-	bricklet_co_mcu_spibb_select(bricklet_num);
+	frame[0] = PROTOCOL_OVERHEAD;
+	PEARSON(checksum, frame[0]);
 
-	bricklet_co_mcu_transceive(bricklet_num, PROTOCOL_OVERHEAD);
-	PEARSON(checksum, PROTOCOL_OVERHEAD);
+	frame[1] = sequence_number << 4;
+	PEARSON(checksum, frame[1]);
 
-	bricklet_co_mcu_transceive(bricklet_num, sequence_number_to_send);
-	PEARSON(checksum, sequence_number_to_send);
-
-	bricklet_co_mcu_transceive(bricklet_num, checksum);
+	frame[2] = checksum;
 
+	bricklet_co_mcu_spibb_select(bricklet_num);
+	bricklet_co_mcu_transceive_frame(bricklet_num, frame, PROTOCOL_OVERHEAD);
 	bricklet_co_mcu_spibb_deselect(bricklet_num);
 }
 
-void bricklet_co_mcu_new_message(void *data, const uint16_t length, const ComType com, const uint8_t bricklet_num) {
+void bricklet_co_mcu_new_message(void *data, const uint16_t length, const uint8_t bricklet_num) {
 	// We have to inject connected UID to Enumerate and Identity messages
 	uint8_t fid = ((MessageHeader*)data)->fid;
 
@@ -265,16 +513,26 @@ void bricklet_co_mcu_new_message(void *data, const uint16_t length, const ComTyp
 	// There is a Bricklet connected to this port!
 	CO_MCU_DATA(bricklet_num)->availability.access.got_message = true;
 
-	// Send message via current com protocol.
-	if(CO_MCU_DATA(bricklet_num)->first_enumerate_send) {
-		send_blocking_with_timeout(data, length, com);
-	} else {
-		// We make sure that the very first enumerate is definitely send.
-		// With this we can make sure that the Master of a stack can
-		// always creates a proper routing table
-		send_blocking(data, length, com);
-		CO_MCU_DATA(bricklet_num)->first_enumerate_send = true;
+	// Send response to the com protocol of the request, callbacks
+	// to all com protocols in use.
+	const uint8_t targets = com_get_reply_targets((MessageHeader*)data);
+	for(uint8_t com = 0; com < COM_TYPE_NUM; com++) {
+		if(!(targets & (1 << com))) {
+			continue;
+		}
+
+		if(CO_MCU_DATA(bricklet_num)->first_enumerate_send || com != com_info.current) {
+			send_blocking_with_timeout(data, length, com);
+		} else {
+			// We make sure that the very first enumerate is definitely send
+			// to the com protocol of the last request. With this we can make
+			// sure that the Master of a stack can always creates a proper
+			// routing table. The other com protocols must not block us.
+			send_blocking(data, length, com);
+		}
 	}
+
+	CO_MCU_DATA(bricklet_num)->first_enumerate_send = true;
 }
 
 void bricklet_co_mcu_handle_error(const uint8_t bricklet_num) {
@@ -285,7 +543,12 @@ void bricklet_co_mcu_handle_error(const uint8_t bricklet_num) {
 	// deadlock situation. By randomly removing one additional
 	// byte we get out of the deadlock.
 	if(adc_get_temperature() % 2) {
-		bricklet_co_mcu_entry_spibb_transceive_byte(bricklet_num, 0);
+		if(bricklet_co_mcu_usart[bricklet_num].usart != NULL) {
+			uint8_t recv;
+			bricklet_co_mcu_usart_transceive(bricklet_num, bricklet_co_mcu_zero, &recv, 1);
+		} else {
+			bricklet_co_mcu_entry_spibb_transceive_byte(bricklet_num, 0);
+		}
 	}
 
 	// In case of error we completely empty the ringbuffer
@@ -413,7 +676,10 @@ void bricklet_co_mcu_check_recv(const uint8_t bricklet_num) {
 				}
 
 				uint8_t last_sequence_number_seen_by_slave = (data_sequence_number & 0xF0) >> 4;
-				if(last_sequence_number_seen_by_slave == CO_MCU_DATA(bricklet_num)->current_sequence_number) {
+				// A message that waits for its first send (ack timeout -1) still has the
+				// sequence number of the last message, an ACK can not be for it
+				if(last_sequence_number_seen_by_slave == CO_MCU_DATA(bricklet_num)->current_sequence_number &&
+				   CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout >= 0) {
 					bricklet_co_mcu_check_reset(bricklet_num);
 					CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout = -1;
 					CO_MCU_DATA(bricklet_num)->buffer_send_length = 0;
@@ -456,7 +722,8 @@ void bricklet_co_mcu_check_recv(const uint8_t bricklet_num) {
 				}
 
 				uint8_t last_sequence_number_seen_by_slave = (data_sequence_number & 0xF0) >> 4;
-				if(last_sequence_number_seen_by_slave == CO_MCU_DATA(bricklet_num)->current_sequence_number) {
+				if(last_sequence_number_seen_by_slave == CO_MCU_DATA(bricklet_num)->current_sequence_number &&
+				   CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout >= 0) {
 					bricklet_co_mcu_check_reset(bricklet_num);
 					CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout = -1;
 					CO_MCU_DATA(bricklet_num)->buffer_send_length = 0;
@@ -469,7 +736,7 @@ void bricklet_co_mcu_check_recv(const uint8_t bricklet_num) {
 				// Otherwise we only ack the already send message again.
 				if(message_sequence_number != CO_MCU_DATA(bricklet_num)->last_sequence_number_seen) {
 					CO_MCU_DATA(bricklet_num)->last_sequence_number_seen = message_sequence_number;
-					bricklet_co_mcu_new_message(message, message_position, com_info.current, bricklet_num);
+					bricklet_co_mcu_new_message(message, message_position, bricklet_num);
 				}
 				return;
 			}
@@ -555,22 +822,88 @@ void bricklet_co_mcu_update_speed(void) {
 	}
 }
 
-void bricklet_co_mcu_poll(const uint8_t bricklet_num) {
+#ifdef PROFILING
+// Prints throughput and CPU load (in 1/100 percent) of each port
+static void bricklet_co_mcu_profiling_print(void) {
+	if(bricklet_co_mcu_profiling_time == 0) {
+		bricklet_co_mcu_profiling_time = system_timer_get_ms();
+		return;
+	}
+
+	if(!system_timer_is_time_elapsed_ms(bricklet_co_mcu_profiling_time, CO_MCU_PROFILING_INTERVAL)) {
+		return;
+	}
+
+	for(uint8_t i = 0; i < BRICKLET_NUM; i++) {
+		if(bricklet_co_mcu_profiling_bytes[i] == 0) {
+			continue;
+		}
+
+		logi("CO MCU Bricklet %c (%s): %"PRIu32" bytes/s, CPU load %"PRIu32".%02"PRIu32"%%\n\r",
+		     'a' + i,
+		     bricklet_co_mcu_usart[i].usart != NULL ? "USART" : "bit-bang",
+		     bricklet_co_mcu_profiling_bytes[i] / (CO_MCU_PROFILING_INTERVAL/1000),
+		     CO_MCU_PROFILING_LOAD(i) / 100, CO_MCU_PROFILING_LOAD(i) % 100);
+
+		bricklet_co_mcu_profiling_bytes[i] = 0;
+		bricklet_co_mcu_profiling_cycles[i] = 0;
+	}
+
+	bricklet_co_mcu_profiling_time = system_timer_get_ms();
+}
+#endif
+
+// The message of a frame is transfered directly from buffer_send, only
+// the bytes before and after it are kept here. A frame is sent in three
+// parts: header (length and sequence number), message and checksum.
+typedef struct {
+	uint8_t header[2];
+	uint8_t checksum;
+	uint8_t length; // 0 if there is nothing to send and we only receive
+} CoMCUFrame;
+
+#define CO_MCU_FRAME_PART_HEADER   0
+#define CO_MCU_FRAME_PART_MESSAGE  1
+#define CO_MCU_FRAME_PART_CHECKSUM 2
+
+// Returns the length of a part of the frame and where its bytes are
+static uint8_t bricklet_co_mcu_frame_part(const uint8_t bricklet_num, const CoMCUFrame *frame, const uint8_t part, const uint8_t **data) {
+	switch(part) {
+		case CO_MCU_FRAME_PART_HEADER: {
+			*data = frame->header;
+			return sizeof(frame->header);
+		}
+
+		case CO_MCU_FRAME_PART_MESSAGE: {
+			*data = CO_MCU_DATA(bricklet_num)->buffer_send;
+			return frame->length - PROTOCOL_OVERHEAD;
+		}
+
+		case CO_MCU_FRAME_PART_CHECKSUM: {
+			*data = &frame->checksum;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Checks if the port is polled in this tick and prepares the frame to send
+static bool bricklet_co_mcu_poll_start(const uint8_t bricklet_num, CoMCUFrame *frame) {
 	if(com_info.current == COM_NONE) {
 		// Never communicate with the Bricklet if we don't know were to send
 		// the data!
-		return;
+		return false;
 	}
 
 	if(bricklet_comcu_reset_wait_time[bricklet_num] != 0) {
 		if(system_timer_is_time_elapsed_ms(bricklet_comcu_reset_wait_time[bricklet_num], BRICKLET_COMCU_RESET_WAIT)) {
 			bricklet_comcu_reset_wait_time[bricklet_num] = 0;
 		} else {
-			return;
+			return false;
 		}
 	}
 
-	uint8_t checksum = 0;
 	if(CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout > 0) {
 		CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout--;
 		if(CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout == 0) {
@@ -585,7 +918,7 @@ void bricklet_co_mcu_poll(const uint8_t bricklet_num) {
 				//                              don't check again. In this case the BC RAM can
 				//                              then be used by the LED Strip Bricklet.
 				if(bricklet_co_mcu_check_led_strip(bricklet_num)) {
-					return;
+					return false;
 				}
 
 				// For all following tries we only try once (until we really get an answer)
@@ -597,44 +930,168 @@ void bricklet_co_mcu_poll(const uint8_t bricklet_num) {
 	}
 
 	bricklet_co_mcu_update_speed();
-	bricklet_co_mcu_spibb_select(bricklet_num);
-
+#ifdef PROFILING
+	bricklet_co_mcu_profiling_print();
+#endif
+	frame->length = 0;
 	if((CO_MCU_DATA(bricklet_num)->buffer_send_length > 0) && (CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout <= 0)) {
 		const uint8_t length_to_send = CO_MCU_DATA(bricklet_num)->buffer_send_length + PROTOCOL_OVERHEAD;
+		uint8_t checksum = 0;
 
 		// If buffer_send_ack_timeout < 0 we received an ACK
 		const uint8_t sequence_number_to_send = bricklet_co_mcu_get_sequence_byte(bricklet_num, CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout < 0);
 
-		bricklet_co_mcu_transceive(bricklet_num, length_to_send);
+		frame->header[0] = length_to_send;
 		PEARSON(checksum, length_to_send);
-		bricklet_co_mcu_transceive(bricklet_num, sequence_number_to_send);
+		frame->header[1] = sequence_number_to_send;
 		PEARSON(checksum, sequence_number_to_send);
 
 		for(uint8_t i = 0; i < CO_MCU_DATA(bricklet_num)->buffer_send_length; i++) {
-			const uint8_t data_to_send = CO_MCU_DATA(bricklet_num)->buffer_send[i];
-			bricklet_co_mcu_transceive(bricklet_num, data_to_send);
-			PEARSON(checksum, data_to_send);
+			PEARSON(checksum, CO_MCU_DATA(bricklet_num)->buffer_send[i]);
 		}
 
+		frame->checksum = checksum;
+		frame->length = length_to_send;
+
 		CO_MCU_DATA(bricklet_num)->buffer_send_ack_timeout = BUFFER_SEND_ACK_TIMEOUT;
+	}
 
-		bricklet_co_mcu_transceive(bricklet_num, checksum);
-	} else {
-		const uint16_t free = ringbuffer_get_free(&CO_MCU_DATA(bricklet_num)->ringbuffer_recv);
-		for(uint8_t i = 0; i < free; i++) {
-			bricklet_co_mcu_transceive(bricklet_num, 0);
+	return true;
+}
+
+// Polls the given ports. With more than one port, all ports have to use bit-banging
+// with the same PIO controllers, the frames of all ports are then transfered at once.
+static void bricklet_co_mcu_poll_ports(const uint8_t *bricklets, const uint8_t bricklets_num) {
+	CoMCUFrame frame[BRICKLET_NUM];
+	const uint8_t *data[BRICKLET_NUM];
+	uint8_t length[BRICKLET_NUM];
+	uint8_t part[BRICKLET_NUM];
+	uint16_t free[BRICKLET_NUM];
+	uint8_t ports[BRICKLET_NUM];
+	uint8_t ports_num = 0;
+
+	for(uint8_t i = 0; i < bricklets_num; i++) {
+		// A port that is already polled by another task is left out,
+		// a message in buffer_send is sent with the next poll
+		if(bricklet_co_mcu_port_busy[bricklets[i]] ||
+		   !bricklet_co_mcu_poll_start(bricklets[i], &frame[ports_num])) {
+			continue;
+		}
+
+		bricklet_co_mcu_port_busy[bricklets[i]] = true;
+
+		if(frame[ports_num].length > 0) {
+			part[ports_num] = CO_MCU_FRAME_PART_HEADER;
+			length[ports_num] = bricklet_co_mcu_frame_part(bricklets[i], &frame[ports_num], part[ports_num], &data[ports_num]);
+			free[ports_num] = 0;
+		} else {
+			// We start with one byte. If it is the start of a message, we
+			// transfer the missing bytes of the message in the next round.
+			data[ports_num] = bricklet_co_mcu_zero;
+			free[ports_num] = ringbuffer_get_free(&CO_MCU_DATA(bricklets[i])->ringbuffer_recv);
+			length[ports_num] = MIN(1, free[ports_num]);
+		}
+
+		ports[ports_num] = bricklets[i];
+		ports_num++;
+	}
+
+	if(ports_num == 0) {
+		return;
+	}
+
+	for(uint8_t i = 0; i < ports_num; i++) {
+		bricklet_co_mcu_spibb_select(ports[i]);
+	}
+
+	bool transfer = true;
+	while(transfer) {
+		if(ports_num == 1) {
+			bricklet_co_mcu_transceive_frame(ports[0], data[0], length[0]);
+		} else {
+			bricklet_co_mcu_transceive_frames_parallel(ports, ports_num, data, length);
+		}
+
+		transfer = false;
+		for(uint8_t i = 0; i < ports_num; i++) {
+			if(frame[i].length > 0) {
+				// The next part of the frame follows in the next round
+				if(length[i] > 0) {
+					part[i]++;
+					length[i] = bricklet_co_mcu_frame_part(ports[i], &frame[i], part[i], &data[i]);
+					transfer |= length[i] > 0;
+				}
+				continue;
+			}
+
+			if(free[i] == 0 || length[i] == 0) {
+				// The message is complete or the ringbuffer is full
+				length[i] = 0;
+				continue;
+			}
+
+			free[i] -= length[i];
 
 			// If the missing length is 0 we either have a complete message or the
 			// Bricklet did not have any data to send (buffer was empty and we got a 0)
-			if(bricklet_co_mcu_check_missing_length(bricklet_num) == 0) {
-				break;
+			length[i] = MIN(bricklet_co_mcu_check_missing_length(ports[i]), free[i]);
+			if(length[i] > 0) {
+				data[i] = bricklet_co_mcu_zero;
+				transfer = true;
 			}
 		}
 	}
 
-	bricklet_co_mcu_spibb_deselect(bricklet_num);
+	for(uint8_t i = 0; i < ports_num; i++) {
+		bricklet_co_mcu_spibb_deselect(ports[i]);
+	}
+
+	// check_recv can transfer an ACK, the ports stay busy until it is done
+	for(uint8_t i = 0; i < ports_num; i++) {
+		bricklet_co_mcu_check_recv(ports[i]);
+		bricklet_co_mcu_port_busy[ports[i]] = false;
+	}
+}
+
+void bricklet_co_mcu_poll(const uint8_t bricklet_num) {
+	bricklet_co_mcu_poll_ports(&bricklet_num, 1);
+}
+
+// Polls all given ports. Ports that use bit-banging with the same PIO
+// controllers for CLK, MOSI and MISO are polled together.
+void bricklet_co_mcu_poll_all(const uint8_t *bricklets, const uint8_t bricklets_num) {
+	bool polled[BRICKLET_NUM] = {false};
+
+	for(uint8_t i = 0; i < bricklets_num; i++) {
+		if(polled[i]) {
+			continue;
+		}
 
-	bricklet_co_mcu_check_recv(bricklet_num);
+		uint8_t group[BRICKLET_NUM];
+		uint8_t group_num = 0;
+		const uint8_t b = bricklets[i];
+
+		group[group_num++] = b;
+		polled[i] = true;
+
+#if CO_MCU_PARALLEL_BITBANG
+		if(bricklet_co_mcu_usart[b].usart == NULL) {
+			for(uint8_t j = i+1; j < bricklets_num; j++) {
+				const uint8_t o = bricklets[j];
+				if(!polled[j] &&
+				   (bricklet_co_mcu_usart[o].usart == NULL) &&
+				   (SPI_CLK(o).pio == SPI_CLK(b).pio) &&
+				   (SPI_MOSI(o).pio == SPI_MOSI(b).pio) &&
+				   (SPI_MISO(o).pio == SPI_MISO(b).pio)) {
+					group[group_num++] = o;
+					polled[j] = true;
+				}
+			}
+		}
+#endif
+
+		bricklet_co_mcu_poll_ports(group, group_num);
+	}
 }
 
 void bricklet_co_mcu_send(const uint8_t bricklet_num, uint8_t *data, const uint8_t length) {
@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include "bricklib/utility/ringbuffer.h"
+#include "bricklib/drivers/usart/usart.h"
 
 #define CO_MCU_BUFFER_SIZE_SEND 80
 #define CO_MCU_BUFFER_SIZE_RECV 140
@@ -31,6 +32,24 @@
 #define CO_MCU_DEFAULT_BAUDRATE 1400000
 #define CO_MCU_MAXIMUM_BAUDRATE 2000000
 
+// Poll ports that use bit-banging on the same PIO controllers at the same time
+#ifndef CO_MCU_PARALLEL_BITBANG
+#define CO_MCU_PARALLEL_BITBANG 1
+#endif
+
+// Timeout for a frame that is transfered by a USART
+#define CO_MCU_USART_TIMEOUT    5 // in ms
+
+// A board can let a USART in SPI master mode transfer the frames of a port,
+// if CLK, MOSI and MISO of the port are SCK, TXD and RXD of the USART, e.g.:
+// #define CO_MCU_USART_A {USART0, ID_USART0, PIO_PERIPH_A}
+// Ports without CO_MCU_USART_<port> use bit-banging.
+typedef struct {
+	Usart *usart;
+	uint32_t id;
+	uint8_t pin_type;
+} CoMCUUSART;
+
 typedef enum {
 	STATE_START,
 	STATE_ACK_SEQUENCE_NUMBER,
@@ -70,6 +89,7 @@ typedef struct {
 #define CO_MCU_DATA(i) ((CoMCUData*)(bc[i]))
 
 void bricklet_co_mcu_poll(const uint8_t bricklet_num);
+void bricklet_co_mcu_poll_all(const uint8_t *bricklets, const uint8_t bricklets_num);
 void bricklet_co_mcu_send(const uint8_t bricklet_num, uint8_t *data, const uint8_t length);
 void bricklet_co_mcu_init(const uint8_t bricklet_num);
 
@@ -47,10 +47,10 @@
 #define COM_MESSAGES_BRICKLET \
 	{FID_WRITE_BRICKLET_NAME, (message_handler_func_t)NULL}, /* Not used anymore */ \
 	{FID_READ_BRICKLET_NAME, (message_handler_func_t)NULL}, /* Not used anymore */ \
-	{FID_WRITE_BRICKLET_PLUGIN, (message_handler_func_t)write_bricklet_plugin}, \
-	{FID_READ_BRICKLET_PLUGIN, (message_handler_func_t)read_bricklet_plugin}, \
-	{FID_WRITE_BRICKLET_UID, (message_handler_func_t)write_bricklet_uid}, \
-	{FID_READ_BRICKLET_UID, (message_handler_func_t)read_bricklet_uid},
+	COM_MESSAGE(FID_WRITE_BRICKLET_PLUGIN, write_bricklet_plugin, WriteBrickletPlugin, MessageHeader), \
+	COM_MESSAGE(FID_READ_BRICKLET_PLUGIN, read_bricklet_plugin, ReadBrickletPlugin, ReadBrickletPluginReturn), \
+	COM_MESSAGE(FID_WRITE_BRICKLET_UID, write_bricklet_uid, WriteBrickletUID, MessageHeader), \
+	COM_MESSAGE(FID_READ_BRICKLET_UID, read_bricklet_uid, ReadBrickletUID, ReadBrickletUIDReturn),
 #endif
 
 typedef struct {
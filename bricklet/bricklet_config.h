@@ -131,7 +131,9 @@ typedef struct {
 #define END_OF_BRICKLET_MEMORY (BRICKLET_CONTEXT_ADDRESS_D - BRICKLET_PLUGIN_MAX_SIZE)
 #endif
 
+#ifndef BRICKLET_CONTEXT_MAX_SIZE
 #define BRICKLET_CONTEXT_MAX_SIZE 256
+#endif
 #define BRICKLET_PLUGIN_MAX_SIZE 0x1000 // 4KByte (0x1600 8)
 
 #define BRICKLET_ADDRESS_A (END_OF_MEMORY - BRICKLET_PLUGIN_MAX_SIZE*1)
@@ -355,6 +355,11 @@ void bricklet_tick_task(const uint8_t tick_type) {
 	}
 #endif
 
+#ifdef BRICK_HAS_CO_MCU_SUPPORT
+	uint8_t co_mcu[BRICKLET_NUM];
+	uint8_t co_mcu_num = 0;
+#endif
+
 	for(uint8_t i = 0; i < BRICKLET_NUM; i++) {
 		switch(bricklet_attached[i]) {
 			case BRICKLET_INIT_PROTOCOL_VERSION_2: {
@@ -366,7 +371,7 @@ void bricklet_tick_task(const uint8_t tick_type) {
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
 			case BRICKLET_INIT_CO_MCU: {
 				if(tick_type == TICK_TASK_TYPE_MESSAGE) {
-					bricklet_co_mcu_poll(i);
+					co_mcu[co_mcu_num++] = i;
 				}
 				break;
 			}
@@ -375,6 +380,14 @@ void bricklet_tick_task(const uint8_t tick_type) {
 			default: break;
 		}
 	}
+
+#ifdef BRICK_HAS_CO_MCU_SUPPORT
+	// Co MCU Bricklets are polled together, so that ports which
+	// share PIO controllers can be bit-banged at the same time
+	if(co_mcu_num > 0) {
+		bricklet_co_mcu_poll_all(co_mcu, co_mcu_num);
+	}
+#endif
 }
 
 
@@ -34,6 +34,9 @@
 	#define spi_stack_init no_init
 	#define spi_stack_send no_send
 	#define spi_stack_recv no_recv
+	#define spi_stack_recv_frame NULL
+	#define spi_stack_recv_release NULL
+	#define spi_stack_send_v NULL
 #endif
 
 ComInfo com_info = {
@@ -46,8 +49,8 @@ ComInfo com_info = {
 
 Com com_list[] = {
 	{COM_NONE, no_init, no_send, no_recv},
-	{COM_USB, usb_init, usb_send, usb_recv},
-	{COM_SPI_STACK, NULL, spi_stack_send, spi_stack_recv},
+	{COM_USB, usb_init, usb_send, usb_recv, usb_recv_frame, usb_recv_release, usb_send_v},
+	{COM_SPI_STACK, NULL, spi_stack_send, spi_stack_recv, spi_stack_recv_frame, spi_stack_recv_release, spi_stack_send_v},
 	COM_EXTENSIONS
 };
 
@@ -64,3 +67,4 @@ uint32_t com_blocking_timeout[] = {
 };
 
 uint32_t com_timeout_count[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+uint32_t com_recv_discard_count[8] = {0, 0, 0, 0, 0, 0, 0, 0};
@@ -37,6 +37,8 @@ typedef enum {
 	COM_WIFI2     = 7,
 } ComType;
 
+#define COM_TYPE_NUM  8
+
 typedef enum {
 	COM_TYPE_NONE   = 0,
 	COM_TYPE_MASTER = 1,
@@ -71,20 +73,44 @@ typedef struct Com Com;
 #define INIT(com) com_list[com]->init()
 #define SEND(data, length, com, options) com_list[com].send(data, length, options)
 #define RECV(data, length, com, options) com_list[com].recv(data, length, options)
+#define RECV_FRAME(length, com) com_list[com].recv_frame(length)
+#define RECV_RELEASE(com) com_list[com].recv_release()
+#define SEND_V(iov, iov_num, com, options) com_list[com].send_v(iov, iov_num, options)
 
 typedef bool (*function_init_t)();
 typedef uint16_t (*function_send_t)(const void *data, const uint16_t length, uint32_t *options);
 typedef uint16_t (*function_recv_t)(void *data, const uint16_t length, uint32_t *options);
 
+// Optional receive API without copy: recv_frame returns a pointer to a
+// complete frame in the buffer of the transport (or NULL). The frame stays
+// valid (and may be modified) until recv_release is called.
+typedef void* (*function_recv_frame_t)(uint16_t *length);
+typedef void (*function_recv_release_t)(void);
+
+// Optional vectored send API: send_v assembles the message from iov_num
+// segments (e.g. header and payload) directly in the buffer of the transport.
+// In contrast to send it sends everything or nothing, it returns the
+// complete length or 0. Use com_send_v for transports without send_v.
+typedef struct {
+	const void *data;
+	uint16_t length;
+} ComIOVec;
+
+typedef uint16_t (*function_send_v_t)(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options);
+
 struct Com {
 	ComType type;
 
 	function_init_t init;
 	function_send_t send;
 	function_recv_t recv;
+	function_recv_frame_t recv_frame;
+	function_recv_release_t recv_release;
+	function_send_v_t send_v;
 };
 
 extern Com com_list[];
 extern uint32_t com_timeout_count[];
+extern uint32_t com_recv_discard_count[];
 
 #endif
@@ -24,6 +24,7 @@
 #include "com_messages.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include "bricklib/free_rtos/include/FreeRTOS.h"
@@ -38,6 +39,7 @@
 #include "bricklib/drivers/wdt/wdt.h"
 #include "bricklib/utility/util_definitions.h"
 #include "bricklib/utility/led.h"
+#include "bricklib/utility/mutex.h"
 #include "bricklib/utility/system_timer.h"
 
 #ifdef BRICK_CAN_BE_MASTER
@@ -46,6 +48,10 @@
 #endif
 #endif
 
+#ifdef PROFILING
+#include "bricklib/utility/profiling.h"
+#endif
+
 extern uint32_t led_rxtx;
 extern uint32_t com_blocking_timeout[];
 
@@ -54,10 +60,333 @@ extern const BrickletAddress baddr[];
 extern BrickletSettings bs[];
 extern uint8_t bricklet_attached[];
 
+// Binary semaphore per transport that is given whenever new data may be
+// available. It is only created by transports that support it, all other
+// transports are polled by com_message_loop as before.
+static Mutex com_recv_event[COM_TYPE_NUM] = {NULL};
+
+// Requests that were forwarded (to a co-processor Bricklet or a stack
+// participant) and the transport that the response has to be send to.
+typedef struct {
+	uint32_t uid;
+	uint8_t fid;
+	uint8_t sequence_num;
+	ComType com;
+} ComRequestOrigin;
+
+static ComRequestOrigin com_request_origin[COM_REQUEST_ORIGIN_NUM];
+static uint8_t com_request_origin_next = 0;
+
+// Bitmask of transports that delivered messages, callbacks are send to all of
+// them (a subscription expires if a send to the transport times out)
+static uint8_t com_subscribed = 0;
+
+static void com_subscription_add(const ComType com) {
+	__disable_irq();
+	com_subscribed |= 1 << com;
+	__enable_irq();
+}
+
+// A transport that does not take a message in time (e.g. the USB cable was
+// pulled or brickd is gone) does not get callbacks anymore until it sends
+// the next message, so it does not slow down the callbacks to the others.
+static void com_subscription_expire(const ComType com) {
+	__disable_irq();
+	com_subscribed &= ~(1 << com);
+	__enable_irq();
+}
+
+static void com_send_timed_out(const ComType com) {
+	com_timeout_count[com]++;
+	com_subscription_expire(com);
+}
+
+#ifdef PROFILING
+#define COM_PROFILING_PRINT_INTERVAL 10000 // in ms
+
+// Statistics for the message path (from the end of the receive in
+// com_message_loop until the handler and all of its sends returned)
+static ProfilingCycles com_profiling_message;
+static uint32_t com_profiling_bytes_copied = 0;
+static uint32_t com_profiling_time_start = 0;
+
+static void com_profiling_message_done(const uint32_t cycles) {
+	if(com_profiling_time_start == 0) {
+		profiling_cycles_reset(&com_profiling_message);
+		com_profiling_bytes_copied = 0;
+		com_profiling_time_start = system_timer_get_ms();
+		return;
+	}
+
+	profiling_cycles_add(&com_profiling_message, cycles);
+
+	const uint32_t elapsed = system_timer_get_ms() - com_profiling_time_start;
+	if(elapsed >= COM_PROFILING_PRINT_INTERVAL) {
+		logi("Message path: %"PRIu32" messages/s, %"PRIu32" bytes copied/message\n\r",
+		     com_profiling_message.count*1000/elapsed,
+		     com_profiling_bytes_copied/com_profiling_message.count);
+		profiling_cycles_print("Message path", &com_profiling_message);
+		com_messages_profiling_print();
+
+		profiling_cycles_reset(&com_profiling_message);
+		com_profiling_bytes_copied = 0;
+		com_profiling_time_start = system_timer_get_ms();
+	}
+}
+#endif
+
+#define COM_TX_QUEUE_FLAG_OPTIONS    (1 << 0)
+#define COM_TX_QUEUE_FLAG_NO_TIMEOUT (1 << 1)
+
+// TX queue per transport. It is only registered by transports that can
+// drain it from their send completion path (see com_tx_queue_drain),
+// all other transports are send to with the blocking send loop as before.
+static ComTXQueue *com_tx_queue[COM_TYPE_NUM] = {NULL};
+
+void com_tx_queue_init(const ComType com, ComTXQueue *queue, uint8_t *buffer, const uint16_t size) {
+	ringbuffer_init(&queue->rb, size, buffer);
+	queue->drop_count              = 0;
+	queue->messages                = 0;
+	queue->messages_high_watermark = 0;
+	queue->draining                = false;
+	queue->drain_again             = false;
+
+	com_tx_queue[com] = queue;
+}
+
+const ComTXQueue* com_tx_queue_get(const ComType com) {
+	return com_tx_queue[com];
+}
+
+static void com_tx_queue_peek(const ComTXQueue *queue, uint8_t *data, const uint16_t length) {
+	uint16_t pos = queue->rb.start;
+	for(uint16_t i = 0; i < length; i++) {
+		data[i] = queue->rb.buffer[pos];
+		pos++;
+		if(pos >= queue->rb.size) {
+			pos = 0;
+		}
+	}
+}
+
+static bool com_tx_queue_add(ComTXQueue *queue,
+                             const void *data,
+                             const uint16_t length,
+                             const uint32_t *options,
+                             const bool timeout) {
+	uint8_t header[COM_TX_QUEUE_ENTRY_HEADER_SIZE];
+	const uint32_t value = options == NULL ? 0 : *options;
+	const uint32_t time = system_timer_get_ms();
+
+	header[0] = length;
+	header[1] = (options == NULL ? 0 : COM_TX_QUEUE_FLAG_OPTIONS) |
+	            (timeout ? 0 : COM_TX_QUEUE_FLAG_NO_TIMEOUT);
+	memcpy(&header[2], &value, sizeof(uint32_t));
+	memcpy(&header[6], &time, sizeof(uint32_t));
+
+	__disable_irq();
+	// The ringbuffer can hold at most size-1 bytes
+	if(ringbuffer_get_free(&queue->rb) <= COM_TX_QUEUE_ENTRY_HEADER_SIZE + length) {
+		__enable_irq();
+		return false;
+	}
+
+	for(uint8_t i = 0; i < COM_TX_QUEUE_ENTRY_HEADER_SIZE; i++) {
+		ringbuffer_add(&queue->rb, header[i]);
+	}
+	for(uint8_t i = 0; i < length; i++) {
+		ringbuffer_add(&queue->rb, ((const uint8_t*)data)[i]);
+	}
+
+	// Update low watermark of free bytes
+	ringbuffer_get_free(&queue->rb);
+
+	queue->messages++;
+	if(queue->messages > queue->messages_high_watermark) {
+		queue->messages_high_watermark = queue->messages;
+	}
+	__enable_irq();
+
+	return true;
+}
+
+// Only one context at a time sends from the queue or past it (see
+// com_tx_queue_send_direct). A context that finds the queue busy asks the
+// owner to drain again, so a send buffer that is freed or a message that
+// is queued in the meantime is not missed.
+static bool com_tx_queue_acquire(ComTXQueue *queue) {
+	__disable_irq();
+	if(queue->draining) {
+		queue->drain_again = true;
+		__enable_irq();
+		return false;
+	}
+	queue->draining    = true;
+	queue->drain_again = false;
+	__enable_irq();
+
+	return true;
+}
+
+// Returns false if the owner has to drain again before the queue is released
+static bool com_tx_queue_release(ComTXQueue *queue) {
+	__disable_irq();
+	if(queue->drain_again) {
+		queue->drain_again = false;
+		__enable_irq();
+		return false;
+	}
+	queue->draining = false;
+	__enable_irq();
+
+	return true;
+}
+
+// The payload of the first entry, it is split in two if it wraps around
+// the end of the ringbuffer
+static uint8_t com_tx_queue_payload(const ComTXQueue *queue, const uint8_t length, ComIOVec *iov) {
+	uint16_t pos = queue->rb.start + COM_TX_QUEUE_ENTRY_HEADER_SIZE;
+	if(pos >= queue->rb.size) {
+		pos -= queue->rb.size;
+	}
+
+	iov[0].data   = &queue->rb.buffer[pos];
+	iov[0].length = MIN(length, queue->rb.size - pos);
+	if(iov[0].length == length) {
+		return 1;
+	}
+
+	iov[1].data   = queue->rb.buffer;
+	iov[1].length = length - iov[0].length;
+	return 2;
+}
+
+// Sends as many queued messages as the transport accepts, the caller has to
+// own the queue. The payload is handed to the transport directly from the
+// ringbuffer, since this also runs in the send completion interrupt only
+// the entry header is copied to the stack.
+static void com_tx_queue_drain_owned(ComTXQueue *queue, const ComType com) {
+	uint8_t header[COM_TX_QUEUE_ENTRY_HEADER_SIZE];
+	ComIOVec iov[2];
+
+	while(!ringbuffer_is_empty(&queue->rb)) {
+		com_tx_queue_peek(queue, header, COM_TX_QUEUE_ENTRY_HEADER_SIZE);
+
+		const uint8_t length = header[0];
+		const uint8_t flags = header[1];
+		uint32_t options;
+		uint32_t time;
+		memcpy(&options, &header[2], sizeof(uint32_t));
+		memcpy(&time, &header[6], sizeof(uint32_t));
+
+		if(!(flags & COM_TX_QUEUE_FLAG_NO_TIMEOUT) &&
+		   system_timer_is_time_elapsed_ms(time, com_blocking_timeout[com])) {
+			// The message did not get through in the same time that
+			// send_blocking_with_timeout would have waited, we drop it.
+			queue->drop_count++;
+			com_send_timed_out(com);
+		} else {
+			const uint8_t iov_num = com_tx_queue_payload(queue, length, iov);
+			if(com_send_v(iov,
+			              iov_num,
+			              com,
+			              (flags & COM_TX_QUEUE_FLAG_OPTIONS) ? &options : NULL) == 0) {
+				break;
+			}
+		}
+
+		__disable_irq();
+		ringbuffer_remove(&queue->rb, COM_TX_QUEUE_ENTRY_HEADER_SIZE + length);
+		queue->messages--;
+		__enable_irq();
+	}
+}
+
+// Sends as many queued messages as the transport accepts. This is called by
+// the transport whenever a send completed (may be called from interrupt) and
+// before every new send, so the order of the messages is kept.
+void com_tx_queue_drain(const ComType com) {
+	ComTXQueue *queue = com_tx_queue[com];
+	if(queue == NULL || !com_tx_queue_acquire(queue)) {
+		return;
+	}
+
+	do {
+		com_tx_queue_drain_owned(queue, com);
+	} while(!com_tx_queue_release(queue));
+}
+
+// Drains the queue and sends the message past it if the queue is empty
+// afterwards. Returns the length of the message or 0 if it was not sent
+// (the queue is busy or not empty, or the transport is busy).
+static uint16_t com_tx_queue_send_direct(ComTXQueue *queue,
+                                         const ComType com,
+                                         const ComIOVec *iov,
+                                         const uint8_t iov_num,
+                                         uint32_t *options) {
+	if(!com_tx_queue_acquire(queue)) {
+		return 0;
+	}
+
+	uint16_t length = 0;
+	do {
+		com_tx_queue_drain_owned(queue, com);
+		if(length == 0 && ringbuffer_is_empty(&queue->rb)) {
+			length = com_send_v(iov, iov_num, com, options);
+		}
+	} while(!com_tx_queue_release(queue));
+
+	return length;
+}
+
+static uint16_t com_tx_queue_send(const void *data,
+                                  const uint16_t length,
+                                  const ComType com,
+                                  uint32_t *options,
+                                  const bool timeout) {
+	ComTXQueue *queue = com_tx_queue[com];
+
+	// If nothing is queued we can try to send directly, otherwise the
+	// message has to go to the end of the queue to keep the order.
+	const ComIOVec iov = {data, length};
+	if(com_tx_queue_send_direct(queue, com, &iov, 1, options) != 0) {
+		return length;
+	}
+
+	// The caller only has to wait if the queue is full
+	const uint32_t time_start = system_timer_get_ms();
+	while(!com_tx_queue_add(queue, data, length, options, timeout)) {
+		if(timeout && system_timer_is_time_elapsed_ms(time_start, com_blocking_timeout[com])) {
+			queue->drop_count++;
+			com_send_timed_out(com);
+			return 0;
+		}
+
+		taskYIELD();
+		com_tx_queue_drain(com);
+	}
+
+	// The transport may have completed its last send before the message was
+	// added, then there is no completion left that would drain the queue
+	com_tx_queue_drain(com);
+
+	return length;
+}
+
 void send_blocking_options(const void *data,
                            const uint16_t length,
                            const ComType com,
                            uint32_t *options) {
+	if(com_batch_collect(data, length, com)) {
+		return;
+	}
+
+	if(com_tx_queue[com] != NULL && length <= MESSAGE_MAX_LENGTH) {
+		com_tx_queue_send(data, length, com, options, false);
+		led_rxtx++;
+		return;
+	}
+
 	uint16_t bytes_send = 0;
 
 	while(length - bytes_send != 0) {
@@ -79,17 +408,30 @@ uint16_t send_blocking_with_timeout_options(const void *data,
                                             const ComType com,
                                             uint32_t *options) {
 	uint16_t bytes_send = 0;
-	uint32_t time_start = system_timer_get_ms();
 
-	while(length - bytes_send != 0) {
-		if(system_timer_is_time_elapsed_ms(time_start, com_blocking_timeout[com])) {
-			com_timeout_count[com]++;
-			break;
+	if(com_batch_collect(data, length, com)) {
+		return length;
+	}
+
+	if(com_tx_queue[com] != NULL && length <= MESSAGE_MAX_LENGTH) {
+		bytes_send = com_tx_queue_send(data, length, com, options, true);
+	} else {
+		uint32_t time_start = system_timer_get_ms();
+
+		while(length - bytes_send != 0) {
+			if(system_timer_is_time_elapsed_ms(time_start, com_blocking_timeout[com])) {
+				com_send_timed_out(com);
+				break;
+			}
+			bytes_send += SEND(data + bytes_send, length - bytes_send, com, options);
+			taskYIELD();
 		}
-		bytes_send += SEND(data + bytes_send, length - bytes_send, com, options);
-		taskYIELD();
 	}
 
+#ifdef PROFILING
+	com_profiling_bytes_copied += bytes_send;
+#endif
+
 	led_rxtx++;
 	return bytes_send;
 }
@@ -100,6 +442,198 @@ uint16_t send_blocking_with_timeout(const void *data,
 	return send_blocking_with_timeout_options(data, length, com, NULL);
 }
 
+uint16_t com_iovec_length(const ComIOVec *iov, const uint8_t iov_num) {
+	uint16_t length = 0;
+	for(uint8_t i = 0; i < iov_num; i++) {
+		length += iov[i].length;
+	}
+
+	return length;
+}
+
+uint16_t com_iovec_gather(void *dest,
+                          const uint16_t size,
+                          const ComIOVec *iov,
+                          const uint8_t iov_num) {
+	const uint16_t length = com_iovec_length(iov, iov_num);
+	if(length > size) {
+		return 0;
+	}
+
+	uint8_t *pos = dest;
+	for(uint8_t i = 0; i < iov_num; i++) {
+		memcpy(pos, iov[i].data, iov[i].length);
+		pos += iov[i].length;
+	}
+
+	return length;
+}
+
+// Fallback adapter for transports without send_v: The segments are
+// gathered on the stack and handed to send as one message.
+uint16_t com_send_v(const ComIOVec *iov,
+                    const uint8_t iov_num,
+                    const ComType com,
+                    uint32_t *options) {
+	if(com_list[com].send_v != NULL) {
+		return SEND_V(iov, iov_num, com, options);
+	}
+
+	uint8_t data[MESSAGE_MAX_LENGTH];
+	const uint16_t length = com_iovec_gather(data, MESSAGE_MAX_LENGTH, iov, iov_num);
+	if(length == 0) {
+		return 0;
+	}
+
+	// A partial send can not be continued by the caller, we only
+	// accept the message if send takes all of it
+	if(SEND(data, length, com, options) != length) {
+		return 0;
+	}
+
+	return length;
+}
+
+uint16_t send_blocking_with_timeout_v(const ComIOVec *iov,
+                                      const uint8_t iov_num,
+                                      const ComType com,
+                                      uint32_t *options) {
+	// Try to assemble the message directly in the buffer of the transport.
+	// This is only allowed if the message would not overtake queued
+	// messages and if it is not part of a batch response.
+	if(com_list[com].send_v != NULL && !com_batch_is_active(com)) {
+		const uint16_t length = com_tx_queue[com] == NULL ?
+		                        SEND_V(iov, iov_num, com, options) :
+		                        com_tx_queue_send_direct(com_tx_queue[com], com, iov, iov_num, options);
+		if(length != 0) {
+			led_rxtx++;
+			return length;
+		}
+	}
+
+	// Otherwise (or if the transport is busy) we gather the message and
+	// use the usual path with TX queue and timeout
+	uint8_t data[MESSAGE_MAX_LENGTH];
+	const uint16_t length = com_iovec_gather(data, MESSAGE_MAX_LENGTH, iov, iov_num);
+	if(length == 0) {
+		return 0;
+	}
+
+	return send_blocking_with_timeout_options(data, length, com, options);
+}
+
+void com_recv_event_init(const ComType com) {
+	if(com_recv_event[com] == NULL) {
+		vSemaphoreCreateBinary(com_recv_event[com]);
+	}
+}
+
+void com_recv_event_signal(const ComType com) {
+	if(com_recv_event[com] != NULL) {
+		mutex_give(com_recv_event[com]);
+	}
+}
+
+void com_recv_event_signal_from_isr(const ComType com) {
+	if(com_recv_event[com] != NULL) {
+		int32_t higher_priority_task_woken = pdFALSE;
+		mutex_give_isr(com_recv_event[com], &higher_priority_task_woken);
+		yield_from_isr(higher_priority_task_woken);
+	}
+}
+
+void com_recv_event_wait(const ComType com) {
+	if(com_recv_event[com] == NULL) {
+		taskYIELD();
+		return;
+	}
+
+	// Block until the transport signals new data (or the timeout elapsed).
+	// If the event was given between the last RECV and now, we return
+	// immediately, so no data can be missed.
+	mutex_take(com_recv_event[com], COM_RECV_EVENT_TIMEOUT);
+}
+
+// The table and com_subscribed are used by the message loops of all
+// transports and by the Bricklet/stack code that forwards the responses
+// (the TX queue drain also runs in interrupts), we access them with
+// disabled interrupts.
+void com_request_origin_add(const MessageHeader *header, const ComType com) {
+	__disable_irq();
+
+	// A request with the same uid, fid and sequence number that is still
+	// in the table has timed out, we reuse its entry.
+	uint8_t i = 0;
+	for(; i < COM_REQUEST_ORIGIN_NUM; i++) {
+		if(com_request_origin[i].com != COM_NONE &&
+		   com_request_origin[i].uid == header->uid &&
+		   com_request_origin[i].fid == header->fid &&
+		   com_request_origin[i].sequence_num == header->sequence_num) {
+			break;
+		}
+	}
+
+	// Otherwise the oldest entry is overwritten
+	if(i == COM_REQUEST_ORIGIN_NUM) {
+		i = com_request_origin_next;
+		com_request_origin_next = (com_request_origin_next + 1) % COM_REQUEST_ORIGIN_NUM;
+	}
+
+	com_request_origin[i].uid          = header->uid;
+	com_request_origin[i].fid          = header->fid;
+	com_request_origin[i].sequence_num = header->sequence_num;
+	com_request_origin[i].com          = com;
+
+	__enable_irq();
+}
+
+// Returns the bitmask of transports that a message from a co-processor
+// Bricklet or a stack participant has to be send to: A response goes to the
+// transport of the request, a callback goes to all subscribed transports.
+uint8_t com_get_reply_targets(const MessageHeader *header) {
+	uint8_t targets = 0;
+
+	__disable_irq();
+	if(header->sequence_num != 0) {
+		for(uint8_t i = 0; i < COM_REQUEST_ORIGIN_NUM; i++) {
+			if(com_request_origin[i].com != COM_NONE &&
+			   com_request_origin[i].uid == header->uid &&
+			   com_request_origin[i].fid == header->fid &&
+			   com_request_origin[i].sequence_num == header->sequence_num) {
+				targets = 1 << com_request_origin[i].com;
+				com_request_origin[i].com = COM_NONE;
+				break;
+			}
+		}
+	} else {
+		targets = com_subscribed;
+	}
+	__enable_irq();
+
+	if(targets != 0) {
+		return targets;
+	}
+
+	// Origin unknown, we use the transport of the last request
+	if(com_info.current == COM_NONE) {
+		return 0;
+	}
+
+	return 1 << com_info.current;
+}
+
+// Checks the header fields that are known without knowing the device,
+// used to find the start of the next message if a transport is out of sync.
+bool com_message_header_is_valid(const void *data) {
+	const MessageHeader *header = data;
+
+	return (header->length >= SIZE_OF_MESSAGE_HEADER) &&
+	       (header->length <= MESSAGE_MAX_LENGTH) &&
+	       (header->fid != 0) &&
+	       (header->other_options == 0) &&
+	       (header->future_use == 0);
+}
+
 void com_handle_setter(const ComType com, void *message) {
 	MessageHeader *header = message;
 	if(header->return_expected) {
@@ -124,31 +658,91 @@ void com_make_default_header(void *message,
 	header->future_use       = 0;
 }
 
+// Message loop for transports that lend out complete frames, the frame is
+// handled in place in the buffer of the transport.
+static void com_message_loop_frame(const MessageLoopParameter *mlp) {
+	char *data;
+	uint16_t length;
+
+	while(true) {
+		data = RECV_FRAME(&length, mlp->com_type);
+		if(data == NULL) {
+			com_recv_event_wait(mlp->com_type);
+			continue;
+		}
+
+		// The transport lends out whole frames, so there is nothing to
+		// resynchronise here. We only make sure that the frame is plausible.
+		if(!com_message_header_is_valid(data) || ((MessageHeader*)data)->length > length) {
+			com_recv_discard_count[mlp->com_type] += length;
+			RECV_RELEASE(mlp->com_type);
+			continue;
+		}
+		length = ((MessageHeader*)data)->length;
+
+		led_rxtx++;
+#ifdef PROFILING
+		const uint32_t cycles_start = PROFILING_CYCLES_GET();
+		mlp->return_func(data, length);
+		com_profiling_message_done(PROFILING_CYCLES_SINCE(cycles_start));
+#else
+		mlp->return_func(data, length);
+#endif
+		RECV_RELEASE(mlp->com_type);
+		taskYIELD();
+	}
+}
+
 void com_message_loop(void *parameters) {
 	MessageLoopParameter *mlp = (MessageLoopParameter*)parameters;
 
+	if(com_list[mlp->com_type].recv_frame != NULL) {
+		com_message_loop_frame(mlp);
+		return;
+	}
+
 	char data[mlp->buffer_size];
 	int32_t length;
 	int32_t received;
+	uint32_t discarded;
 
 	while(true) {
 		length = 0;
+		discarded = 0;
+
+		while(true) {
+			// Only read the header here, so there are never bytes of the
+			// following message in the buffer that we would need to keep.
+			while(length < SIZE_OF_MESSAGE_HEADER) {
+				received = RECV(data + length,
+				                SIZE_OF_MESSAGE_HEADER - length,
+				                mlp->com_type,
+				                NULL);
+				if(received == 0) {
+					com_recv_event_wait(mlp->com_type);
+				} else {
+					length += received;
+				}
+			}
 
-		while(length < SIZE_OF_MESSAGE_HEADER) {
-			received = RECV(data + length,
-			                mlp->buffer_size - length,
-			                mlp->com_type,
-			                NULL);
-			if(received == 0) {
-				taskYIELD();
-			} else {
-				length += received;
+			if(com_message_header_is_valid(data) &&
+			   (((MessageHeader*)data)->length <= mlp->buffer_size)) {
+				break;
 			}
+
+			// Out of sync: Throw away the first byte and check if the
+			// following bytes are the start of a valid header.
+			length--;
+			memmove(data, data + 1, length);
+			com_recv_discard_count[mlp->com_type]++;
+			discarded++;
 		}
 
-		MessageHeader *header = (MessageHeader*)data;
+		if(discarded > 0) {
+			logw("Com %d out of sync, discarded %"PRIu32" bytes\n\r", mlp->com_type, discarded);
+		}
 
-		// TODO: If header->length > 80: Out-Of-Sync-Handling
+		MessageHeader *header = (MessageHeader*)data;
 
 		while(length < header->length) {
 			received = RECV(data + length,
@@ -156,7 +750,7 @@ void com_message_loop(void *parameters) {
 			                mlp->com_type,
 			                NULL);
 			if(received == 0) {
-				taskYIELD();
+				com_recv_event_wait(mlp->com_type);
 			} else {
 				length += received;
 			}
@@ -165,7 +759,14 @@ void com_message_loop(void *parameters) {
 		// com_debug_message(header);
 
 		led_rxtx++;
+#ifdef PROFILING
+		com_profiling_bytes_copied += length;
+		const uint32_t cycles_start = PROFILING_CYCLES_GET();
+		mlp->return_func(data, header->length);
+		com_profiling_message_done(PROFILING_CYCLES_SINCE(cycles_start));
+#else
 		mlp->return_func(data, header->length);
+#endif
 		taskYIELD();
 	}
 }
@@ -174,20 +775,51 @@ void com_route_message_from_pc(const char *data, const uint16_t length, const Co
 	if(!com_route_message_brick(data, length, com)) {
 #ifdef BRICK_CAN_BE_MASTER
 #ifndef BRICK_EXCLUDE_BRICKD
+		const MessageHeader *header = (const MessageHeader*)data;
+		if(header->uid != 0 && header->return_expected) {
+			com_request_origin_add(header, com);
+		}
+
 		routing_master_from_pc(data, length, com);
 #endif
 #endif
 	}
 }
 
+// Calls the handler of a com_messages entry. Requests with a length that does not
+// match the request struct of the handler are answered with an error instead.
+static void com_call_reply_func(const ComType com, const ComMessage *com_message, const char *data) {
+	if(!com_message_length_is_valid(com_message, (const MessageHeader*)data)) {
+		com_return_error(data,
+		                 MAX(com_message->response_length, sizeof(MessageHeader)),
+		                 MESSAGE_ERROR_CODE_INVALID_PARAMETER,
+		                 com);
+		return;
+	}
+
+#ifdef PROFILING
+	const uint32_t cycles_start = PROFILING_CYCLES_GET();
+	com_message->reply_func(com, (void*)data);
+	com_messages_profiling_add(com_message, PROFILING_CYCLES_SINCE(cycles_start));
+#else
+	com_message->reply_func(com, (void*)data);
+#endif
+}
+
 bool com_route_message_brick(const char *data, const uint16_t length, const ComType com) {
 	com_info.current = com;
+	if(com != COM_NONE) {
+		com_subscription_add(com);
+	}
 
 	MessageHeader *header = (MessageHeader*)data;
 	if(header->uid == 0) {
 		const ComMessage *com_message = get_com_from_header(header);
 		if(com_message != NULL && com_message->reply_func != NULL) {
-			com_message->reply_func(com, (void*)data);
+			// Broadcasts with unexpected length are ignored, there is nobody to return an error to
+			if(com_message_length_is_valid(com_message, header)) {
+				com_call_reply_func(com, com_message, data);
+			}
 		}
 
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
@@ -202,7 +834,7 @@ bool com_route_message_brick(const char *data, const uint16_t length, const ComT
 	} else if(header->uid == com_info.uid) {
 		const ComMessage *com_message = get_com_from_header(header);
 		if(com_message != NULL && com_message->reply_func != NULL) {
-			com_message->reply_func(com, (void*)data);
+			com_call_reply_func(com, com_message, data);
 			return true;
 		} else {
 			com_return_error(data, sizeof(MessageHeader), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
@@ -217,6 +849,9 @@ bool com_route_message_brick(const char *data, const uint16_t length, const ComT
 		if((bs[i].uid == header->uid) || (bs[i].uid_isolator == header->uid)) {
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
 			if(bricklet_attached[i] == BRICKLET_INIT_CO_MCU) {
+				if(header->return_expected) {
+					com_request_origin_add(header, com);
+				}
 				bricklet_co_mcu_send(i, (void*)data, length);
 			} else 
 #endif
@@ -224,7 +859,7 @@ bool com_route_message_brick(const char *data, const uint16_t length, const ComT
 			if(header->fid == FID_GET_IDENTITY) {
 				const ComMessage *com_message = get_com_from_header(header);
 				if(com_message != NULL && com_message->reply_func != NULL) {
-					com_message->reply_func(com, (void*)data);
+					com_call_reply_func(com, com_message, data);
 					return true;
 				} else {
 					com_return_error(data, sizeof(MessageHeader), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
@@ -246,15 +881,20 @@ void com_return_error(const void *data, const uint8_t ret_length, const uint8_t
 		return;
 	}
 
-	uint8_t ret_data[ret_length];
-	MessageHeader *ret_message = (MessageHeader*)&ret_data;
+	// The payload of an error response is all zero, it is taken from a
+	// constant buffer and not build on the stack
+	static const uint8_t zero_payload[MESSAGE_MAX_LENGTH - sizeof(MessageHeader)] = {0};
+
+	MessageHeader ret_header = *message;
+	ret_header.length = MAX(ret_length, sizeof(MessageHeader));
+	ret_header.error = error_code;
 
-	memset(ret_data, 0, ret_length);
-	*ret_message = *message;
-	ret_message->length = ret_length;
-	ret_message->error = error_code;
+	const ComIOVec iov[2] = {
+		{&ret_header, sizeof(MessageHeader)},
+		{zero_payload, MIN(ret_header.length, MESSAGE_MAX_LENGTH) - sizeof(MessageHeader)}
+	};
 
-	send_blocking_with_timeout(ret_data, ret_length, com);
+	send_blocking_with_timeout_v(iov, 2, com, NULL);
 }
 
 void com_return_setter(const ComType com, const void *data) {
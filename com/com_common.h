@@ -26,9 +26,33 @@
 #include <stdint.h>
 
 #include "com.h"
+#include "bricklib/utility/ringbuffer.h"
 
 #define MESSAGE_LOOP_SIZE 550
 
+// Maximum time (in ticks) that com_message_loop blocks on the receive event
+// of a transport. Transports that need to be polled regardless of incoming
+// data (e.g. stack enumeration timer) are still polled with this period.
+#define COM_RECV_EVENT_TIMEOUT 1
+
+// FreeRTOS API functions may only be called from interrupts with a priority
+// at or below configMAX_SYSCALL_INTERRUPT_PRIORITY. Transports only use the
+// receive event if their interrupt priority allows it.
+#define COM_RECV_EVENT_MIN_IRQ_PRIORITY (configMAX_SYSCALL_INTERRUPT_PRIORITY >> 4)
+
+// Size (in bytes) of the TX queue of transports that use one. Each queued
+// message needs COM_TX_QUEUE_ENTRY_HEADER_SIZE bytes in addition to its length.
+#ifndef COM_TX_QUEUE_SIZE
+#define COM_TX_QUEUE_SIZE 256
+#endif
+
+// length (1 byte), options valid (1 byte), options (4 byte), enqueue time (4 byte)
+#define COM_TX_QUEUE_ENTRY_HEADER_SIZE 10
+
+// Number of forwarded requests for which the origin transport is remembered
+// until the response arrives (see com_request_origin_add)
+#define COM_REQUEST_ORIGIN_NUM 16
+
 #define MESSAGE_EMPTY_INITIALIZER {{0}}
 
 #define MESSAGE_ERROR_CODE_OK 0
@@ -46,6 +70,8 @@ typedef struct {
 #define MESSAGE_HEADER_LENGTH_POSITION 4
 #define MESSAGE_HEADER_FID_POSITION    5
 
+#define MESSAGE_MAX_LENGTH 80
+
 typedef struct {
 	uint32_t uid;
 	uint8_t length;
@@ -63,6 +89,25 @@ typedef struct {
 	uint32_t data;
 } __attribute__((__packed__)) MessageHeaderSimple;
 
+typedef struct {
+	Ringbuffer rb;
+	uint32_t drop_count;
+	uint8_t messages;
+	uint8_t messages_high_watermark;
+	volatile bool draining;
+	volatile bool drain_again;
+} ComTXQueue;
+
+void com_recv_event_init(const ComType com);
+void com_recv_event_signal(const ComType com);
+void com_recv_event_signal_from_isr(const ComType com);
+void com_recv_event_wait(const ComType com);
+void com_tx_queue_init(const ComType com, ComTXQueue *queue, uint8_t *buffer, const uint16_t size);
+void com_tx_queue_drain(const ComType com);
+const ComTXQueue* com_tx_queue_get(const ComType com);
+bool com_message_header_is_valid(const void *data);
+void com_request_origin_add(const MessageHeader *header, const ComType com);
+uint8_t com_get_reply_targets(const MessageHeader *header);
 void com_handle_setter(const ComType com, void *message);
 void com_message_loop(void *parameters);
 void com_make_default_header(void *message,
@@ -83,6 +128,19 @@ uint16_t send_blocking_with_timeout_options(const void *data,
                                             const uint16_t length,
                                             const ComType com,
                                             uint32_t *options);
+uint16_t com_iovec_length(const ComIOVec *iov, const uint8_t iov_num);
+uint16_t com_iovec_gather(void *dest,
+                          const uint16_t size,
+                          const ComIOVec *iov,
+                          const uint8_t iov_num);
+uint16_t com_send_v(const ComIOVec *iov,
+                    const uint8_t iov_num,
+                    const ComType com,
+                    uint32_t *options);
+uint16_t send_blocking_with_timeout_v(const ComIOVec *iov,
+                                      const uint8_t iov_num,
+                                      const ComType com,
+                                      uint32_t *options);
 bool com_route_message_brick(const char *data, const uint16_t length, const ComType com);
 void com_route_message_from_pc(const char *data, const uint16_t length, const ComType com);
 void com_return_error(const void *data, const uint8_t ret_length, const uint8_t error_code, const ComType com);
@@ -22,7 +22,13 @@
 #include "com_messages.h"
 
 #include <string.h>
+#include <inttypes.h>
 #include "bricklib/drivers/usb/USBD.h"
+#include "bricklib/com/usb/usb.h"
+#include "bricklib/com/spi/spi_stack/spi_stack_common.h"
+#ifdef BRICK_CAN_BE_MASTER
+#include "bricklib/com/spi/spi_stack/spi_stack_master_dma.h"
+#endif
 
 #include "bricklib/utility/init.h"
 #include "bricklib/utility/led.h"
@@ -33,6 +39,10 @@
 #include "bricklib/drivers/adc/adc.h"
 #include "bricklib/com/com.h"
 
+#ifdef PROFILING
+#include "bricklib/utility/profiling.h"
+#endif
+
 #include "bricklib/bricklet/bricklet_communication.h"
 #include "bricklib/bricklet/bricklet_config.h"
 #include "bricklib/bricklet/bricklet_init.h"
@@ -76,61 +86,120 @@ extern uint8_t chibi_first_message;
 
 uint32_t stack_enumerate_timer = 0;
 
+// Responses to the sub-request that execute_batch currently dispatches are
+// collected here instead of being send (see com_batch_collect). There is one
+// per transport, the message loops of several transports may run batches
+// at the same time (a handler can yield while it sends).
+typedef struct {
+	bool active;
+	uint32_t uid;
+	uint8_t fid;
+	uint8_t sequence_num;
+	uint8_t length;
+	uint8_t *buffer;
+} ComBatch;
+
+static ComBatch com_batch[COM_TYPE_NUM];
+
 const ComMessage com_messages[] = {
 	COM_NO_MESSAGE,
 	COM_MESSAGES_USER
-	{FID_CREATE_ENUMERATE_CONNECTED, (message_handler_func_t)create_enumerate_connected},
+	COM_MESSAGE(FID_GET_SPI_STACK_ERROR_COUNT, get_spi_stack_error_count, GetSPIStackErrorCount, GetSPIStackErrorCountReturn),
+	COM_MESSAGE(FID_GET_USB_STATISTICS, get_usb_statistics, GetUSBStatistics, GetUSBStatisticsReturn),
+	{FID_EXECUTE_BATCH, (message_handler_func_t)execute_batch}, // Variable request length
+	COM_MESSAGE(FID_GET_RECV_DISCARD_COUNT, get_recv_discard_count, GetRecvDiscardCount, GetRecvDiscardCountReturn),
+	COM_MESSAGE(FID_GET_SEND_QUEUE_STATUS, get_send_queue_status, GetSendQueueStatus, GetSendQueueStatusReturn),
+	COM_MESSAGE(FID_CREATE_ENUMERATE_CONNECTED, create_enumerate_connected, CreateEnumerateConnected, MessageHeader),
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
-	{FID_SET_SPITFP_BAUDRATE_CONFIG, (message_handler_func_t)set_spitfp_baudrate_config},
-	{FID_GET_SPITFP_BAUDRATE_CONFIG, (message_handler_func_t)get_spitfp_baudrate_config},
+	COM_MESSAGE(FID_SET_SPITFP_BAUDRATE_CONFIG, set_spitfp_baudrate_config, SetSPITFPBaudrateConfig, MessageHeader),
+	COM_MESSAGE(FID_GET_SPITFP_BAUDRATE_CONFIG, get_spitfp_baudrate_config, GetSPITFPBaudrateConfig, GetSPITFPBaudrateConfigReturn),
 #else
 	COM_NO_MESSAGE,
 	COM_NO_MESSAGE,
 #endif
-	{FID_GET_SEND_TIMEOUT_COUNT, (message_handler_func_t)get_send_timeout_count},
+	COM_MESSAGE(FID_GET_SEND_TIMEOUT_COUNT, get_send_timeout_count, GetSendTimeoutCount, GetSendTimeoutCountReturn),
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
-	{FID_SET_SPITFP_BAUDRATE, (message_handler_func_t)set_spitfp_baudrate},
-	{FID_GET_SPITFP_BAUDRATE, (message_handler_func_t)get_spitfp_baudrate},
+	COM_MESSAGE(FID_SET_SPITFP_BAUDRATE, set_spitfp_baudrate, SetSPITFPBaudrate, MessageHeader),
+	COM_MESSAGE(FID_GET_SPITFP_BAUDRATE, get_spitfp_baudrate, GetSPITFPBaudrate, GetSPITFPBaudrateReturn),
 	COM_NO_MESSAGE, // FID 236 is reserved
-	{FID_GET_SPITFP_ERROR_COUNT, (message_handler_func_t)get_spitfp_error_count},
+	COM_MESSAGE(FID_GET_SPITFP_ERROR_COUNT, get_spitfp_error_count, GetSPITFPErrorCount, GetSPITFPErrorCountReturn),
 #else
 	COM_NO_MESSAGE,
 	COM_NO_MESSAGE,
 	COM_NO_MESSAGE,
 	COM_NO_MESSAGE,
 #endif
-	{FID_ENABLE_STATUS_LED, (message_handler_func_t)enable_status_led},
-	{FID_DISABLE_STATUS_LED, (message_handler_func_t)disable_status_led},
-	{FID_IS_STATUS_LED_ENABLED, (message_handler_func_t)is_status_led_enabled},
-	{FID_GET_PROTOCOL1_BRICKLET_NAME, (message_handler_func_t)get_protocol1_bricklet_name},
-	{FID_GET_CHIP_TEMPERATURE, (message_handler_func_t)get_chip_temperature},
-	{FID_RESET, (message_handler_func_t)reset},
+	COM_MESSAGE(FID_ENABLE_STATUS_LED, enable_status_led, EnableStatusLED, MessageHeader),
+	COM_MESSAGE(FID_DISABLE_STATUS_LED, disable_status_led, DisableStatusLED, MessageHeader),
+	COM_MESSAGE(FID_IS_STATUS_LED_ENABLED, is_status_led_enabled, IsStatusLEDEnabled, IsStatusLEDEnabledReturn),
+	COM_MESSAGE(FID_GET_PROTOCOL1_BRICKLET_NAME, get_protocol1_bricklet_name, GetProtocol1BrickletName, GetProtocol1BrickletNameReturn),
+	COM_MESSAGE(FID_GET_CHIP_TEMPERATURE, get_chip_temperature, GetChipTemperature, GetChipTemperatureReturn),
+	COM_MESSAGE(FID_RESET, reset, Reset, MessageHeader),
 	COM_MESSAGES_BRICKLET
-	{FID_GET_ADC_CALIBRATION, (message_handler_func_t)get_adc_calibration},
-	{FID_ADC_CALIBRATE, (message_handler_func_t)com_adc_calibrate},
-	{FID_STACK_ENUMERATE, (message_handler_func_t)stack_enumerate},
+	COM_MESSAGE(FID_GET_ADC_CALIBRATION, get_adc_calibration, GetADCCalibration, GetADCCalibrationReturn),
+	COM_MESSAGE(FID_ADC_CALIBRATE, com_adc_calibrate, ADCCalibrate, MessageHeader),
+	COM_MESSAGE(FID_STACK_ENUMERATE, stack_enumerate, StackEnumerate, StackEnumerateReturn),
 	{FID_ENUMERATE_CALLBACK, (message_handler_func_t)NULL},
-	{FID_ENUMERATE, (message_handler_func_t)enumerate},
-	{FID_GET_IDENTITY, (message_handler_func_t)get_identity}
+	COM_MESSAGE(FID_ENUMERATE, enumerate, Enumerate, MessageHeader),
+	COM_MESSAGE(FID_GET_IDENTITY, get_identity, GetIdentity, GetIdentityReturn)
 };
 
 const uint8_t COM_MESSAGES_NUM = (sizeof(com_messages) / sizeof(ComMessage));
 
+_Static_assert((sizeof(com_messages) / sizeof(ComMessage)) == COM_MESSAGE_USER_LAST_FID + 1 + COM_GENERAL_FID_NUM,
+               "com_messages does not match COM_MESSAGE_USER_LAST_FID");
+
+// The user messages are at index 0 to COM_MESSAGE_USER_LAST_FID and are
+// followed directly by the general messages.
 const ComMessage* get_com_from_header(const MessageHeader *header) {
-	uint8_t fid = 0;
-	if(header->fid < COM_GENERAL_FID_MAX) {
-		fid = header->fid;
-		if(fid > COM_MESSAGE_USER_LAST_FID) {
-			return NULL;
-		}
-	} else {
-		fid = COM_MESSAGES_NUM - 1 - 255 + header->fid;
-		if(fid > COM_MESSAGES_NUM) {
-			return NULL;
+	uint8_t index = header->fid;
+	if(index >= COM_GENERAL_FID_FIRST) {
+		index = index - COM_GENERAL_FID_FIRST + COM_MESSAGE_USER_LAST_FID + 1;
+	} else if(index > COM_MESSAGE_USER_LAST_FID) {
+		return NULL;
+	}
+
+	return &com_messages[index];
+}
+
+#ifdef PROFILING
+typedef struct {
+	uint32_t count;
+	uint32_t cycles_sum;
+	uint32_t cycles_max;
+} ComMessageProfiling;
+
+// Handler cost per entry of com_messages
+static ComMessageProfiling com_messages_profiling[sizeof(com_messages) / sizeof(ComMessage)];
+
+void com_messages_profiling_add(const ComMessage *com_message, const uint32_t cycles) {
+	ComMessageProfiling *cmp = &com_messages_profiling[com_message - com_messages];
+
+	cmp->count++;
+	cmp->cycles_sum += cycles;
+	if(cycles > cmp->cycles_max) {
+		cmp->cycles_max = cycles;
+	}
+}
+
+void com_messages_profiling_print(void) {
+	for(uint8_t i = 0; i < COM_MESSAGES_NUM; i++) {
+		ComMessageProfiling *cmp = &com_messages_profiling[i];
+		if(cmp->count > 0) {
+			logi("FID %d: %"PRIu32" calls, avg %"PRIu32", max %"PRIu32" cycles\n\r",
+			     com_messages[i].type,
+			     cmp->count,
+			     cmp->cycles_sum/cmp->count,
+			     cmp->cycles_max);
 		}
 	}
 
-	return &com_messages[fid];
+	memset(com_messages_profiling, 0, sizeof(com_messages_profiling));
+}
+#endif
+
+bool com_message_length_is_valid(const ComMessage *com_message, const MessageHeader *header) {
+	return (com_message->request_length == 0) || (com_message->request_length == header->length);
 }
 
 void reset(const ComType com, const Reset *data) {
@@ -141,6 +210,188 @@ void reset(const ComType com, const Reset *data) {
 	brick_reset();
 }
 
+bool com_batch_is_active(const ComType com) {
+	return com_batch[com].active;
+}
+
+bool com_batch_collect(const void *data, const uint16_t length, const ComType com) {
+	const MessageHeader *header = data;
+	ComBatch *batch = &com_batch[com];
+
+	if(!batch->active || length < sizeof(MessageHeader)) {
+		return false;
+	}
+
+	// Only the response to the current sub-request is collected,
+	// callbacks and other messages are send as usual
+	if(header->uid != batch->uid ||
+	   header->fid != batch->fid ||
+	   header->sequence_num != batch->sequence_num) {
+		return false;
+	}
+
+	// If the response does not fit anymore it is send on its own
+	if(batch->length + length > sizeof(((ExecuteBatchReturn*)NULL)->responses)) {
+		return false;
+	}
+
+	memcpy(batch->buffer + batch->length, data, length);
+	batch->length += length;
+
+	return true;
+}
+
+void execute_batch(const ComType com, const ExecuteBatch *data) {
+	ExecuteBatchReturn ebr;
+	uint8_t request[MESSAGE_MAX_LENGTH];
+	const uint8_t requests_length = data->header.length - sizeof(MessageHeader);
+	uint8_t offset = 0;
+	ComBatch *batch = &com_batch[com];
+
+	ebr.header = data->header;
+
+	batch->length = 0;
+	batch->buffer = ebr.responses;
+
+	while(offset + sizeof(MessageHeader) <= requests_length) {
+		const MessageHeader *header = (const MessageHeader*)&data->requests[offset];
+		if(!com_message_header_is_valid(header) || header->length > requests_length - offset) {
+			logd("Malformed request in batch at %d\n\r", offset);
+			break;
+		}
+
+		offset += header->length;
+
+		// Nested batches are not supported
+		if(header->fid == FID_EXECUTE_BATCH) {
+			continue;
+		}
+
+		// Handlers may write their response into the request buffer,
+		// so each request gets a copy that it can overwrite.
+		memcpy(request, header, header->length);
+
+		batch->uid          = header->uid;
+		batch->fid          = header->fid;
+		batch->sequence_num = header->sequence_num;
+		batch->active       = true;
+
+		// Only requests for this Brick are answered while the batch runs.
+		// Bricklets with co-processor and stack participants answer later
+		// (or never), so they get an error instead of being forwarded.
+		if(header->uid == com_info.uid) {
+			com_route_message_from_pc((const char*)request, header->length, com);
+		} else {
+			com_return_error(request, sizeof(MessageHeader), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
+		}
+
+		batch->active       = false;
+	}
+
+	// The collected responses are dropped if the caller does not want them
+	if(data->header.return_expected) {
+		ebr.header.length = sizeof(MessageHeader) + batch->length;
+		send_blocking_with_timeout(&ebr, ebr.header.length, com);
+	}
+}
+
+void get_spi_stack_error_count(const ComType com, const GetSPIStackErrorCount *data) {
+	if(data->stack_address < SPI_ADDRESS_MIN || data->stack_address > SPI_ADDRESS_MAX) {
+		com_return_error(data, sizeof(GetSPIStackErrorCountReturn), MESSAGE_ERROR_CODE_INVALID_PARAMETER, com);
+		logblete("Stack address %d does not exist (get_spi_stack_error_count)\n\r", data->stack_address);
+		return;
+	}
+
+	GetSPIStackErrorCountReturn gssecr = MESSAGE_EMPTY_INITIALIZER;
+
+	gssecr.header        = data->header;
+	gssecr.header.length = sizeof(GetSPIStackErrorCountReturn);
+
+	// Only the master of a stack sees the link to the slaves,
+	// on all other Bricks the counters stay 0
+#ifdef BRICK_CAN_BE_MASTER
+	const SPIStackMasterErrorCount *error_count = spi_stack_master_get_error_count(data->stack_address);
+	gssecr.busy_count           = error_count->busy_count;
+	gssecr.error_count_length   = error_count->error_count_length;
+	gssecr.error_count_checksum = error_count->error_count_checksum;
+	gssecr.duplicate_count      = error_count->duplicate_count;
+	gssecr.retry_count          = error_count->retry_count;
+#endif
+
+	send_blocking_with_timeout(&gssecr, sizeof(GetSPIStackErrorCountReturn), com);
+}
+
+void get_usb_statistics(const ComType com, const GetUSBStatistics *data) {
+	const USBStatistics *statistics = usb_get_statistics();
+	GetUSBStatisticsReturn gusr;
+
+	gusr.header                = data->header;
+	gusr.header.length         = sizeof(GetUSBStatisticsReturn);
+	gusr.bytes_in              = statistics->bytes_in;
+	gusr.bytes_out             = statistics->bytes_out;
+	gusr.resend_count          = statistics->resend_count;
+	gusr.restart_count         = statistics->restart_count;
+	gusr.out_stall_count       = usb_recv_ring_get()->stall_count;
+	gusr.suspend_count         = statistics->suspend_count;
+	gusr.suspend_time_last     = statistics->suspend_time_last;
+	gusr.resume_time_last      = statistics->resume_time_last;
+	gusr.suspend_duration_last = statistics->suspend_duration_last;
+	gusr.suspend_duration_max  = statistics->suspend_duration_max;
+	gusr.time                  = system_timer_get_ms();
+
+	send_blocking_with_timeout(&gusr, sizeof(GetUSBStatisticsReturn), com);
+}
+
+void get_recv_discard_count(const ComType com, const GetRecvDiscardCount *data) {
+#ifdef BRICK_CAN_BE_MASTER
+	if(data->communication_method > COM_WIFI2) {
+#else
+	if(data->communication_method > COM_SPI_STACK) {
+#endif
+		com_return_error(data, sizeof(GetRecvDiscardCountReturn), MESSAGE_ERROR_CODE_INVALID_PARAMETER, com);
+		logblete("Communication Method %d does not exist (get_recv_discard_count)\n\r", data->communication_method);
+		return;
+	}
+
+	GetRecvDiscardCountReturn grdcr;
+
+	grdcr.header        = data->header;
+	grdcr.header.length = sizeof(GetRecvDiscardCountReturn);
+	grdcr.discard_count = com_recv_discard_count[data->communication_method];
+
+	send_blocking_with_timeout(&grdcr, sizeof(GetRecvDiscardCountReturn), com);
+}
+
+void get_send_queue_status(const ComType com, const GetSendQueueStatus *data) {
+#ifdef BRICK_CAN_BE_MASTER
+	if(data->communication_method > COM_WIFI2) {
+#else
+	if(data->communication_method > COM_SPI_STACK) {
+#endif
+		com_return_error(data, sizeof(GetSendQueueStatusReturn), MESSAGE_ERROR_CODE_INVALID_PARAMETER, com);
+		logblete("Communication Method %d does not exist (get_send_queue_status)\n\r", data->communication_method);
+		return;
+	}
+
+	GetSendQueueStatusReturn gsqsr = MESSAGE_EMPTY_INITIALIZER;
+
+	gsqsr.header        = data->header;
+	gsqsr.header.length = sizeof(GetSendQueueStatusReturn);
+
+	// All values stay 0 if the communication method does not use a queue
+	const ComTXQueue *queue = com_tx_queue_get(data->communication_method);
+	if(queue != NULL) {
+		gsqsr.size                    = queue->rb.size - 1;
+		gsqsr.used                    = ringbuffer_get_used((Ringbuffer*)&queue->rb);
+		gsqsr.used_high_watermark     = queue->rb.size - queue->rb.low_watermark;
+		gsqsr.messages                = queue->messages;
+		gsqsr.messages_high_watermark = queue->messages_high_watermark;
+		gsqsr.drop_count              = queue->drop_count;
+	}
+
+	send_blocking_with_timeout(&gsqsr, sizeof(GetSendQueueStatusReturn), com);
+}
+
 void create_enumerate_connected(const ComType com, const CreateEnumerateConnected *data) {
 	EnumerateCallback ec = MESSAGE_EMPTY_INITIALIZER;
 	make_brick_enumerate(&ec);
@@ -36,6 +36,11 @@
 
 #define SIZE_OF_MESSAGE_HEADER 8
 
+#define FID_GET_SPI_STACK_ERROR_COUNT 225
+#define FID_GET_USB_STATISTICS 226
+#define FID_EXECUTE_BATCH 227
+#define FID_GET_RECV_DISCARD_COUNT 228
+#define FID_GET_SEND_QUEUE_STATUS 229
 #define FID_CREATE_ENUMERATE_CONNECTED 230
 
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
@@ -68,10 +73,21 @@
 #define FID_GET_IDENTITY 255
 
 #define COM_GENERAL_FID_MAX 200
+
+// General FIDs are the last entries of com_messages (FID_GET_SPI_STACK_ERROR_COUNT to FID_GET_IDENTITY)
+#define COM_GENERAL_FID_FIRST FID_GET_SPI_STACK_ERROR_COUNT
+#define COM_GENERAL_FID_NUM (256 - COM_GENERAL_FID_FIRST)
+
 #define MAX_LENGTH_NAME 40
 
 #define COM_NO_MESSAGE {0, NULL}
 
+// Entry of com_messages with known request/response structs. The request
+// length is checked before the handler is called, the response length is
+// used for the error response.
+#define COM_MESSAGE(fid, func, request, response) \
+	{fid, (message_handler_func_t)func, sizeof(request), sizeof(response)}
+
 #define STACK_PARTICIPANT_PLUG 1
 #define STACK_PARTICIPANT_UNPLUG 2
 
@@ -91,8 +107,82 @@ typedef void (*message_handler_func_t)(uint8_t, const void*);
 typedef struct {
 	uint8_t type;
 	message_handler_func_t reply_func;
+	uint8_t request_length;  // 0 = not checked (e.g. {fid, func} entries of COM_MESSAGES_USER)
+	uint8_t response_length;
 } ComMessage;
 
+// Payload of ExecuteBatch are complete TFP requests back to back, payload of
+// ExecuteBatchReturn are the responses to these requests back to back.
+// Only requests for the Brick itself are executed, requests for other UIDs
+// get an error response (MESSAGE_ERROR_CODE_NOT_SUPPORTED).
+typedef struct {
+	MessageHeader header;
+	uint8_t requests[MESSAGE_MAX_LENGTH - sizeof(MessageHeader)];
+} __attribute__((__packed__)) ExecuteBatch;
+
+typedef struct {
+	MessageHeader header;
+	uint8_t responses[MESSAGE_MAX_LENGTH - sizeof(MessageHeader)];
+} __attribute__((__packed__)) ExecuteBatchReturn;
+
+typedef struct {
+	MessageHeader header;
+	uint8_t stack_address;
+} __attribute__((__packed__)) GetSPIStackErrorCount;
+
+typedef struct {
+	MessageHeader header;
+	uint32_t busy_count;
+	uint32_t error_count_length;
+	uint32_t error_count_checksum;
+	uint32_t duplicate_count;
+	uint32_t retry_count;
+} __attribute__((__packed__)) GetSPIStackErrorCountReturn;
+
+typedef struct {
+	MessageHeader header;
+} __attribute__((__packed__)) GetUSBStatistics;
+
+typedef struct {
+	MessageHeader header;
+	uint32_t bytes_in;
+	uint32_t bytes_out;
+	uint32_t resend_count;
+	uint32_t restart_count;
+	uint32_t out_stall_count;
+	uint32_t suspend_count;
+	uint32_t suspend_time_last;
+	uint32_t resume_time_last;
+	uint32_t suspend_duration_last;
+	uint32_t suspend_duration_max;
+	uint32_t time;
+} __attribute__((__packed__)) GetUSBStatisticsReturn;
+
+typedef struct {
+	MessageHeader header;
+	uint8_t communication_method;
+} __attribute__((__packed__)) GetRecvDiscardCount;
+
+typedef struct {
+	MessageHeader header;
+	uint32_t discard_count;
+} __attribute__((__packed__)) GetRecvDiscardCountReturn;
+
+typedef struct {
+	MessageHeader header;
+	uint8_t communication_method;
+} __attribute__((__packed__)) GetSendQueueStatus;
+
+typedef struct {
+	MessageHeader header;
+	uint16_t size;
+	uint16_t used;
+	uint16_t used_high_watermark;
+	uint8_t messages;
+	uint8_t messages_high_watermark;
+	uint32_t drop_count;
+} __attribute__((__packed__)) GetSendQueueStatusReturn;
+
 typedef struct {
 	MessageHeader header;
 } __attribute__((packed)) CreateEnumerateConnected;
@@ -257,11 +347,22 @@ typedef struct {
 } __attribute__((__packed__)) GetProtocol1BrickletNameReturn;
 
 const ComMessage* get_com_from_header(const MessageHeader *header);
+bool com_message_length_is_valid(const ComMessage *com_message, const MessageHeader *header);
+#ifdef PROFILING
+void com_messages_profiling_add(const ComMessage *com_message, const uint32_t cycles);
+void com_messages_profiling_print(void);
+#endif
 uint16_t get_length_from_data(const char *data);
 uint8_t get_stack_id_from_data(const char *data);
 uint8_t get_type_from_data(const char *data);
 
-
+bool com_batch_is_active(const ComType com);
+bool com_batch_collect(const void *data, const uint16_t length, const ComType com);
+void execute_batch(const ComType com, const ExecuteBatch *data);
+void get_spi_stack_error_count(const ComType com, const GetSPIStackErrorCount *data);
+void get_usb_statistics(const ComType com, const GetUSBStatistics *data);
+void get_recv_discard_count(const ComType com, const GetRecvDiscardCount *data);
+void get_send_queue_status(const ComType com, const GetSendQueueStatus *data);
 void create_enumerate_connected(const ComType com, const CreateEnumerateConnected *data);
 
 #ifdef BRICK_HAS_CO_MCU_SUPPORT
@@ -71,6 +71,29 @@ uint16_t spi_stack_send(const void *data, const uint16_t length, uint32_t *optio
 	return send_length;
 }
 
+uint16_t spi_stack_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options) {
+	if(spi_stack_buffer_size_send > 0) {
+		return 0;
+	}
+
+	const uint16_t send_length = com_iovec_gather(spi_stack_buffer_send, SPI_STACK_BUFFER_SIZE, iov, iov_num);
+	if(send_length == 0) {
+		return 0;
+	}
+
+	if(options && *options >= SPI_ADDRESS_MIN && *options <= com_info.last_stack_address) {
+		spi_stack_send_to = *options;
+	} else {
+		spi_stack_send_to = -1;
+	}
+
+	led_rxtx++;
+
+	spi_stack_buffer_size_send = send_length;
+
+	return send_length;
+}
+
 uint16_t spi_stack_recv(void *data, const uint16_t length, uint32_t *options) {
 	if(spi_stack_buffer_size_recv == 0) {
 		return 0;
@@ -94,3 +117,18 @@ uint16_t spi_stack_recv(void *data, const uint16_t length, uint32_t *options) {
 
 	return recv_length;
 }
+
+void* spi_stack_recv_frame(uint16_t *length) {
+	if(spi_stack_buffer_size_recv == 0) {
+		return NULL;
+	}
+
+	led_rxtx++;
+
+	*length = spi_stack_buffer_size_recv;
+	return spi_stack_buffer_recv;
+}
+
+void spi_stack_recv_release(void) {
+	spi_stack_buffer_size_recv = 0;
+}
@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "bricklib/com/com.h"
 #include "bricklib/logging/logging.h"
 #include "config.h"
 
@@ -57,6 +58,9 @@
 
 
 uint16_t spi_stack_send(const void *data, const uint16_t length, uint32_t *options);
+uint16_t spi_stack_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options);
 uint16_t spi_stack_recv(void *data, const uint16_t length, uint32_t *options);
+void* spi_stack_recv_frame(uint16_t *length);
+void spi_stack_recv_release(void);
 
 #endif
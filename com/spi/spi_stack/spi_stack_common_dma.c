@@ -40,13 +40,16 @@
 #include "config.h"
 
 // Recv and send buffer for SPI stack (written by spi_stack_send/recv)
-uint8_t spi_stack_buffer_recv[SPI_STACK_MAX_MESSAGE_LENGTH] = {0};
-uint8_t spi_stack_buffer_send[SPI_STACK_MAX_MESSAGE_LENGTH] = {0};
+uint8_t spi_stack_buffer_recv[SPI_STACK_MAX_MESSAGE_LENGTH] __attribute__((aligned(4))) = {0};
+uint8_t spi_stack_buffer_send[SPI_STACK_MAX_MESSAGE_LENGTH] __attribute__((aligned(4))) = {0};
 
 // Recv and send buffer size for SPI stack (written by spi_stack_send/recv)
 uint16_t spi_stack_buffer_size_send = 0;
 uint16_t spi_stack_buffer_size_recv = 0;
 
+static uint8_t spi_stack_tx_queue_buffer[COM_TX_QUEUE_SIZE];
+static ComTXQueue spi_stack_tx_queue;
+
 #ifdef BRICK_CAN_BE_MASTER
 extern uint8_t master_mode;
 extern ComInfo com_info;
@@ -55,15 +58,37 @@ extern ComInfo com_info;
 void SPI_IrqHandler(void) {
 #ifdef BRICK_CAN_BE_MASTER
 	if(master_mode & MASTER_MODE_MASTER) {
-		spi_stack_master_irq();
+		// The message loop drives the SPI transfers through spi_stack_master_recv,
+		// we wake it up if a transfer is done (there may be new data and a transfer buffer is free)
+		if(spi_stack_master_irq()) {
+			com_recv_event_signal_from_isr(COM_SPI_STACK);
+		}
 	} else if(master_mode & MASTER_MODE_SLAVE) {
 		spi_stack_slave_irq();
+
+		// The send buffer was handed to the DMA, the next queued message can be copied
+		if(spi_stack_buffer_size_send == 0) {
+			com_tx_queue_drain(COM_SPI_STACK);
+		}
+		if(spi_stack_buffer_size_recv != 0) {
+			com_recv_event_signal_from_isr(COM_SPI_STACK);
+		}
 	}
 #else
 	spi_stack_slave_irq();
+	if(spi_stack_buffer_size_send == 0) {
+		com_tx_queue_drain(COM_SPI_STACK);
+	}
+	if(spi_stack_buffer_size_recv != 0) {
+		com_recv_event_signal_from_isr(COM_SPI_STACK);
+	}
 #endif
 }
 
+void spi_stack_tx_queue_init(void) {
+	com_tx_queue_init(COM_SPI_STACK, &spi_stack_tx_queue, spi_stack_tx_queue_buffer, COM_TX_QUEUE_SIZE);
+}
+
 void spi_stack_increase_slave_seq(uint8_t *seq) {
 	*seq = *seq + (1 << 3);
 	if(*seq > SPI_STACK_INFO_SEQUENCE_SLAVE_MASK) {
@@ -87,6 +112,224 @@ uint8_t spi_stack_calculate_pearson(const uint8_t *data, const uint8_t length) {
 	return checksum;
 }
 
+// Copies data and continues the Pearson hash over it in the same pass.
+// If source and destination are word aligned (see SPIStackDMABuffer),
+// the data is read and written a word at a time.
+uint8_t spi_stack_copy_pearson(uint8_t *dest, const uint8_t *src, const uint8_t length, uint8_t checksum) {
+	uint8_t i = 0;
+
+	if((((uint32_t)dest | (uint32_t)src) & 3) == 0) {
+		for(; i + 4 <= length; i += 4) {
+			const uint32_t word = *((const uint32_t*)(src + i));
+			*((uint32_t*)(dest + i)) = word;
+
+			// Little endian, the lowest byte comes first
+			PEARSON(checksum, (uint8_t)word);
+			PEARSON(checksum, (uint8_t)(word >> 8));
+			PEARSON(checksum, (uint8_t)(word >> 16));
+			PEARSON(checksum, (uint8_t)(word >> 24));
+		}
+	}
+
+	for(; i < length; i++) {
+		dest[i] = src[i];
+		PEARSON(checksum, src[i]);
+	}
+
+	return checksum;
+}
+
+// Same as spi_stack_copy_pearson, with CRC-16/CCITT instead of the Pearson hash
+uint16_t spi_stack_copy_crc16(uint8_t *dest, const uint8_t *src, const uint8_t length, uint16_t crc) {
+	uint8_t i = 0;
+
+	if((((uint32_t)dest | (uint32_t)src) & 3) == 0) {
+		for(; i + 4 <= length; i += 4) {
+			const uint32_t word = *((const uint32_t*)(src + i));
+			*((uint32_t*)(dest + i)) = word;
+
+			CRC16_CCITT(crc, word & 0xFF);
+			CRC16_CCITT(crc, (word >> 8) & 0xFF);
+			CRC16_CCITT(crc, (word >> 16) & 0xFF);
+			CRC16_CCITT(crc, word >> 24);
+		}
+	}
+
+	for(; i < length; i++) {
+		dest[i] = src[i];
+		CRC16_CCITT(crc, src[i]);
+	}
+
+	return crc;
+}
+
+// Returns the position of the info byte, the preamble decides
+// if there are one (Pearson) or two (CRC16) checksum bytes behind it
+uint8_t spi_stack_packet_info_position(const uint8_t *packet) {
+	if(packet[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE_CRC16) {
+		return packet[SPI_STACK_LENGTH] - 3;
+	}
+
+	return SPI_STACK_INFO(packet[SPI_STACK_LENGTH]);
+}
+
+uint8_t spi_stack_packet_payload_max(const uint8_t *packet) {
+	if(packet[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE_CRC16) {
+		return SPI_STACK_CRC16_BUFFER_SIZE;
+	}
+
+	return SPI_STACK_BUFFER_SIZE;
+}
+
+// Builds a packet from the given payload, the payload is copied while the
+// checksum is calculated. Empty packets (and short polls) always use the
+// Pearson hash, as well as payloads that don't fit with CRC16.
+void spi_stack_make_packet(uint8_t *packet, const ComIOVec *iov, const uint8_t iov_num, const uint8_t payload_length, const uint8_t info, const bool crc16) {
+	uint8_t *dest = &packet[2];
+
+	// The bytes after the checksum are ignored by the receiver, we don't need to clear them
+	if(crc16 && payload_length > 0 && payload_length <= SPI_STACK_CRC16_BUFFER_SIZE) {
+		const uint8_t length = payload_length + SPI_STACK_CRC16_OVERHEAD;
+		uint16_t crc = CRC16_CCITT_INIT;
+
+		packet[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE_CRC16;
+		packet[SPI_STACK_LENGTH] = length;
+		CRC16_CCITT(crc, SPI_STACK_PREAMBLE_VALUE_CRC16);
+		CRC16_CCITT(crc, length);
+		for(uint8_t i = 0; i < iov_num; i++) {
+			crc = spi_stack_copy_crc16(dest, iov[i].data, iov[i].length, crc);
+			dest += iov[i].length;
+		}
+
+		packet[length-3] = info;
+		CRC16_CCITT(crc, info);
+		packet[length-2] = crc >> 8;
+		packet[length-1] = crc & 0xFF;
+	} else {
+		const uint8_t length = payload_length + SPI_STACK_EMPTY_MESSAGE_LENGTH;
+		uint8_t checksum = 0;
+
+		packet[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE;
+		packet[SPI_STACK_LENGTH] = length;
+		PEARSON(checksum, SPI_STACK_PREAMBLE_VALUE);
+		PEARSON(checksum, length);
+		for(uint8_t i = 0; i < iov_num; i++) {
+			checksum = spi_stack_copy_pearson(dest, iov[i].data, iov[i].length, checksum);
+			dest += iov[i].length;
+		}
+
+		packet[SPI_STACK_INFO(length)] = info;
+		PEARSON(checksum, info);
+		packet[SPI_STACK_CHECKSUM(length)] = checksum;
+	}
+}
+
+// Updates length, info and checksum of a packet of which the payload (and
+// the preamble that decides the checksum type) was changed in place
+void spi_stack_finish_packet(uint8_t *packet, const uint8_t payload_length, const uint8_t info) {
+	if(packet[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE_CRC16) {
+		const uint8_t length = payload_length + SPI_STACK_CRC16_OVERHEAD;
+		packet[SPI_STACK_LENGTH] = length;
+		packet[length-3] = info;
+
+		const uint16_t crc = crc16_ccitt_software(packet, length-2, CRC16_CCITT_INIT);
+		packet[length-2] = crc >> 8;
+		packet[length-1] = crc & 0xFF;
+	} else {
+		const uint8_t length = payload_length + SPI_STACK_EMPTY_MESSAGE_LENGTH;
+		packet[SPI_STACK_LENGTH] = length;
+		packet[SPI_STACK_INFO(length)] = info;
+		packet[SPI_STACK_CHECKSUM(length)] = spi_stack_calculate_pearson(packet, length-1);
+	}
+}
+
+// Validates preamble, length and checksum of a received packet. If payload
+// is not NULL, the payload is copied to it while the checksum is calculated,
+// the copy is only valid if SPI_STACK_PACKET_OK is returned.
+SPIStackPacketStatus spi_stack_check_packet(const uint8_t *packet, const uint8_t received_length, uint8_t *payload, uint8_t *payload_length, uint8_t *info) {
+	const uint8_t length = packet[SPI_STACK_LENGTH];
+
+	if(packet[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE_CRC16) {
+		if((length < SPI_STACK_MESSAGE_LENGTH_MIN_CRC16) || (length > SPI_STACK_MAX_MESSAGE_LENGTH)) {
+			return SPI_STACK_PACKET_ERROR_LENGTH;
+		}
+		if(length > received_length) {
+			return SPI_STACK_PACKET_INCOMPLETE;
+		}
+
+		*payload_length = length - SPI_STACK_CRC16_OVERHEAD;
+		*info = packet[length-3];
+
+		uint16_t crc = CRC16_CCITT_INIT;
+		CRC16_CCITT(crc, packet[SPI_STACK_PREAMBLE]);
+		CRC16_CCITT(crc, length);
+		if(payload != NULL) {
+			crc = spi_stack_copy_crc16(payload, &packet[2], *payload_length, crc);
+		} else {
+			crc = crc16_ccitt_software(&packet[2], *payload_length, crc);
+		}
+		CRC16_CCITT(crc, *info);
+
+		if(crc != ((packet[length-2] << 8) | packet[length-1])) {
+			logspisw("CRC16 not proper: %x != %x\n\r", crc, (packet[length-2] << 8) | packet[length-1]);
+			return SPI_STACK_PACKET_ERROR_CHECKSUM;
+		}
+
+		return SPI_STACK_PACKET_OK;
+	}
+
+	if(packet[SPI_STACK_PREAMBLE] != SPI_STACK_PREAMBLE_VALUE) {
+		return SPI_STACK_PACKET_ERROR_PREAMBLE;
+	}
+
+	if((length != SPI_STACK_EMPTY_MESSAGE_LENGTH) &&
+	   ((length < SPI_STACK_MESSAGE_LENGTH_MIN) ||
+	    (length > SPI_STACK_MAX_MESSAGE_LENGTH))) {
+		return SPI_STACK_PACKET_ERROR_LENGTH;
+	}
+	if(length > received_length) {
+		return SPI_STACK_PACKET_INCOMPLETE;
+	}
+
+	*payload_length = length - SPI_STACK_EMPTY_MESSAGE_LENGTH;
+	*info = packet[SPI_STACK_INFO(length)];
+
+	uint8_t checksum = 0;
+	PEARSON(checksum, packet[SPI_STACK_PREAMBLE]);
+	PEARSON(checksum, length);
+	if(payload != NULL) {
+		checksum = spi_stack_copy_pearson(payload, &packet[2], *payload_length, checksum);
+	} else {
+		for(uint8_t i = 0; i < *payload_length; i++) {
+			PEARSON(checksum, packet[2+i]);
+		}
+	}
+	PEARSON(checksum, *info);
+
+	if(checksum != packet[SPI_STACK_CHECKSUM(length)]) {
+		logspisw("Checksum not proper: %x != %x\n\r", checksum, packet[SPI_STACK_CHECKSUM(length)]);
+		return SPI_STACK_PACKET_ERROR_CHECKSUM;
+	}
+
+	return SPI_STACK_PACKET_OK;
+}
+
+// Returns the length of the first message in a payload that may contain
+// several messages. A broken header is handled by the message loop, in this
+// case the whole rest of the payload is returned.
+uint8_t spi_stack_message_length(const uint8_t *data, const uint8_t length) {
+	if(length < SIZE_OF_MESSAGE_HEADER) {
+		return length;
+	}
+
+	const uint8_t message_length = ((const MessageHeader*)data)->length;
+	if(message_length < SIZE_OF_MESSAGE_HEADER || message_length > length) {
+		return length;
+	}
+
+	return message_length;
+}
+
 uint16_t spi_stack_send(const void *data, const uint16_t length, uint32_t *options) {
 #ifdef BRICK_CAN_BE_MASTER
 	if(master_mode & MASTER_MODE_MASTER) {
@@ -101,6 +344,20 @@ uint16_t spi_stack_send(const void *data, const uint16_t length, uint32_t *optio
 #endif
 }
 
+uint16_t spi_stack_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options) {
+#ifdef BRICK_CAN_BE_MASTER
+	if(master_mode & MASTER_MODE_MASTER) {
+		return spi_stack_master_send_v(iov, iov_num, options);
+	} else if(master_mode & MASTER_MODE_SLAVE) {
+		return spi_stack_slave_send_v(iov, iov_num, options);
+	} else {
+		return 0;
+	}
+#else
+	return spi_stack_slave_send_v(iov, iov_num, options);
+#endif
+}
+
 uint16_t spi_stack_recv(void *data, const uint16_t length, uint32_t *options) {
 #ifdef BRICK_CAN_BE_MASTER
 	if(master_mode & MASTER_MODE_MASTER) {
@@ -121,3 +378,37 @@ uint16_t spi_stack_recv(void *data, const uint16_t length, uint32_t *options) {
 	return spi_stack_slave_recv(data, length, options);
 #endif
 }
+
+void* spi_stack_recv_frame(uint16_t *length) {
+#ifdef BRICK_CAN_BE_MASTER
+	if(master_mode & MASTER_MODE_MASTER) {
+		void *frame = spi_stack_master_recv_frame(length);
+
+		// Disallow stack enumerate answer message if it is not initial enumeration
+		if((frame != NULL) && (((MessageHeader*)frame)->fid == FID_STACK_ENUMERATE) && com_info.current != COM_NONE) {
+			spi_stack_master_recv_release();
+			return NULL;
+		}
+
+		return frame;
+	} else if(master_mode & MASTER_MODE_SLAVE) {
+		return spi_stack_slave_recv_frame(length);
+	} else {
+		return NULL;
+	}
+#else
+	return spi_stack_slave_recv_frame(length);
+#endif
+}
+
+void spi_stack_recv_release(void) {
+#ifdef BRICK_CAN_BE_MASTER
+	if(master_mode & MASTER_MODE_MASTER) {
+		spi_stack_master_recv_release();
+	} else if(master_mode & MASTER_MODE_SLAVE) {
+		spi_stack_slave_recv_release();
+	}
+#else
+	spi_stack_slave_recv_release();
+#endif
+}
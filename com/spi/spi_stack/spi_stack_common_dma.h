@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "bricklib/com/com.h"
 #include "bricklib/logging/logging.h"
 #include "config.h"
 
@@ -62,6 +63,13 @@
 #define SPI_STACK_MESSAGE_LENGTH_MIN   12
 #define SPI_STACK_PREAMBLE_VALUE       0xAA
 
+// Packets with CRC16 have their own preamble and one more byte of checksum,
+// a payload of 80 bytes does not fit and is sent with Pearson hash instead
+#define SPI_STACK_PREAMBLE_VALUE_CRC16       0xA5
+#define SPI_STACK_CRC16_OVERHEAD             5
+#define SPI_STACK_CRC16_BUFFER_SIZE          (SPI_STACK_MAX_MESSAGE_LENGTH - SPI_STACK_CRC16_OVERHEAD)
+#define SPI_STACK_MESSAGE_LENGTH_MIN_CRC16   (SPI_STACK_MESSAGE_LENGTH_MIN + 1)
+
 #define SPI_STACK_PREAMBLE                  0
 #define SPI_STACK_LENGTH                    1
 #define SPI_STACK_INFO(length)              ((length) -2)
@@ -69,14 +77,45 @@
 
 #define SPI_STACK_INFO_SEQUENCE_MASTER_MASK (0x7)
 #define SPI_STACK_INFO_SEQUENCE_SLAVE_MASK  (0x38)
+#define SPI_STACK_INFO_MULTI_MESSAGE        (1 << 6)
+#define SPI_STACK_INFO_SHORT_POLL           (1 << 7) // only set by slave
+#define SPI_STACK_INFO_CRC16                (1 << 7) // only set by master
+
+typedef enum {
+	SPI_STACK_PACKET_OK = 0,
+	SPI_STACK_PACKET_ERROR_PREAMBLE,
+	SPI_STACK_PACKET_ERROR_LENGTH,
+	SPI_STACK_PACKET_ERROR_CHECKSUM,
+	SPI_STACK_PACKET_INCOMPLETE // length is longer than the received bytes
+} SPIStackPacketStatus;
+
+// Buffer for one packet that is handed to the DMA. The packet starts two
+// bytes into a word, so that the payload behind preamble and length is word
+// aligned and can be copied a word at a time.
+typedef struct {
+	uint8_t alignment[2];
+	uint8_t packet[SPI_STACK_MAX_MESSAGE_LENGTH];
+} __attribute__((aligned(4))) SPIStackDMABuffer;
 
 void spi_stack_slave_irq(void);
 
 void spi_stack_increase_slave_seq(uint8_t *seq);
 void spi_stack_increase_master_seq(uint8_t *seq);
+void spi_stack_tx_queue_init(void);
 
 uint8_t spi_stack_calculate_pearson(const uint8_t *data, const uint8_t length);
+uint8_t spi_stack_copy_pearson(uint8_t *dest, const uint8_t *src, const uint8_t length, uint8_t checksum);
+uint16_t spi_stack_copy_crc16(uint8_t *dest, const uint8_t *src, const uint8_t length, uint16_t crc);
+uint8_t spi_stack_message_length(const uint8_t *data, const uint8_t length);
+uint8_t spi_stack_packet_info_position(const uint8_t *packet);
+uint8_t spi_stack_packet_payload_max(const uint8_t *packet);
+void spi_stack_make_packet(uint8_t *packet, const ComIOVec *iov, const uint8_t iov_num, const uint8_t payload_length, const uint8_t info, const bool crc16);
+void spi_stack_finish_packet(uint8_t *packet, const uint8_t payload_length, const uint8_t info);
+SPIStackPacketStatus spi_stack_check_packet(const uint8_t *packet, const uint8_t received_length, uint8_t *payload, uint8_t *payload_length, uint8_t *info);
 uint16_t spi_stack_send(const void *data, const uint16_t length, uint32_t *options);
+uint16_t spi_stack_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options);
 uint16_t spi_stack_recv(void *data, const uint16_t length, uint32_t *options);
+void* spi_stack_recv_frame(uint16_t *length);
+void spi_stack_recv_release(void);
 
 #endif
@@ -281,7 +281,13 @@ void spi_stack_master_insert_position(void* data, const uint8_t position) {
 }
 
 void spi_stack_master_message_loop_return(const char *data, const uint16_t length) {
-	send_blocking_with_timeout(data, length, com_info.current);
+	// Responses go to the com of the request, callbacks to all coms in use
+	const uint8_t targets = com_get_reply_targets((const MessageHeader*)data);
+	for(uint8_t com = 0; com < COM_TYPE_NUM; com++) {
+		if(targets & (1 << com)) {
+			send_blocking_with_timeout(data, length, com);
+		}
+	}
 }
 
 void spi_stack_master_message_loop(void *parameters) {
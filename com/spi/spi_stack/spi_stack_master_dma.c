@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <stdbool.h>
 
 #include "bricklib/com/com_common.h"
@@ -38,6 +39,11 @@
 #include "bricklib/free_rtos/include/task.h"
 #include "bricklib/utility/util_definitions.h"
 #include "bricklib/utility/pearson_hash.h"
+#include "bricklib/utility/system_timer.h"
+
+#ifdef PROFILING
+#include "bricklib/utility/profiling.h"
+#endif
 
 #include "extensions/rs485/rs485_low_level.h"
 
@@ -51,13 +57,6 @@
 
 #define SPI_STACK_TIME_BETWEEN_SELECT (640*5)   // 640 cycles  = 10us
 
-extern uint8_t spi_stack_buffer_recv[SPI_STACK_MAX_MESSAGE_LENGTH];
-extern uint8_t spi_stack_buffer_send[SPI_STACK_MAX_MESSAGE_LENGTH];
-
-// Recv and send buffer size for SPI stack (written by spi_stack_send/recv)
-extern uint16_t spi_stack_buffer_size_send;
-extern uint16_t spi_stack_buffer_size_recv;
-
 extern Pin spi_select_master[];
 extern ComInfo com_info;
 
@@ -66,6 +65,18 @@ extern uint32_t led_rxtx;
 uint8_t spi_stack_master_master_seq[SPI_ADDRESS_MAX] = {1, 1, 1, 1, 1, 1, 1, 1};
 uint8_t spi_stack_master_slave_seq[SPI_ADDRESS_MAX] = {0};
 
+// Set if the last valid packet of the slave announced that it can unpack
+// several messages from one payload
+bool spi_stack_master_multi_message[SPI_ADDRESS_MAX] = {false};
+
+// Set if the last valid packet of the slave announced that it can be polled
+// with a short transfer that only contains an empty packet
+bool spi_stack_master_short_poll[SPI_ADDRESS_MAX] = {false};
+
+// Set if the slave sent a valid packet with CRC16. We announce CRC16 support
+// in every packet, but only use it towards slaves that showed that they know it.
+bool spi_stack_master_crc16[SPI_ADDRESS_MAX] = {false};
+
 // Note that stack address is "1 based" (0 is master of stack)
 // while slave_status is 0 based, don't forget the -1!
 SPIStackMasterSlaveStatus slave_status[SPI_ADDRESS_MAX] = {
@@ -73,12 +84,78 @@ SPIStackMasterSlaveStatus slave_status[SPI_ADDRESS_MAX] = {
 	SLAVE_STATUS_AVAILABLE, SLAVE_STATUS_AVAILABLE, SLAVE_STATUS_AVAILABLE, SLAVE_STATUS_AVAILABLE
 };
 
+// Activity based polling: A slave that recently sent or received data is
+// polled every time it is its turn, an idle slave is only polled every
+// SPI_STACK_MASTER_POLL_IDLE_INTERVAL ms.
+uint8_t spi_stack_master_poll_activity[SPI_ADDRESS_MAX] = {0};
+uint32_t spi_stack_master_poll_time[SPI_ADDRESS_MAX] = {0};
+uint32_t spi_stack_master_poll_count[SPI_ADDRESS_MAX] = {0};
+uint32_t spi_stack_master_poll_hit_count[SPI_ADDRESS_MAX] = {0};
+
+SPIStackMasterErrorCount spi_stack_master_error_count[SPI_ADDRESS_MAX] = {{0}};
+
 uint8_t stack_address_counter = 1;
 uint8_t stack_address_current = 1;
 uint8_t stack_address_broadcast = 0;
-SPIStackMasterTransceiveState transceive_state = TRANSCEIVE_STATE_MESSAGE_EMPTY;
 
 int32_t spi_stack_deselect_time = 0;
+extern uint8_t spi_stack_deselect_address;
+
+// Two send/receive DMA buffer pairs are used alternately: While one transfer
+// is on the wire, the next one (for another slave) is already prepared and
+// started directly from the SPI interrupt when the current one is done.
+// Both transfers never address the same slave, the protocol only allows
+// one outstanding packet per slave.
+typedef struct {
+	SPIStackDMABuffer send;
+	SPIStackDMABuffer recv;
+	uint8_t stack_address;
+	uint8_t send_length; // 0 for an empty packet
+	bool sent;           // true if the packet was on the wire at least once
+	bool short_poll_hit; // true if a short poll showed that the slave has a message
+	uint8_t dma_length;  // number of bytes clocked for the current transfer
+	volatile SPIStackMasterTransceiveState state;
+} SPIStackMasterTransfer;
+
+#define SPI_STACK_MASTER_TRANSFER_NUM  2
+#define SPI_STACK_MASTER_TRANSFER_NONE 0xFF
+
+static SPIStackMasterTransfer spi_stack_master_transfer[SPI_STACK_MASTER_TRANSFER_NUM];
+static volatile uint8_t spi_stack_master_transfer_active = SPI_STACK_MASTER_TRANSFER_NONE;
+static uint8_t spi_stack_master_transfer_last = 0;
+
+// State of both transfers together, for code outside of bricklib that used
+// the state of the single transfer before: BUSY while a transfer is on the
+// wire, MESSAGE_READY if one waits to be started, otherwise MESSAGE_EMPTY.
+// Not used here.
+SPIStackMasterTransceiveState transceive_state = TRANSCEIVE_STATE_MESSAGE_EMPTY;
+
+// Received payloads are handed off to this queue by the SPI interrupt, the
+// bus only has to wait for the message loop if the queue is full. Every slot
+// is tagged with the stack address of the slave and a slave can only use
+// SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE slots, the other slaves are still
+// polled while the message loop forwards the messages of a busy slave.
+static uint8_t spi_stack_master_recv_slot[SPI_STACK_MASTER_RECV_SLOTS][SPI_STACK_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint8_t spi_stack_master_recv_slot_length[SPI_STACK_MASTER_RECV_SLOTS];
+static uint8_t spi_stack_master_recv_slot_address[SPI_STACK_MASTER_RECV_SLOTS];
+static volatile uint8_t spi_stack_master_recv_used_by[SPI_ADDRESS_MAX] = {0};
+static uint8_t spi_stack_master_recv_head = 0;
+static uint8_t spi_stack_master_recv_tail = 0;
+static volatile uint8_t spi_stack_master_recv_used = 0;
+static uint16_t spi_stack_master_recv_pointer = 0;
+
+#ifdef PROFILING
+#define SPI_STACK_MASTER_PROFILING_INTERVAL 10000 // in ms
+static uint32_t spi_stack_master_profiling_frames = 0;
+static uint32_t spi_stack_master_profiling_short_frames = 0;
+static uint32_t spi_stack_master_profiling_payloads = 0;
+static uint32_t spi_stack_master_profiling_time = 0;
+
+// Cycles in the SPI interrupt to validate a received packet and hand it off
+static ProfilingCycles spi_stack_master_profiling_done_cycles;
+#endif
+
+static bool spi_stack_master_start_next(void);
 
 void spi_stack_master_init(void) {
 	// Set starting sequence number to something that slave does not expect
@@ -145,38 +222,38 @@ void spi_stack_master_init(void) {
     // Enable SPI peripheral.
     SPI_Enable(SPI);
 
-	spi_stack_master_reset_recv_dma_buffer();
-	spi_stack_master_reset_send_dma_buffer();
+	spi_stack_tx_queue_init();
 
     // Call interrupt on end of slave select
     SPI_EnableIt(SPI, SPI_IER_ENDRX | SPI_IER_ENDTX);
 }
 
 void spi_stack_master_reset_recv_dma_buffer(void) {
+	SPIStackMasterTransfer *transfer = &spi_stack_master_transfer[spi_stack_master_transfer_active];
+
 	// Set preamble to something invalid, so we can't accidentally
 	// Reuse old data
-	spi_stack_buffer_recv[SPI_STACK_PREAMBLE] = 0;
-    SPI->SPI_RPR = (uint32_t)spi_stack_buffer_recv;
-    SPI->SPI_RCR = SPI_STACK_MAX_MESSAGE_LENGTH;
+	transfer->recv.packet[SPI_STACK_PREAMBLE] = 0;
+    SPI->SPI_RPR = (uint32_t)transfer->recv.packet;
+    SPI->SPI_RCR = transfer->dma_length;
 }
 
 void spi_stack_master_reset_send_dma_buffer(void) {
-	const uint8_t length = spi_stack_buffer_send[SPI_STACK_LENGTH];
+	SPIStackMasterTransfer *transfer = &spi_stack_master_transfer[spi_stack_master_transfer_active];
 	const uint8_t mask = SPI_STACK_INFO_SEQUENCE_SLAVE_MASK | SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
 	const uint8_t value = spi_stack_master_slave_seq[stack_address_current-1] | spi_stack_master_master_seq[stack_address_current-1];
-	const uint8_t pos = SPI_STACK_INFO(length);
+	const uint8_t info = transfer->send.packet[spi_stack_packet_info_position(transfer->send.packet)];
 
-	if((spi_stack_buffer_send[pos] & mask) != value) {
-		spi_stack_buffer_send[pos] = (spi_stack_buffer_send[pos] & (~mask)) | value;
-		spi_stack_buffer_send[SPI_STACK_CHECKSUM(length)] = spi_stack_calculate_pearson(spi_stack_buffer_send, length-1);
+	// The sequence numbers may have changed since the packet was prepared
+	if((info & mask) != value) {
+		spi_stack_finish_packet(transfer->send.packet, transfer->send_length, (info & (~mask)) | value);
 	}
 
-    SPI->SPI_TPR = (uint32_t)spi_stack_buffer_send;
-    SPI->SPI_TCR = SPI_STACK_MAX_MESSAGE_LENGTH;
+    SPI->SPI_TPR = (uint32_t)transfer->send.packet;
+    SPI->SPI_TCR = transfer->dma_length;
 }
 
 void spi_stack_master_enable_dma(void) {
-	transceive_state = TRANSCEIVE_STATE_BUSY;
 	spi_stack_select(stack_address_current);
 	spi_stack_master_reset_recv_dma_buffer();
 	spi_stack_master_reset_send_dma_buffer();
@@ -190,22 +267,84 @@ void spi_stack_master_disable_dma(void) {
 	spi_stack_deselect();
 }
 
-void spi_stack_master_make_empty_send_packet(void) {
-	memset(spi_stack_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
-	spi_stack_buffer_send[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE;
-	spi_stack_buffer_send[SPI_STACK_LENGTH] = SPI_STACK_EMPTY_MESSAGE_LENGTH;
-	spi_stack_buffer_send[SPI_STACK_INFO(SPI_STACK_EMPTY_MESSAGE_LENGTH)] = spi_stack_master_master_seq[stack_address_current-1] | spi_stack_master_slave_seq[stack_address_current-1];
-	spi_stack_buffer_send[SPI_STACK_CHECKSUM(SPI_STACK_EMPTY_MESSAGE_LENGTH)] = spi_stack_calculate_pearson(spi_stack_buffer_send, SPI_STACK_EMPTY_MESSAGE_LENGTH-1);
+// Appends a message to the payload of a packet that was not sent yet
+static void spi_stack_master_append_packet(SPIStackMasterTransfer *transfer,
+                                           const ComIOVec *iov,
+                                           const uint8_t iov_num,
+                                           const uint8_t length) {
+	// The message is gathered directly into the DMA buffer,
+	// it overwrites the info and checksum of the previous payload
+	if(length > 0) {
+		com_iovec_gather(&transfer->send.packet[2 + transfer->send_length], SPI_STACK_BUFFER_SIZE - transfer->send_length, iov, iov_num);
+	}
+
+	transfer->send_length += length;
 
-	spi_stack_buffer_size_send = 0;
+	const uint8_t stack_address = transfer->stack_address;
+	spi_stack_finish_packet(transfer->send.packet,
+	                        transfer->send_length,
+	                        SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_CRC16 | spi_stack_master_master_seq[stack_address-1] | spi_stack_master_slave_seq[stack_address-1]); // Master is never busy
 }
 
-SPIStackMasterTransceiveInfo spi_stack_master_start_transceive(const uint8_t *data, const uint8_t length, const uint8_t stack_address) {
-	__disable_irq();
+static void spi_stack_master_make_packet(SPIStackMasterTransfer *transfer,
+                                         const ComIOVec *iov,
+                                         const uint8_t iov_num,
+                                         const uint8_t length,
+                                         const uint8_t stack_address) {
+	// The message is copied directly into the DMA buffer
+	// and the checksum is calculated on the way
+	spi_stack_make_packet(transfer->send.packet,
+	                      iov,
+	                      iov_num,
+	                      length,
+	                      SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_CRC16 | spi_stack_master_master_seq[stack_address-1] | spi_stack_master_slave_seq[stack_address-1], // Master is never busy
+	                      spi_stack_master_crc16[stack_address-1]);
+
+	transfer->stack_address = stack_address;
+	transfer->send_length = length;
+	transfer->sent = false;
+	transfer->short_poll_hit = false;
+	transfer->state = TRANSCEIVE_STATE_MESSAGE_READY;
+}
+
+// Returns the transfer that addresses the given slave (or NULL)
+static SPIStackMasterTransfer* spi_stack_master_get_transfer_to(const uint8_t stack_address) {
+	for(uint8_t i = 0; i < SPI_STACK_MASTER_TRANSFER_NUM; i++) {
+		if(spi_stack_master_transfer[i].state != TRANSCEIVE_STATE_MESSAGE_EMPTY &&
+		   spi_stack_master_transfer[i].stack_address == stack_address) {
+			return &spi_stack_master_transfer[i];
+		}
+	}
+
+	return NULL;
+}
+
+static SPIStackMasterTransfer* spi_stack_master_get_free_transfer(void) {
+	for(uint8_t i = 0; i < SPI_STACK_MASTER_TRANSFER_NUM; i++) {
+		if(spi_stack_master_transfer[i].state == TRANSCEIVE_STATE_MESSAGE_EMPTY) {
+			return &spi_stack_master_transfer[i];
+		}
+	}
+
+	return NULL;
+}
+
+// An empty packet that was never on the wire can be replaced. A packet that
+// was already sent has to be repeated as is, the slave may have seen its
+// sequence number already.
+static bool spi_stack_master_is_transfer_replaceable(const SPIStackMasterTransfer *transfer) {
+	return transfer->state == TRANSCEIVE_STATE_MESSAGE_READY &&
+	       transfer->send_length == 0 &&
+	       !transfer->sent;
+}
+
+// A slave needs some time after it was deselected to prepare its DMA
+// buffers again, other slaves can be selected right away.
+static bool spi_stack_master_is_select_allowed(const uint8_t stack_address) {
+	if(stack_address != spi_stack_deselect_address) {
+		return true;
+	}
 
-	// If the last deselect just happened we return as busy.
-	// In this case the slave may not be ready yet, we have to give him some
-	// more time.
 	int32_t current_time = SysTick->VAL;
 	if(spi_stack_deselect_time != current_time) {
 		if(spi_stack_deselect_time < current_time) {
@@ -213,188 +352,417 @@ SPIStackMasterTransceiveInfo spi_stack_master_start_transceive(const uint8_t *da
 		}
 
 		if(current_time + SPI_STACK_TIME_BETWEEN_SELECT > spi_stack_deselect_time) {
-			__enable_irq();
-			return TRANSCEIVE_INFO_SEND_NOTHING_BUSY;
+			return false;
 		}
 	}
 
-	if(spi_stack_buffer_size_recv > 0) {
-		// The receive buffer is not empty, we can not transceive!
-		__enable_irq();
-		return TRANSCEIVE_INFO_SEND_NOTHING_BUSY;
+	return true;
+}
+
+// Returns true if the bus is free and a prepared transfer could be started
+// but the slave still needs time after the last deselect. This wait is at
+// most SPI_STACK_TIME_BETWEEN_SELECT.
+// Called with disabled interrupts.
+static bool spi_stack_master_is_waiting_for_select(void) {
+	if(spi_stack_master_transfer_active != SPI_STACK_MASTER_TRANSFER_NONE ||
+	   spi_stack_master_recv_used == SPI_STACK_MASTER_RECV_SLOTS) {
+		return false;
 	}
 
-	if(transceive_state == TRANSCEIVE_STATE_MESSAGE_EMPTY) {
-		if(stack_address == 0) { // We are called with sa = 0 if nothing is to send
-			// There is nothing to send,
-			// we send a message with empty payload (4 byte)
+	for(uint8_t i = 0; i < SPI_STACK_MASTER_TRANSFER_NUM; i++) {
+		const SPIStackMasterTransfer *transfer = &spi_stack_master_transfer[i];
+		if(transfer->state == TRANSCEIVE_STATE_MESSAGE_READY &&
+		   spi_stack_master_recv_used_by[transfer->stack_address-1] < SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE &&
+		   !spi_stack_master_is_select_allowed(transfer->stack_address)) {
+			return true;
+		}
+	}
 
-			// Since there is nothing to send we can ask the slaves round robin
-			stack_address_counter++;
-			if(stack_address_counter > com_info.last_stack_address) {
-				stack_address_counter = 1;
-			}
+	return false;
+}
 
-			stack_address_current = stack_address_counter;
+// Returns the stack address of the slave that should be polled next or 0
+// if no slave should be polled right now. If all slaves are idle, the bus
+// stays idle until the interval of the first one is over. While the other
+// transfer waits for the select gap the bus would be idle anyway, so then
+// an idle slave is polled before its interval is over.
+static uint8_t spi_stack_master_poll_select(const bool select_gap) {
+	for(uint8_t i = 0; i < com_info.last_stack_address; i++) {
+		stack_address_counter++;
+		if(stack_address_counter > com_info.last_stack_address) {
+			stack_address_counter = 1;
+		}
 
-			spi_stack_master_make_empty_send_packet();
-			spi_stack_master_enable_dma();
+		// Don't poll a slave that is already addressed by the other transfer
+		// or that can't hand off a message anyway
+		if(spi_stack_master_get_transfer_to(stack_address_counter) != NULL ||
+		   spi_stack_master_recv_used_by[stack_address_counter-1] >= SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE) {
+			continue;
+		}
 
-			__enable_irq();
-			return TRANSCEIVE_INFO_SEND_EMPTY_MESSAGE;
+		const uint8_t index = stack_address_counter-1;
+		if(spi_stack_master_poll_activity[index] > 0 ||
+		   select_gap ||
+		   system_timer_is_time_elapsed_ms(spi_stack_master_poll_time[index], SPI_STACK_MASTER_POLL_IDLE_INTERVAL)) {
+			spi_stack_master_poll_time[index] = system_timer_get_ms();
+			return stack_address_counter;
 		}
+	}
 
-		stack_address_current = stack_address;
-		if(slave_status[stack_address-1] == SLAVE_STATUS_AVAILABLE) {
-			// The send buffer is empty, there is something to send
-			// and the slave is ready to receive data, that means we can copy the data!
+	return 0;
+}
+
+// Starts a prepared transfer, see spi_stack_master_start_next
+static bool spi_stack_master_start_prepared(void) {
+	if(spi_stack_master_transfer_active != SPI_STACK_MASTER_TRANSFER_NONE) {
+		return false;
+	}
 
-			memset(spi_stack_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
+	// A received payload has to fit into the receive queue
+	if(spi_stack_master_recv_used == SPI_STACK_MASTER_RECV_SLOTS) {
+		return false;
+	}
 
-			spi_stack_buffer_send[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE;
-			spi_stack_buffer_send[SPI_STACK_LENGTH] = length + SPI_STACK_EMPTY_MESSAGE_LENGTH;
-			spi_stack_buffer_send[SPI_STACK_INFO(spi_stack_buffer_send[SPI_STACK_LENGTH])] = 0 | spi_stack_master_master_seq[stack_address_current-1] | spi_stack_master_slave_seq[stack_address_current-1]; // Master is never busy
+	// Alternate between the transfers, so that a slave that needs retries
+	// does not block the other one
+	for(uint8_t i = 1; i <= SPI_STACK_MASTER_TRANSFER_NUM; i++) {
+		const uint8_t index = (spi_stack_master_transfer_last + i) % SPI_STACK_MASTER_TRANSFER_NUM;
+		SPIStackMasterTransfer *transfer = &spi_stack_master_transfer[index];
+		if(transfer->state != TRANSCEIVE_STATE_MESSAGE_READY) {
+			continue;
+		}
 
-			for(uint8_t i = 0; i < length; i++) {
-				spi_stack_buffer_send[i+2] = data[i];
-			}
+		// The slave already used up its share of the receive queue
+		if(spi_stack_master_recv_used_by[transfer->stack_address-1] >= SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE) {
+			continue;
+		}
 
-			spi_stack_buffer_send[SPI_STACK_CHECKSUM(spi_stack_buffer_send[SPI_STACK_LENGTH])] = spi_stack_calculate_pearson(spi_stack_buffer_send, spi_stack_buffer_send[SPI_STACK_LENGTH]-1);
-			spi_stack_buffer_size_send = length;
+		if(!spi_stack_master_is_select_allowed(transfer->stack_address)) {
+			continue;
+		}
 
-			spi_stack_master_enable_dma();
-			__enable_irq();
-			return TRANSCEIVE_INFO_SEND_OK;
+		// An empty packet only needs the full length if the slave can't
+		// handle short polls or if it has a message for us
+		if(transfer->send_length == 0 &&
+		   !transfer->short_poll_hit &&
+		   spi_stack_master_short_poll[transfer->stack_address-1]) {
+			transfer->dma_length = SPI_STACK_EMPTY_MESSAGE_LENGTH;
 		} else {
-			// This case should not be reachable.
-			// What can we do here?
-			__enable_irq();
-			return TRANSCEIVE_INFO_SEND_ERROR;
+			transfer->dma_length = SPI_STACK_MAX_MESSAGE_LENGTH;
 		}
-	} else if(transceive_state == TRANSCEIVE_STATE_MESSAGE_READY) {
-		// There is a ready-to-send message in the send buffer that we
-		// were not able to send for some reason, lets send it.
+
+		transfer->state = TRANSCEIVE_STATE_BUSY;
+		transfer->sent = true;
+		spi_stack_master_transfer_active = index;
+		spi_stack_master_transfer_last = index;
+		stack_address_current = transfer->stack_address;
 		spi_stack_master_enable_dma();
+
+		return true;
+	}
+
+	return false;
+}
+
+static void spi_stack_master_update_transceive_state(void) {
+	if(spi_stack_master_transfer_active != SPI_STACK_MASTER_TRANSFER_NONE) {
+		transceive_state = TRANSCEIVE_STATE_BUSY;
+		return;
+	}
+
+	transceive_state = TRANSCEIVE_STATE_MESSAGE_EMPTY;
+	for(uint8_t i = 0; i < SPI_STACK_MASTER_TRANSFER_NUM; i++) {
+		if(spi_stack_master_transfer[i].state == TRANSCEIVE_STATE_MESSAGE_READY) {
+			transceive_state = TRANSCEIVE_STATE_MESSAGE_READY;
+		}
+	}
+}
+
+// Starts the next prepared transfer if the bus is free.
+// Called from the SPI interrupt or with disabled interrupts.
+static bool spi_stack_master_start_next(void) {
+	const bool started = spi_stack_master_start_prepared();
+	spi_stack_master_update_transceive_state();
+
+	return started;
+}
+
+SPIStackMasterTransceiveInfo spi_stack_master_start_transceive(const uint8_t *data, const uint8_t length, const uint8_t stack_address) {
+	const ComIOVec iov = {data, length};
+	return spi_stack_master_start_transceive_v(&iov, 1, stack_address);
+}
+
+SPIStackMasterTransceiveInfo spi_stack_master_start_transceive_v(const ComIOVec *iov, const uint8_t iov_num, const uint8_t stack_address) {
+	const uint16_t length = com_iovec_length(iov, iov_num);
+	if(length > SPI_STACK_BUFFER_SIZE) {
+		return TRANSCEIVE_INFO_SEND_ERROR;
+	}
+
+	__disable_irq();
+
+	if(stack_address == 0) { // We are called with sa = 0 if nothing is to send
+		// There is nothing to send, we prepare a message with empty
+		// payload (4 byte) in a free transfer.
+		SPIStackMasterTransfer *transfer = spi_stack_master_get_free_transfer();
+		if(transfer != NULL) {
+			// Since there is nothing to send we can ask the slaves,
+			// weighted by their recent activity
+			const uint8_t poll_address = spi_stack_master_poll_select(spi_stack_master_is_waiting_for_select());
+			if(poll_address != 0) {
+				spi_stack_master_make_packet(transfer, NULL, 0, 0, poll_address);
+			}
+		}
+
+		spi_stack_master_start_next();
 		__enable_irq();
-		return TRANSCEIVE_INFO_SEND_NOTHING_BUSY;
-	} else if(transceive_state == TRANSCEIVE_STATE_BUSY) {
-		// There is currently data in transfer
+		return TRANSCEIVE_INFO_SEND_EMPTY_MESSAGE;
+	}
+
+	if(slave_status[stack_address-1] != SLAVE_STATUS_AVAILABLE) {
+		// This case should not be reachable.
+		// What can we do here?
 		__enable_irq();
-		return TRANSCEIVE_INFO_SEND_NOTHING_BUSY;
+		return TRANSCEIVE_INFO_SEND_ERROR;
 	}
 
-	// This should not be reachable either.
-	// What can we do here?
+	// Only one packet per slave can be in flight. If there is an empty
+	// packet for this slave that was not started yet, we replace it.
+	// If there is a packet with payload that was not started yet and the
+	// slave can unpack several messages, we append to it.
+	// Otherwise we can use a free transfer or replace an empty packet for
+	// another slave that was not started yet.
+	SPIStackMasterTransfer *transfer = spi_stack_master_get_transfer_to(stack_address);
+	if(transfer != NULL) {
+		if(transfer->state == TRANSCEIVE_STATE_MESSAGE_READY &&
+		   !transfer->sent &&
+		   transfer->send_length > 0 &&
+		   spi_stack_master_multi_message[stack_address-1] &&
+		   transfer->send_length + length <= spi_stack_packet_payload_max(transfer->send.packet)) {
+			spi_stack_master_append_packet(transfer, iov, iov_num, length);
+			spi_stack_master_start_next();
+
+			__enable_irq();
+			return TRANSCEIVE_INFO_SEND_OK;
+		}
+
+		if(!spi_stack_master_is_transfer_replaceable(transfer)) {
+			__enable_irq();
+			return TRANSCEIVE_INFO_SEND_NOTHING_BUSY;
+		}
+	} else {
+		transfer = spi_stack_master_get_free_transfer();
+		if(transfer == NULL) {
+			for(uint8_t i = 0; i < SPI_STACK_MASTER_TRANSFER_NUM; i++) {
+				if(spi_stack_master_is_transfer_replaceable(&spi_stack_master_transfer[i])) {
+					transfer = &spi_stack_master_transfer[i];
+					break;
+				}
+			}
+
+			if(transfer == NULL) {
+				__enable_irq();
+				return TRANSCEIVE_INFO_SEND_NOTHING_BUSY;
+			}
+		}
+	}
+
+	spi_stack_master_make_packet(transfer, iov, iov_num, length, stack_address);
+	spi_stack_master_start_next();
+
 	__enable_irq();
-	return TRANSCEIVE_INFO_SEND_ERROR;
+	return TRANSCEIVE_INFO_SEND_OK;
 }
 
-void spi_stack_master_irq(void) {
-	volatile uint32_t status = SPI->SPI_SR;
+// Updates the activity of the slave after a finished transfer
+static void spi_stack_master_poll_update(const SPIStackMasterTransfer *transfer, const bool received) {
+	const uint8_t index = transfer->stack_address-1;
 
-	// We only do anything here if RX and TX are finished.
-	if((status & (SPI_SR_ENDRX | SPI_SR_ENDTX)) == (SPI_SR_ENDRX | SPI_SR_ENDTX)) {
-		spi_stack_master_disable_dma();
+	if(transfer->send_length == 0) {
+		spi_stack_master_poll_count[index]++;
+		if(received) {
+			spi_stack_master_poll_hit_count[index]++;
+		}
+	}
 
-		if(spi_stack_buffer_recv[SPI_STACK_PREAMBLE] != SPI_STACK_PREAMBLE_VALUE) {
+	// A slave that got a request will likely answer soon
+	if(received || transfer->send_length > 0) {
+		spi_stack_master_poll_activity[index] = SPI_STACK_MASTER_POLL_ACTIVITY_MAX;
+	} else if(spi_stack_master_poll_activity[index] > 0) {
+		spi_stack_master_poll_activity[index]--;
+	}
+}
+
+// Validates the received packet of the finished transfer, hands the payload
+// off to the receive queue and updates the sequence numbers.
+static void spi_stack_master_transfer_done(SPIStackMasterTransfer *transfer) {
+	SPIStackMasterErrorCount *error_count = &spi_stack_master_error_count[stack_address_current-1];
+	const uint8_t *recv = transfer->recv.packet;
+	bool received = false;
+
+	// The payload is copied to the free head slot of the receive queue (see
+	// spi_stack_master_start_next) while the checksum is calculated. The slot
+	// is only handed to the message loop if the packet is new.
+	uint8_t *slot = spi_stack_master_recv_slot[spi_stack_master_recv_head];
+	uint8_t payload_length = 0;
+	uint8_t info = 0;
+
+	switch(spi_stack_check_packet(recv, transfer->dma_length, slot, &payload_length, &info)) {
+		case SPI_STACK_PACKET_OK: {
+			break;
+		}
+
+		case SPI_STACK_PACKET_ERROR_PREAMBLE: {
 			// An "unproper preamble" is part of the protocol,
 			// if the slave is too busy to fill the DMA buffers fast enough.
 			// If we did try to send something we need to try again.
+			error_count->busy_count++;
+			error_count->retry_count++;
 
-			transceive_state = TRANSCEIVE_STATE_MESSAGE_READY;
+			transfer->state = TRANSCEIVE_STATE_MESSAGE_READY;
 			return;
 		}
 
-		uint8_t length = spi_stack_buffer_recv[SPI_STACK_LENGTH];
-		if((length != SPI_STACK_EMPTY_MESSAGE_LENGTH) &&
-		   ((length < SPI_STACK_MESSAGE_LENGTH_MIN) ||
-		    (length > SPI_STACK_MAX_MESSAGE_LENGTH))) {
-			logspise("Received packet with malformed length: %d\n\r", length);
+		case SPI_STACK_PACKET_ERROR_LENGTH: {
+			logspise("Received packet with malformed length: %d\n\r", recv[SPI_STACK_LENGTH]);
+			error_count->error_count_length++;
+			error_count->retry_count++;
 
-			transceive_state = TRANSCEIVE_STATE_MESSAGE_READY;
+			transfer->state = TRANSCEIVE_STATE_MESSAGE_READY;
 			return;
 		}
 
-		uint8_t checksum = spi_stack_calculate_pearson(spi_stack_buffer_recv, length-1);
-		if(checksum != spi_stack_buffer_recv[SPI_STACK_CHECKSUM(length)]) {
-			logspise("Received packet with wrong checksum (actual: %x != expected: %x)\n\r",
-			         checksum, spi_stack_buffer_recv[SPI_STACK_CHECKSUM(length)]);
+		case SPI_STACK_PACKET_INCOMPLETE: {
+			// The slave has a message for us that didn't fit into the short poll,
+			// we repeat the poll with full length
+			transfer->short_poll_hit = true;
+			spi_stack_master_poll_activity[stack_address_current-1] = SPI_STACK_MASTER_POLL_ACTIVITY_MAX;
 
-			// Commented out code below is for debugging wrong checksum problems.
-			// This should only be needed during initial development, we leave it here just in case.
-/*
-			logwohe("spi packet (%d): preamble(%d), length(%d), info(%d), checksum(%d)\n\r",
-					stack_address_current,
-					spi_stack_buffer_recv[SPI_STACK_PREAMBLE],
-					spi_stack_buffer_recv[SPI_STACK_LENGTH],
-					spi_stack_buffer_recv[SPI_STACK_INFO(length)],
-					spi_stack_buffer_recv[SPI_STACK_CHECKSUM(length)]);
-
-			MessageHeader *header = ((MessageHeader*)(spi_stack_buffer_recv+2));
-
-			logwohe("Message UID: %lu", header->uid);
-			logwohe(", length: %d", header->length);
-			logwohe(", fid: %d", header->fid);
-			logwohe(", (seq#, r, a, oo): (%d, %d, %d, %d)", header->sequence_num, header->return_expected, header->authentication, header->other_options);
-			logwohe(", (e, fu): (%d, %d)\n\r", header->error, header->future_use);
-
-			logwohe("Message data: [");
+			transfer->state = TRANSCEIVE_STATE_MESSAGE_READY;
+			return;
+		}
 
-			uint8_t *data = (uint8_t*)header;
-			for(uint8_t i = 0; i < header->length - 8; i++) {
-				logwohe("%d ", data[i+8]);
-			}
-			logwohe("]\n\r");*/
+		case SPI_STACK_PACKET_ERROR_CHECKSUM: {
+			logspise("Received packet with wrong checksum (length %d)\n\r", recv[SPI_STACK_LENGTH]);
+			error_count->error_count_checksum++;
+			error_count->retry_count++;
 
-			transceive_state = TRANSCEIVE_STATE_MESSAGE_READY;
+			transfer->state = TRANSCEIVE_STATE_MESSAGE_READY;
 			return;
 		}
+	}
 
-		// If the sequence number is the same as the last time, we already
-		// handled this response, we don't handle it again in this case
-		if((spi_stack_buffer_recv[SPI_STACK_INFO(length)] & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK) != spi_stack_master_slave_seq[stack_address_current-1]) {
-			spi_stack_master_slave_seq[stack_address_current-1] = spi_stack_buffer_recv[SPI_STACK_INFO(length)] & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK;
+	spi_stack_master_multi_message[stack_address_current-1] = (info & SPI_STACK_INFO_MULTI_MESSAGE) != 0;
+	spi_stack_master_short_poll[stack_address_current-1] = (info & SPI_STACK_INFO_SHORT_POLL) != 0;
+
+	// A slave that knows CRC16 uses it for every payload that fits. If we get
+	// a Pearson packet with such a payload (or a slave without multi message
+	// support, which is older than CRC16) the slave doesn't know it (anymore).
+	if(recv[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE_CRC16) {
+		spi_stack_master_crc16[stack_address_current-1] = true;
+	} else if(((payload_length > 0) && (payload_length <= SPI_STACK_CRC16_BUFFER_SIZE)) ||
+	          !spi_stack_master_multi_message[stack_address_current-1]) {
+		spi_stack_master_crc16[stack_address_current-1] = false;
+	}
 
-			if(length == SPI_STACK_EMPTY_MESSAGE_LENGTH) {
-				// We didn't receive anything, there is nothing to copy anywhere
-			} else {
-				for(uint8_t i = 0; i < length-SPI_STACK_EMPTY_MESSAGE_LENGTH; i++) {
-					spi_stack_buffer_recv[i] = spi_stack_buffer_recv[i+2];
-				}
+	// If the sequence number is the same as the last time, we already
+	// handled this response, we don't handle it again in this case
+	if((info & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK) != spi_stack_master_slave_seq[stack_address_current-1]) {
+		spi_stack_master_slave_seq[stack_address_current-1] = info & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK;
 
-				spi_stack_buffer_size_recv = length-SPI_STACK_EMPTY_MESSAGE_LENGTH;
+		if(payload_length == 0) {
+			// We didn't receive anything, there is nothing to copy anywhere
+		} else {
+			// The payload may contain several messages
+			uint8_t offset = 0;
+			while(offset < payload_length) {
+				const uint8_t message_length = spi_stack_message_length(slot + offset, payload_length - offset);
 
 				// Insert stack position (in case of Enumerate or GetIdentity).
 				// The SPI Slave can not know its position in the stack.
-				spi_stack_master_insert_position(spi_stack_buffer_recv, stack_address_current);
+				spi_stack_master_insert_position(slot + offset, message_length, stack_address_current);
 
 				// Handle routing for Co MCU Bricklets
-				spi_stack_master_update_routing_table(spi_stack_buffer_recv, stack_address_current);
+				spi_stack_master_update_routing_table(slot + offset, message_length, stack_address_current);
+
+				offset += message_length;
 			}
-		}
 
-		const uint8_t last_master_seq_seen_by_slave = spi_stack_buffer_recv[SPI_STACK_INFO(length)] & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
-		uint8_t seq_inc = spi_stack_master_master_seq[stack_address_current-1] & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
-		spi_stack_increase_master_seq(&seq_inc);
+			spi_stack_master_recv_slot_length[spi_stack_master_recv_head] = payload_length;
+			spi_stack_master_recv_slot_address[spi_stack_master_recv_head] = stack_address_current;
+			spi_stack_master_recv_head = (spi_stack_master_recv_head + 1) % SPI_STACK_MASTER_RECV_SLOTS;
+			spi_stack_master_recv_used_by[stack_address_current-1]++;
+			spi_stack_master_recv_used++;
 
-		// If the slave received our last message or we didn't send anything anyway, we can increase sequence number.
-		// We do not increase the sequence number if the last ack we saw had the same sequence number as
-		// the one we would get after increasing. Otherwise we may get a false positive ACK.
-		if(((last_master_seq_seen_by_slave != spi_stack_master_master_seq[stack_address_current-1]) &&
-		   ((spi_stack_buffer_size_send > 0) || (seq_inc == last_master_seq_seen_by_slave)))) {
-			transceive_state = TRANSCEIVE_STATE_MESSAGE_READY;
-			return;
-		} else {
-			spi_stack_increase_master_seq(&spi_stack_master_master_seq[stack_address_current-1]);
-			spi_stack_buffer_size_send = 0;
+			received = true;
+
+#ifdef PROFILING
+			spi_stack_master_profiling_payloads++;
+#endif
 		}
+	} else if(payload_length != 0) {
+		// The slave didn't see our ack and sent the message again
+		error_count->duplicate_count++;
+	}
+
+	spi_stack_master_poll_update(transfer, received);
+
+	const uint8_t last_master_seq_seen_by_slave = info & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
+	uint8_t seq_inc = spi_stack_master_master_seq[stack_address_current-1] & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
+	spi_stack_increase_master_seq(&seq_inc);
+
+	// If the slave received our last message or we didn't send anything anyway, we can increase sequence number.
+	// We do not increase the sequence number if the last ack we saw had the same sequence number as
+	// the one we would get after increasing. Otherwise we may get a false positive ACK.
+	if(((last_master_seq_seen_by_slave != spi_stack_master_master_seq[stack_address_current-1]) &&
+	   ((transfer->send_length > 0) || (seq_inc == last_master_seq_seen_by_slave)))) {
+		error_count->retry_count++;
+		transfer->state = TRANSCEIVE_STATE_MESSAGE_READY;
+		return;
+	} else {
+		spi_stack_increase_master_seq(&spi_stack_master_master_seq[stack_address_current-1]);
+	}
+
+	transfer->state = TRANSCEIVE_STATE_MESSAGE_EMPTY;
+}
+
+bool spi_stack_master_irq(void) {
+	volatile uint32_t status = SPI->SPI_SR;
+
+	// We only do anything here if RX and TX are finished.
+	if((status & (SPI_SR_ENDRX | SPI_SR_ENDTX)) != (SPI_SR_ENDRX | SPI_SR_ENDTX) ||
+	   spi_stack_master_transfer_active == SPI_STACK_MASTER_TRANSFER_NONE) {
+		return false;
+	}
+
+	spi_stack_master_disable_dma();
 
-		transceive_state = TRANSCEIVE_STATE_MESSAGE_EMPTY;
+#ifdef PROFILING
+	spi_stack_master_profiling_frames++;
+	if(spi_stack_master_transfer[spi_stack_master_transfer_active].dma_length == SPI_STACK_EMPTY_MESSAGE_LENGTH) {
+		spi_stack_master_profiling_short_frames++;
 	}
+#endif
+
+#ifdef PROFILING
+	const uint32_t cycles_start = PROFILING_CYCLES_GET();
+	spi_stack_master_transfer_done(&spi_stack_master_transfer[spi_stack_master_transfer_active]);
+	profiling_cycles_add(&spi_stack_master_profiling_done_cycles, PROFILING_CYCLES_SINCE(cycles_start));
+#else
+	spi_stack_master_transfer_done(&spi_stack_master_transfer[spi_stack_master_transfer_active]);
+#endif
+	spi_stack_master_transfer_active = SPI_STACK_MASTER_TRANSFER_NONE;
+
+	// The other transfer was prepared while this one was on the wire,
+	// it can be started right away.
+	spi_stack_master_start_next();
+
+	// The message loop prepares the next transfer and handles the received
+	// payload, we wake it up
+	return true;
 }
 
-void spi_stack_master_update_routing_table(void* data, const uint8_t position) {
-	if(spi_stack_buffer_size_recv > sizeof(MessageHeader)) {
+void spi_stack_master_update_routing_table(void* data, const uint8_t length, const uint8_t position) {
+	if(length > sizeof(MessageHeader)) {
 		EnumerateCallback *enum_cb =  (EnumerateCallback*)data;
 		if(enum_cb->header.fid == FID_ENUMERATE_CALLBACK) {
 			RouteTo route_to = routing_route_to(enum_cb->header.uid);
@@ -408,8 +776,8 @@ void spi_stack_master_update_routing_table(void* data, const uint8_t position) {
 }
 
 // Insert stack address into enumerate message
-void spi_stack_master_insert_position(void* data, const uint8_t position) {
-	if(spi_stack_buffer_size_recv > sizeof(MessageHeader)) {
+void spi_stack_master_insert_position(void* data, const uint8_t length, const uint8_t position) {
+	if(length > sizeof(MessageHeader)) {
 		EnumerateCallback *enum_cb =  (EnumerateCallback*)data;
 		if(enum_cb->header.fid == FID_ENUMERATE_CALLBACK || enum_cb->header.fid == FID_GET_IDENTITY) {
 			if(enum_cb->position == '0') {
@@ -421,15 +789,23 @@ void spi_stack_master_insert_position(void* data, const uint8_t position) {
 }
 
 void spi_stack_master_message_loop_return(const char *data, const uint16_t length) {
-	// To be backward compatible to older firmwares we do not send
-	// "enumerate-added callback" through to an ethernet socket
-	if(((EnumerateCallback*)data)->header.fid == FID_ENUMERATE_CALLBACK &&
-	   ((EnumerateCallback*)data)->enumeration_type == ENUMERATE_TYPE_ADDED &&
-	   com_info.current == COM_ETHERNET) {
-		return;
-	}
+	// Responses go to the com of the request, callbacks to all coms in use
+	const uint8_t targets = com_get_reply_targets((const MessageHeader*)data);
+	for(uint8_t com = 0; com < COM_TYPE_NUM; com++) {
+		if(!(targets & (1 << com))) {
+			continue;
+		}
 
-	send_blocking_with_timeout(data, length, com_info.current);
+		// To be backward compatible to older firmwares we do not send
+		// "enumerate-added callback" through to an ethernet socket
+		if(((EnumerateCallback*)data)->header.fid == FID_ENUMERATE_CALLBACK &&
+		   ((EnumerateCallback*)data)->enumeration_type == ENUMERATE_TYPE_ADDED &&
+		   com == COM_ETHERNET) {
+			continue;
+		}
+
+		send_blocking_with_timeout(data, length, com);
+	}
 }
 
 void spi_stack_master_message_loop(void *parameters) {
@@ -437,18 +813,25 @@ void spi_stack_master_message_loop(void *parameters) {
 	mlp.buffer_size = SPI_STACK_BUFFER_SIZE;
 	mlp.com_type    = COM_SPI_STACK;
 	mlp.return_func = spi_stack_master_message_loop_return;
+
+	// SPI_IrqHandler signals the end of each transfer. The receive event
+	// can only be used if the SPI interrupt may call FreeRTOS functions.
+#if PRIORITY_STACK_MASTER_SPI >= COM_RECV_EVENT_MIN_IRQ_PRIORITY
+	com_recv_event_init(COM_SPI_STACK);
+#endif
 	com_message_loop(&mlp);
 }
 
 
 uint16_t spi_stack_master_send(const void *data, const uint16_t length, uint32_t *options) {
-	if(spi_stack_buffer_size_send > 0 || transceive_state != TRANSCEIVE_STATE_MESSAGE_EMPTY) {
-		return 0;
-	}
+	const ComIOVec iov = {data, length};
+	return spi_stack_master_send_v(&iov, 1, options);
+}
 
+uint16_t spi_stack_master_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options) {
 	// If the stack address is in the options, we use it
 	if(options && *options >= SPI_ADDRESS_MIN && *options <= com_info.last_stack_address) {
-		if(spi_stack_master_start_transceive(data, length, *options) != TRANSCEIVE_INFO_SEND_OK) {
+		if(spi_stack_master_start_transceive_v(iov, iov_num, *options) != TRANSCEIVE_INFO_SEND_OK) {
 			return 0;
 		}
 	} else {
@@ -484,41 +867,143 @@ uint16_t spi_stack_master_send(const void *data, const uint16_t length, uint32_t
 
 	led_rxtx++;
 
-	return length;
+	return com_iovec_length(iov, iov_num);
 }
 
+const SPIStackMasterErrorCount* spi_stack_master_get_error_count(const uint8_t stack_address) {
+	if(stack_address < SPI_ADDRESS_MIN || stack_address > SPI_ADDRESS_MAX) {
+		return NULL;
+	}
 
-uint16_t spi_stack_master_recv(void *data, const uint16_t length, uint32_t *options) {
-	if(spi_stack_buffer_size_recv == 0) {
-		// Use recv loop to trigger regular SPI transmits.
-		// It will scale automatically with the utilization of the Master
-		// and we don't need a SPI recv loop anymore, sweet!
-		if(com_info.current != COM_NONE) {
-			// No need to send data over SPI if there is no connection to
-			// any of the interfaces yet
-			spi_stack_master_start_transceive(NULL, 0, 0);
+	return &spi_stack_master_error_count[stack_address-1];
+}
+
+#ifdef PROFILING
+static void spi_stack_master_profiling_print(void) {
+	if(spi_stack_master_profiling_time == 0) {
+		profiling_cycles_reset(&spi_stack_master_profiling_done_cycles);
+		spi_stack_master_profiling_time = system_timer_get_ms();
+	} else if(system_timer_is_time_elapsed_ms(spi_stack_master_profiling_time, SPI_STACK_MASTER_PROFILING_INTERVAL)) {
+		logi("SPI stack: %"PRIu32" frames/s (%"PRIu32" short), %"PRIu32" payloads/s\n\r",
+		     profiling_per_second(spi_stack_master_profiling_frames, spi_stack_master_profiling_time),
+		     profiling_per_second(spi_stack_master_profiling_short_frames, spi_stack_master_profiling_time),
+		     profiling_per_second(spi_stack_master_profiling_payloads, spi_stack_master_profiling_time));
+		for(uint8_t i = 0; i < com_info.last_stack_address; i++) {
+			logi(" Slave %d: %"PRIu32" polls, %"PRIu32" hits, activity %d\n\r",
+			     i+1,
+			     spi_stack_master_poll_count[i],
+			     spi_stack_master_poll_hit_count[i],
+			     spi_stack_master_poll_activity[i]);
 		}
+		profiling_cycles_print("SPI stack transfer done", &spi_stack_master_profiling_done_cycles);
+		profiling_cycles_reset(&spi_stack_master_profiling_done_cycles);
+		spi_stack_master_profiling_frames = 0;
+		spi_stack_master_profiling_short_frames = 0;
+		spi_stack_master_profiling_payloads = 0;
+		spi_stack_master_profiling_time = system_timer_get_ms();
+	}
+}
+#endif
+
+static void spi_stack_master_poll(void) {
+	// Use recv loop to trigger regular SPI transmits.
+	// It will scale automatically with the utilization of the Master
+	// and we don't need a SPI recv loop anymore, sweet!
+	if(com_info.current != COM_NONE) {
+		// Queued messages are send first, they are drained here since
+		// the message loop is woken up after every finished transfer.
+		com_tx_queue_drain(COM_SPI_STACK);
+
+		// No need to send data over SPI if there is no connection to
+		// any of the interfaces yet
+		spi_stack_master_start_transceive(NULL, 0, 0);
+
+		// If a transfer only waits for the slave after the last deselect
+		// there will be no SPI interrupt that wakes up the message loop, so
+		// we make sure that we are polled again right away. In all other
+		// cases the message loop blocks until the next interrupt or timeout.
+		__disable_irq();
+		const bool select_gap = spi_stack_master_is_waiting_for_select();
+		__enable_irq();
+
+		if(select_gap) {
+			com_recv_event_signal(COM_SPI_STACK);
+		}
+
+#ifdef PROFILING
+		spi_stack_master_profiling_print();
+#endif
+	}
+}
+
+static void spi_stack_master_recv_slot_free(void) {
+	__disable_irq();
+	spi_stack_master_recv_used_by[spi_stack_master_recv_slot_address[spi_stack_master_recv_tail]-1]--;
+	spi_stack_master_recv_tail = (spi_stack_master_recv_tail + 1) % SPI_STACK_MASTER_RECV_SLOTS;
+	spi_stack_master_recv_used--;
+	__enable_irq();
+
+	// The bus may have waited for a free slot
+	com_tx_queue_drain(COM_SPI_STACK);
+	spi_stack_master_start_transceive(NULL, 0, 0);
+}
+
+uint16_t spi_stack_master_recv(void *data, const uint16_t length, uint32_t *options) {
+	if(spi_stack_master_recv_used == 0) {
+		spi_stack_master_poll();
 		return 0;
 	}
 
 	led_rxtx++;
 
-	static uint16_t recv_pointer = 0;
+	// The stack address of the slave that sent the message
+	if(options != NULL) {
+		*options = spi_stack_master_recv_slot_address[spi_stack_master_recv_tail];
+	}
 
-	uint16_t recv_length = MIN(length, spi_stack_buffer_size_recv);
+	const uint8_t slot_length = spi_stack_master_recv_slot_length[spi_stack_master_recv_tail];
+	uint16_t recv_length = MIN(length, slot_length - spi_stack_master_recv_pointer);
 
-	memcpy(data, spi_stack_buffer_recv + recv_pointer, recv_length);
+	memcpy(data, spi_stack_master_recv_slot[spi_stack_master_recv_tail] + spi_stack_master_recv_pointer, recv_length);
 
-	if(spi_stack_buffer_size_recv - recv_length == 0) {
-		recv_pointer = 0;
-	} else {
-		recv_pointer += recv_length;
+	spi_stack_master_recv_pointer += recv_length;
+	if(spi_stack_master_recv_pointer >= slot_length) {
+		spi_stack_master_recv_pointer = 0;
+
+		// Also start a SPI transmission after we read out the recv slot.
+		spi_stack_master_recv_slot_free();
 	}
 
-	spi_stack_buffer_size_recv -= recv_length;
+	return recv_length;
+}
 
-	// Also start a SPI transmission after we read out the recv buffer.
-	spi_stack_master_start_transceive(NULL, 0, 0);
+// Every slot of the receive queue contains the payload of one packet, which
+// may consist of several messages. They are lent out one after the other,
+// the tail slot is not overwritten by the SPI interrupt until it is released.
+void* spi_stack_master_recv_frame(uint16_t *length) {
+	if(spi_stack_master_recv_used == 0) {
+		spi_stack_master_poll();
+		return NULL;
+	}
 
-	return recv_length;
+	led_rxtx++;
+
+	uint8_t *data = spi_stack_master_recv_slot[spi_stack_master_recv_tail] + spi_stack_master_recv_pointer;
+	*length = spi_stack_message_length(data, spi_stack_master_recv_slot_length[spi_stack_master_recv_tail] - spi_stack_master_recv_pointer);
+	return data;
+}
+
+void spi_stack_master_recv_release(void) {
+	const uint8_t slot_length = spi_stack_master_recv_slot_length[spi_stack_master_recv_tail];
+
+	spi_stack_master_recv_pointer += spi_stack_message_length(spi_stack_master_recv_slot[spi_stack_master_recv_tail] + spi_stack_master_recv_pointer,
+	                                                          slot_length - spi_stack_master_recv_pointer);
+	if(spi_stack_master_recv_pointer < slot_length) {
+		return;
+	}
+
+	spi_stack_master_recv_pointer = 0;
+
+	// Also start a SPI transmission after we released the recv slot.
+	spi_stack_master_recv_slot_free();
 }
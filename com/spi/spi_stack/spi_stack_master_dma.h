@@ -23,9 +23,40 @@
 #define SPI_MASTER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "bricklib/com/com_common.h"
 
+// Received payloads are queued in SPI_STACK_MASTER_RECV_SLOTS slots. The
+// master does not use spi_stack_buffer_recv anymore (only the slave does),
+// code that read the last payload from it has to use spi_stack_recv.
+#ifndef SPI_STACK_MASTER_RECV_SLOTS
+#define SPI_STACK_MASTER_RECV_SLOTS 8
+#endif
+
+// Maximum number of receive slots that can be used by one slave, so that
+// a busy slave can't stop the communication with the other slaves
+#ifndef SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE
+#define SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE 4
+#endif
+
+#if SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE > SPI_STACK_MASTER_RECV_SLOTS
+#error "SPI_STACK_MASTER_RECV_SLOTS_PER_SLAVE has to be <= SPI_STACK_MASTER_RECV_SLOTS"
+#endif
+
+// Number of empty polls after which an active slave is treated as idle
+#ifndef SPI_STACK_MASTER_POLL_ACTIVITY_MAX
+#define SPI_STACK_MASTER_POLL_ACTIVITY_MAX 8
+#endif
+
+// An idle slave is polled every SPI_STACK_MASTER_POLL_IDLE_INTERVAL ms and
+// in between only if the bus waits for the select gap of another slave.
+// The interval does not depend on the number of transfers, so idle slaves
+// don't take the bus from busy ones.
+#ifndef SPI_STACK_MASTER_POLL_IDLE_INTERVAL
+#define SPI_STACK_MASTER_POLL_IDLE_INTERVAL 8 // in ms
+#endif
+
 typedef enum {
 	SLAVE_STATUS_ABSENT = 0,
 	SLAVE_STATUS_AVAILABLE,
@@ -37,6 +68,15 @@ typedef enum {
 	TRANSCEIVE_STATE_BUSY
 } SPIStackMasterTransceiveState;
 
+// Link quality to one slave, see FID_GET_SPI_STACK_ERROR_COUNT
+typedef struct {
+	uint32_t busy_count;           // no valid preamble, slave was too busy to fill its DMA buffer
+	uint32_t error_count_length;   // malformed length
+	uint32_t error_count_checksum; // wrong checksum
+	uint32_t duplicate_count;      // message with slave sequence number that was already handled
+	uint32_t retry_count;          // packets that had to be sent again (errors or no ack)
+} SPIStackMasterErrorCount;
+
 typedef enum {
 	TRANSCEIVE_INFO_SEND_EMPTY_MESSAGE = 0,
 	TRANSCEIVE_INFO_SEND_NOTHING_BUSY,
@@ -44,20 +84,22 @@ typedef enum {
 	TRANSCEIVE_INFO_SEND_ERROR
 } SPIStackMasterTransceiveInfo;
 
-void spi_stack_master_irq(void);
+bool spi_stack_master_irq(void);
 void spi_stack_master_reset_recv_dma_buffer(void);
 void spi_stack_master_reset_send_dma_buffer(void);
 void spi_stack_master_enable_dma(void);
 void spi_stack_master_disable_dma(void);
 SPIStackMasterTransceiveInfo spi_stack_master_start_transceive(const uint8_t *data, const uint8_t length, const uint8_t stack_address);
+SPIStackMasterTransceiveInfo spi_stack_master_start_transceive_v(const ComIOVec *iov, const uint8_t iov_num, const uint8_t stack_address);
 
 bool spi_stack_master_transceive(void);
 
 void spi_master_state_machine(void);
 void spi_master_reset_state_machine(void);
 void spi_stack_master_init(void);
-void spi_stack_master_insert_position(void* data, const uint8_t position);
-void spi_stack_master_update_routing_table(void* data, const uint8_t position);
+const SPIStackMasterErrorCount* spi_stack_master_get_error_count(const uint8_t stack_address);
+void spi_stack_master_insert_position(void* data, const uint8_t length, const uint8_t position);
+void spi_stack_master_update_routing_table(void* data, const uint8_t length, const uint8_t position);
 
 void spi_stack_master_state_machine_loop(void *arg);
 void spi_stack_master_message_loop(void *parameters);
@@ -65,6 +107,9 @@ void spi_stack_master_message_loop(void *parameters);
 void spi_stack_master_message_loop_return(const char *data, const uint16_t length);
 
 uint16_t spi_stack_master_send(const void *data, const uint16_t length, uint32_t *options);
+uint16_t spi_stack_master_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options);
 uint16_t spi_stack_master_recv(void *data, const uint16_t length, uint32_t *options);
+void* spi_stack_master_recv_frame(uint16_t *length);
+void spi_stack_master_recv_release(void);
 
 #endif
@@ -32,6 +32,9 @@ Pin spi_select_master[SPI_ADDRESS_MAX] = {PINS_SPI_SELECT_MASTER};
 
 extern int32_t spi_stack_deselect_time;
 
+// The time between two selects is only relevant for the same slave
+uint8_t spi_stack_deselect_address = 0;
+
 void spi_stack_select(const uint8_t num) {
 	if(num >= SPI_ADDRESS_MIN && num <= SPI_ADDRESS_MAX) {
 		PIO_Clear(&spi_select_master[num-1]);
@@ -40,7 +43,11 @@ void spi_stack_select(const uint8_t num) {
 }
 
 void spi_stack_deselect() {
-	PIO_Set(&spi_select_master[spi_stack_select_last_num-1]);
+	// The master also deselects if nothing is selected (e.g. in its init)
+	if(spi_stack_select_last_num >= SPI_ADDRESS_MIN) {
+		PIO_Set(&spi_select_master[spi_stack_select_last_num-1]);
+	}
+	spi_stack_deselect_address = spi_stack_select_last_num;
 	spi_stack_select_last_num = 0;
 
 	spi_stack_deselect_time = SysTick->VAL;
@@ -34,12 +34,23 @@
 
 #include "bricklib/utility/util_definitions.h"
 #include "bricklib/utility/system_timer.h"
+#include "bricklib/utility/pearson_hash.h"
 #include "bricklib/com/com_common.h"
 #include "bricklib/com/com_messages.h"
 
 #include "spi_stack_common_dma.h"
 #include "config.h"
 
+#ifdef PROFILING
+#include "bricklib/utility/profiling.h"
+
+#define SPI_STACK_SLAVE_PROFILING_INTERVAL 10000 // in ms
+
+// Cycles in the SPI interrupt to handle the received and prepare the next packet
+static ProfilingCycles spi_stack_slave_profiling_irq_cycles;
+static uint32_t spi_stack_slave_profiling_time = 0;
+#endif
+
 extern uint8_t spi_stack_buffer_recv[SPI_STACK_MAX_MESSAGE_LENGTH];
 extern uint8_t spi_stack_buffer_send[SPI_STACK_MAX_MESSAGE_LENGTH];
 
@@ -52,87 +63,102 @@ extern uint32_t stack_enumerate_timer;
 
 static const Pin spi_slave_pins[] = {PINS_SPI, PIN_SPI_SELECT_SLAVE};
 
-uint8_t spi_dma_buffer_recv[SPI_STACK_MAX_MESSAGE_LENGTH];
-uint8_t spi_dma_buffer_send[SPI_STACK_MAX_MESSAGE_LENGTH];
+SPIStackDMABuffer spi_dma_buffer_recv;
+SPIStackDMABuffer spi_dma_buffer_send;
 
 uint8_t spi_stack_slave_master_seq = 0;
 uint8_t spi_stack_slave_slave_seq = 0;
 
+// Set if the last valid packet of the master announced that it can unpack
+// several messages from one payload
+bool spi_stack_slave_multi_message = false;
+
+// Set if the last valid packet of the master announced that it can check
+// packets with CRC16, we then use CRC16 for all packets with payload
+bool spi_stack_slave_crc16 = false;
+
+// Set while the packet with payload in spi_dma_buffer_send was not acknowledged
+// by the master, it is then given to the DMA again (preamble 0xAA or 0xA5)
+static bool spi_stack_slave_send_unacked = false;
+
+// Number of bytes the master clocked in the last transfer
+static uint8_t spi_stack_slave_recv_length = SPI_STACK_MAX_MESSAGE_LENGTH;
+
+// Read position of spi_stack_slave_recv_frame in spi_stack_buffer_recv
+static uint8_t spi_stack_slave_recv_frame_offset = 0;
+
 // * Packet structure:
-//  * Byte 0: Preamble = 0xAA
-//  * Byte 1: Length = n+2
+//  * Byte 0: Preamble = 0xAA (0xA5 with CRC16)
+//  * Byte 1: Length = n+2 (n+3 with CRC16)
 //  * Byte 2 to n: Payload
 //  * Byte n+1: Info (slave sequence, master sequence)
 //   * Bit 0-2: Master sequence number (MSN)
 //   * Bit 3-5: Slave sequence number (SSN)
-//   * Bit 6-7: Currently unused
-//  * Byte n+2: Checksum over bytes 0 to n+1
+//   * Bit 6: Multi message support of sender
+//   * Bit 7: Short poll support (set by slave), CRC16 support (set by master)
+//  * Byte n+2: Pearson hash over bytes 0 to n+1
+//    (with CRC16: Byte n+2 and n+3: CRC16 over bytes 0 to n+1, high byte first)
 
 void spi_stack_slave_reset_recv_dma_buffer(void) {
 	// Set preamble to something invalid, so we can't accidentally
 	// Reuse old data
-	spi_dma_buffer_recv[SPI_STACK_PREAMBLE] = 0;
-    SPI->SPI_RPR = (uint32_t)spi_dma_buffer_recv;
+	spi_dma_buffer_recv.packet[SPI_STACK_PREAMBLE] = 0;
+    SPI->SPI_RPR = (uint32_t)spi_dma_buffer_recv.packet;
     SPI->SPI_RCR = SPI_STACK_MAX_MESSAGE_LENGTH;
 	SPI->SPI_PTCR = SPI_PTCR_RXTEN;
 }
 
 void spi_stack_slave_reset_send_dma_buffer(void) {
-	const uint8_t length = spi_dma_buffer_send[SPI_STACK_LENGTH];
+	uint8_t *packet = spi_dma_buffer_send.packet;
 	const uint8_t mask = SPI_STACK_INFO_SEQUENCE_SLAVE_MASK | SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
 	const uint8_t value = spi_stack_slave_slave_seq | spi_stack_slave_master_seq;
-	const uint8_t pos = SPI_STACK_INFO(length);
+	const uint8_t info = packet[spi_stack_packet_info_position(packet)];
 
-	if((spi_dma_buffer_send[pos] & mask) != value) {
-		spi_dma_buffer_send[pos] = (spi_dma_buffer_send[pos] & (~mask)) | value;
-		spi_dma_buffer_send[SPI_STACK_CHECKSUM(length)] = spi_stack_calculate_pearson(spi_dma_buffer_send, length-1);
+	if((info & mask) != value) {
+		const uint8_t payload_length = spi_stack_packet_info_position(packet) - 2;
+		spi_stack_finish_packet(packet, payload_length, (info & (~mask)) | value);
 	}
 
-    SPI->SPI_TPR = (uint32_t)spi_dma_buffer_send;
+    SPI->SPI_TPR = (uint32_t)spi_dma_buffer_send.packet;
     SPI->SPI_TCR = SPI_STACK_MAX_MESSAGE_LENGTH;
 	SPI->SPI_PTCR = SPI_PTCR_TXTEN;
 }
 
 void spi_stack_slave_handle_irq_recv(void) {
-	// Check preamble
-	if(spi_dma_buffer_recv[SPI_STACK_PREAMBLE] != SPI_STACK_PREAMBLE_VALUE) {
+	// Check preamble, length and checksum. If our recv buffer is free, the payload
+	// is copied on the way. It is only used if the packet is accepted below.
+	const bool copied = spi_stack_buffer_size_recv == 0;
+	uint8_t payload_length = 0;
+	uint8_t info = 0;
+	const SPIStackPacketStatus packet_status = spi_stack_check_packet(spi_dma_buffer_recv.packet,
+	                                                                  spi_stack_slave_recv_length,
+	                                                                  copied ? spi_stack_buffer_recv : NULL,
+	                                                                  &payload_length,
+	                                                                  &info);
+	if(packet_status != SPI_STACK_PACKET_OK) {
+		if(packet_status == SPI_STACK_PACKET_ERROR_LENGTH) {
+			logspisw("Length is not proper: %d\n\r", spi_dma_buffer_recv.packet[SPI_STACK_LENGTH]);
+		}
 		spi_stack_slave_reset_recv_dma_buffer();
 		return;
 	}
 
-	// Check length
-	const uint8_t length = spi_dma_buffer_recv[SPI_STACK_LENGTH];
-	if((length != SPI_STACK_EMPTY_MESSAGE_LENGTH) &&
-	   ((length < SPI_STACK_MESSAGE_LENGTH_MIN) ||
-	    (length > SPI_STACK_MAX_MESSAGE_LENGTH))) {
-		logspisw("Length is not proper: %d\n\r", length);
-		spi_stack_slave_reset_recv_dma_buffer();
-		return;
-	}
-
-	// Calculate and check checksum
-	const uint8_t checksum = spi_stack_calculate_pearson(spi_dma_buffer_recv, length-1);
-	if(checksum != spi_dma_buffer_recv[SPI_STACK_CHECKSUM(length)]) {
-		logspisw("Checksum not proper: %x != %x\n\r",
-				 checksum,
-				 spi_dma_buffer_recv[SPI_STACK_CHECKSUM(length)]);
-		spi_stack_slave_reset_recv_dma_buffer();
-		return;
-	}
+	spi_stack_slave_multi_message = (info & SPI_STACK_INFO_MULTI_MESSAGE) != 0;
+	spi_stack_slave_crc16 = (info & SPI_STACK_INFO_CRC16) != 0;
 
 	// Check if last slave sequence number that the master has seen is the same as the last one we send.
 	// or if we didn't send anything. In both cases we can send another message and we can increase the
 	// slave sequence number
-	if(((spi_dma_buffer_recv[SPI_STACK_INFO(length)] & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK) == spi_stack_slave_slave_seq) ||
-	   (spi_dma_buffer_send[SPI_STACK_LENGTH] == SPI_STACK_EMPTY_MESSAGE_LENGTH)) {
-		// We set the preamble in the send buffer to zero to show that a new message can be send.
-		spi_dma_buffer_send[SPI_STACK_PREAMBLE] = 0;
+	if(((info & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK) == spi_stack_slave_slave_seq) ||
+	   (spi_dma_buffer_send.packet[SPI_STACK_LENGTH] == SPI_STACK_EMPTY_MESSAGE_LENGTH)) {
+		// The packet in the send buffer was acknowledged, a new message can be send.
+		spi_stack_slave_send_unacked = false;
 		spi_stack_increase_slave_seq(&spi_stack_slave_slave_seq);
 	}
 
 	// Check if master sequence number is the same as the last one we have seen. In this case we ignore the message
 	// to make sure that we don't handle a message two times.
-	if((spi_dma_buffer_recv[SPI_STACK_INFO(length)] & SPI_STACK_INFO_SEQUENCE_MASTER_MASK) == spi_stack_slave_master_seq) {
+	if((info & SPI_STACK_INFO_SEQUENCE_MASTER_MASK) == spi_stack_slave_master_seq) {
 		logspisw("Received same master sequence number two times: %x\n\r",
 		         spi_stack_slave_master_seq);
 
@@ -142,7 +168,7 @@ void spi_stack_slave_handle_irq_recv(void) {
 
 	// If our recv buffer is full we should not update the master sequence number
 	// and we can't do anything with the data (the master will send it again).
-	if(spi_stack_buffer_size_recv != 0) {
+	if(!copied) {
 		logspisw("Got packet while recv buffer was full\n\r");
 		spi_stack_slave_reset_recv_dma_buffer();
 		return;
@@ -150,13 +176,10 @@ void spi_stack_slave_handle_irq_recv(void) {
 
 	// If our recv buffer is empty and the sequence number is new
 	// we have to save the new sequence number
-	spi_stack_slave_master_seq = spi_dma_buffer_recv[SPI_STACK_INFO(length)] & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
+	spi_stack_slave_master_seq = info & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
 
-	// Everything seems OK, can we copy the DMA buffer?
-	for(uint8_t j = 0; j < length - SPI_STACK_EMPTY_MESSAGE_LENGTH; j++) {
-		spi_stack_buffer_recv[j] = spi_dma_buffer_recv[2+j];
-	}
-	spi_stack_buffer_size_recv = length - SPI_STACK_EMPTY_MESSAGE_LENGTH;
+	// Everything seems OK, the payload was already copied with the checksum calculation
+	spi_stack_buffer_size_recv = payload_length;
 
 	spi_stack_slave_reset_recv_dma_buffer();
 	return;
@@ -164,35 +187,29 @@ void spi_stack_slave_handle_irq_recv(void) {
 }
 
 void spi_stack_slave_handle_irq_send(void) {
-	// If the preamble is still set in the dma buffer, we did have
-	// an checksum error or similar and we need to send the message again.
-	// Otherwise the recv code would have overwritten the preamble
-	if(spi_dma_buffer_send[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE) {
+	// If the packet was not acknowledged, we did have an checksum error
+	// or similar and we need to send the message again.
+	// Otherwise the recv code would have cleared the flag
+	if(spi_stack_slave_send_unacked) {
 		spi_stack_slave_reset_send_dma_buffer();
 		return;
 	} else if(spi_stack_buffer_size_send > 0) {
-		// If we have something to send we will immediately give it to the DMA
-		const uint8_t length = spi_stack_buffer_size_send + SPI_STACK_EMPTY_MESSAGE_LENGTH;
-
-		memset(spi_dma_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
-		// Set preamble, length and data
-		spi_dma_buffer_send[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE;
-		spi_dma_buffer_send[SPI_STACK_LENGTH] = length;
-		for(uint8_t i = 0; i < spi_stack_buffer_size_send; i++) {
-			spi_dma_buffer_send[i+2] = spi_stack_buffer_send[i];
-		}
-
-		spi_dma_buffer_send[SPI_STACK_INFO(length)] = spi_stack_slave_slave_seq | spi_stack_slave_master_seq;
-
-		// Calculate checksum
-		spi_dma_buffer_send[SPI_STACK_CHECKSUM(length)] = spi_stack_calculate_pearson(spi_dma_buffer_send, length-1);
-
-		logspisd("Sending message: length(%d), info(%x), checksum(%x)\n\r",
-		         length,
-		         spi_dma_buffer_send[SPI_STACK_INFO(length)],
-		         spi_dma_buffer_send[SPI_STACK_CHECKSUM(length)]);
+		// If we have something to send we will immediately give it to the DMA.
+		// The data is copied while the checksum is calculated.
+		const ComIOVec iov = {spi_stack_buffer_send, spi_stack_buffer_size_send};
+		spi_stack_make_packet(spi_dma_buffer_send.packet,
+		                      &iov,
+		                      1,
+		                      spi_stack_buffer_size_send,
+		                      SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_SHORT_POLL | spi_stack_slave_slave_seq | spi_stack_slave_master_seq,
+		                      spi_stack_slave_crc16);
+
+		logspisd("Sending message: length(%d), preamble(%x)\n\r",
+		         spi_dma_buffer_send.packet[SPI_STACK_LENGTH],
+		         spi_dma_buffer_send.packet[SPI_STACK_PREAMBLE]);
 
 		spi_stack_slave_reset_send_dma_buffer();
+		spi_stack_slave_send_unacked = true;
 		spi_stack_buffer_size_send = 0;
 		return;
 
@@ -220,11 +237,7 @@ void spi_stack_slave_handle_irq_send(void) {
 
 	// Otherwise the send buffer is empty.
 	// In this case we have to send an empty message
-	memset(spi_dma_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
-	spi_dma_buffer_send[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE;
-	spi_dma_buffer_send[SPI_STACK_LENGTH] = SPI_STACK_EMPTY_MESSAGE_LENGTH;
-	spi_dma_buffer_send[SPI_STACK_INFO(SPI_STACK_EMPTY_MESSAGE_LENGTH)] = spi_stack_slave_slave_seq | spi_stack_slave_master_seq;
-	spi_dma_buffer_send[SPI_STACK_CHECKSUM(SPI_STACK_EMPTY_MESSAGE_LENGTH)] = spi_stack_calculate_pearson(spi_dma_buffer_send, SPI_STACK_EMPTY_MESSAGE_LENGTH-1);
+	spi_stack_make_packet(spi_dma_buffer_send.packet, NULL, 0, 0, SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_SHORT_POLL | spi_stack_slave_slave_seq | spi_stack_slave_master_seq, false);
 
 	spi_stack_slave_reset_send_dma_buffer();
 }
@@ -239,9 +252,13 @@ void spi_stack_slave_irq(void) {
 		// 1. We had a glitch in the slave select pin
 		// 2. Something went wrong during the transfer (we didn't see all clock bits or similar)
 		// In both cases we will wait for the next select. Is there a better way to handle this?
-		if(SPI->SPI_RCR != 0 || SPI->SPI_TCR != 0) {
+		// A short poll of the master only transfers an empty packet, it is handled like a
+		// complete transfer (the remaining TX bytes are discarded by the reset below).
+		const bool short_poll = SPI->SPI_RCR == (SPI_STACK_MAX_MESSAGE_LENGTH - SPI_STACK_EMPTY_MESSAGE_LENGTH);
+		if(!short_poll && (SPI->SPI_RCR != 0 || SPI->SPI_TCR != 0)) {
 			return;
 		}
+		spi_stack_slave_recv_length = SPI_STACK_MAX_MESSAGE_LENGTH - SPI->SPI_RCR;
 
 		// If an overrun or underrun occurred, we can't be sure that there is not currently
 		// another transmission in progress.
@@ -269,8 +286,15 @@ void spi_stack_slave_irq(void) {
 		SPI_EnableIt(SPI, SPI_IER_NSSR);
 
 		// Handle recv and send buffer handling
+#ifdef PROFILING
+		const uint32_t cycles_start = PROFILING_CYCLES_GET();
+		spi_stack_slave_handle_irq_recv();
+		spi_stack_slave_handle_irq_send();
+		profiling_cycles_add(&spi_stack_slave_profiling_irq_cycles, PROFILING_CYCLES_SINCE(cycles_start));
+#else
 		spi_stack_slave_handle_irq_recv();
 		spi_stack_slave_handle_irq_send();
+#endif
 	}
 }
 
@@ -301,14 +325,14 @@ void spi_stack_slave_init(void) {
 
     spi_stack_slave_reset_recv_dma_buffer();
 
-	memset(spi_dma_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
-	spi_dma_buffer_send[SPI_STACK_PREAMBLE] = SPI_STACK_PREAMBLE_VALUE;
-	spi_dma_buffer_send[SPI_STACK_LENGTH] = SPI_STACK_EMPTY_MESSAGE_LENGTH;
-	spi_dma_buffer_send[SPI_STACK_INFO(SPI_STACK_EMPTY_MESSAGE_LENGTH)] = spi_stack_slave_slave_seq | spi_stack_slave_master_seq;
-	spi_dma_buffer_send[SPI_STACK_CHECKSUM(SPI_STACK_EMPTY_MESSAGE_LENGTH)] = spi_stack_calculate_pearson(spi_dma_buffer_send, SPI_STACK_EMPTY_MESSAGE_LENGTH-1);
+	memset(spi_dma_buffer_send.packet, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
+	spi_stack_slave_send_unacked = false;
+	spi_stack_make_packet(spi_dma_buffer_send.packet, NULL, 0, 0, SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_SHORT_POLL | spi_stack_slave_slave_seq | spi_stack_slave_master_seq, false);
 
 	spi_stack_slave_reset_send_dma_buffer();
 
+	spi_stack_tx_queue_init();
+
     // Call interrupt on end of slave select
     SPI_EnableIt(SPI, SPI_IER_NSSR);
 }
@@ -322,40 +346,82 @@ void spi_stack_slave_message_loop(void *parameters) {
 	mlp.buffer_size = SPI_STACK_BUFFER_SIZE;
 	mlp.com_type    = COM_SPI_STACK;
 	mlp.return_func = spi_stack_slave_message_loop_return;
+
+	// SPI_IrqHandler signals new data. The receive event can only be
+	// used if the SPI interrupt may call FreeRTOS functions.
+#if PRIORITY_STACK_SLAVE_SPI >= COM_RECV_EVENT_MIN_IRQ_PRIORITY
+	com_recv_event_init(COM_SPI_STACK);
+#endif
 	com_message_loop(&mlp);
 }
 
 uint16_t spi_stack_slave_send(const void *data, const uint16_t length, uint32_t *options) {
-	if(spi_stack_buffer_size_send > 0) {
+	const ComIOVec iov = {data, MIN(length, SPI_STACK_BUFFER_SIZE)};
+	return spi_stack_slave_send_v(&iov, 1, options);
+}
+
+uint16_t spi_stack_slave_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options) {
+	const uint16_t length = com_iovec_length(iov, iov_num);
+	if(length == 0 || length > SPI_STACK_BUFFER_SIZE) {
 		return 0;
 	}
 
-	led_rxtx++;
+	__disable_irq();
+
+	// If the master can unpack several messages from one payload, we
+	// append to the message that was not given to the DMA yet
+	if(spi_stack_buffer_size_send > 0) {
+		if(!spi_stack_slave_multi_message || (spi_stack_buffer_size_send + length > SPI_STACK_BUFFER_SIZE)) {
+			__enable_irq();
+			return 0;
+		}
+	} else {
+		memset(spi_stack_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
+	}
+
+	com_iovec_gather(spi_stack_buffer_send + spi_stack_buffer_size_send, SPI_STACK_BUFFER_SIZE - spi_stack_buffer_size_send, iov, iov_num);
+	spi_stack_buffer_size_send += length;
 
-	uint16_t send_length = MIN(length, SPI_STACK_BUFFER_SIZE);
+	__enable_irq();
 
-	memset(spi_stack_buffer_send, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
-	memcpy(spi_stack_buffer_send, data, send_length);
-	spi_stack_buffer_size_send = send_length;
+	led_rxtx++;
 
-	return send_length;
+	return length;
 }
 
 bool spi_stack_slave_add_enumerate_connected_request(void) {
 	__disable_irq();
 	com_make_default_header(spi_stack_buffer_recv, 0, sizeof(Enumerate), FID_CREATE_ENUMERATE_CONNECTED);
 	spi_stack_buffer_size_recv = sizeof(Enumerate);
+	spi_stack_slave_recv_frame_offset = 0;
 	__enable_irq();
 
+	com_recv_event_signal(COM_SPI_STACK);
+
 	return true;
 }
 
+static void spi_stack_slave_poll(void) {
+	if((stack_enumerate_timer != 0) && (system_timer_is_time_elapsed_ms(stack_enumerate_timer, 1000))) {
+		stack_enumerate_timer = 0;
+		spi_stack_slave_add_enumerate_connected_request();
+	}
+
+#ifdef PROFILING
+	if(spi_stack_slave_profiling_time == 0) {
+		profiling_cycles_reset(&spi_stack_slave_profiling_irq_cycles);
+		spi_stack_slave_profiling_time = system_timer_get_ms();
+	} else if(system_timer_is_time_elapsed_ms(spi_stack_slave_profiling_time, SPI_STACK_SLAVE_PROFILING_INTERVAL)) {
+		profiling_cycles_print("SPI stack slave IRQ", &spi_stack_slave_profiling_irq_cycles);
+		profiling_cycles_reset(&spi_stack_slave_profiling_irq_cycles);
+		spi_stack_slave_profiling_time = system_timer_get_ms();
+	}
+#endif
+}
+
 uint16_t spi_stack_slave_recv(void *data, const uint16_t length, uint32_t *options) {
 	if(spi_stack_buffer_size_recv == 0) {
-		if((stack_enumerate_timer != 0) && (system_timer_is_time_elapsed_ms(stack_enumerate_timer, 1000))) {
-			stack_enumerate_timer = 0;
-			spi_stack_slave_add_enumerate_connected_request();
-		}
+		spi_stack_slave_poll();
 		return 0;
 	}
 
@@ -377,3 +443,30 @@ uint16_t spi_stack_slave_recv(void *data, const uint16_t length, uint32_t *optio
 
 	return recv_length;
 }
+
+// The receive buffer contains the payload of one packet, which may consist of
+// several messages. They are lent out one after the other, the buffer is not
+// overwritten by the SPI interrupt until the last one is released.
+void* spi_stack_slave_recv_frame(uint16_t *length) {
+	if(spi_stack_buffer_size_recv == 0) {
+		spi_stack_slave_poll();
+		return NULL;
+	}
+
+	led_rxtx++;
+
+	uint8_t *data = spi_stack_buffer_recv + spi_stack_slave_recv_frame_offset;
+	*length = spi_stack_message_length(data, spi_stack_buffer_size_recv - spi_stack_slave_recv_frame_offset);
+	return data;
+}
+
+void spi_stack_slave_recv_release(void) {
+	spi_stack_slave_recv_frame_offset += spi_stack_message_length(spi_stack_buffer_recv + spi_stack_slave_recv_frame_offset,
+	                                                              spi_stack_buffer_size_recv - spi_stack_slave_recv_frame_offset);
+	if(spi_stack_slave_recv_frame_offset < spi_stack_buffer_size_recv) {
+		return;
+	}
+
+	spi_stack_slave_recv_frame_offset = 0;
+	spi_stack_buffer_size_recv = 0;
+}
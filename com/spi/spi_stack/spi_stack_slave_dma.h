@@ -36,6 +36,9 @@ void spi_stack_slave_message_loop(void *parameters);
 void spi_stack_slave_message_loop_return(const char *data, const uint16_t length);
 
 uint16_t spi_stack_slave_send(const void *data, const uint16_t length, uint32_t *options);
+uint16_t spi_stack_slave_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options);
 uint16_t spi_stack_slave_recv(void *data, const uint16_t length, uint32_t *options);
+void* spi_stack_slave_recv_frame(uint16_t *length);
+void spi_stack_slave_recv_release(void);
 
 #endif
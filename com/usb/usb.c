@@ -22,6 +22,7 @@
 #include "usb.h"
 
 #include <string.h>
+#include <inttypes.h>
 
 #include "bricklib/drivers/pio/pio.h"
 #include "bricklib/drivers/pio/pio_it.h"
@@ -45,6 +46,10 @@
 #include "bricklib/logging/logging.h"
 #include "bricklib/com/spi/spi_stack/spi_stack_master.h"
 #include "bricklib/utility/led.h"
+#include "bricklib/utility/system_timer.h"
+#ifdef PROFILING
+#include "bricklib/utility/profiling.h"
+#endif
 #ifndef BRICK_HAS_NO_BRICKLETS
 #include "bricklib/bricklet/bricklet_config.h"
 #endif
@@ -54,6 +59,10 @@
 
 #define MAX_USB_MESSAGE_SIZE 80
 
+#ifdef PROFILING
+#define USB_SEND_PROFILING_INTERVAL 10000 // in ms
+#endif
+
 #define USB_IN_FUNCTION 1
 #define USB_CALLBACK 2
 
@@ -63,127 +72,385 @@ extern ComInfo com_info;
 static USBDDriver usbd_driver;
 bool usb_first_connection = false;
 uint8_t usb_wakeup_counter = 0;
-uint32_t usb_recv_transferred = 0;
 
 bool usb_startup_connected = false;
 static uint8_t receive_status = 0;
 static uint8_t send_status = 0;
 
-char usb_recv_buffer[MAX_USB_MESSAGE_SIZE];
-char usb_send_buffer[MAX_USB_MESSAGE_SIZE];
-volatile uint16_t usb_send_buffer_length = 0;
+static USBRecvRing usb_recv_ring;
+static USBStatistics usb_statistics;
+
+// State of usb_recv_frame/usb_recv_release. Frames are lent out of the
+// tail slot of usb_recv_ring directly, only frames that span more than one
+// packet are assembled in usb_recv_frame_buffer.
+static uint16_t usb_recv_offset = 0;
+static uint16_t usb_recv_frame_lent = 0;
+static uint16_t usb_recv_frame_assembled = 0;
+static char usb_recv_frame_buffer[MAX_USB_MESSAGE_SIZE];
+
+static uint8_t usb_tx_queue_buffer[COM_TX_QUEUE_SIZE];
+static ComTXQueue usb_tx_queue;
 
 #ifdef PIN_USB_DETECT
 static Pin pin_usb_detect = PIN_USB_DETECT;
 #endif
 
-uint32_t usb_sequence_number = 0;
+// Messages that are waiting for the bulk IN endpoint. usb_custom_write_hook
+// (see USBD_HAL.c) takes them packet by packet with usb_send_get_packet, as
+// long as one of the two endpoint banks is free. Thus the next packet is
+// already in the FIFO while the current one is on the wire.
+static char usb_send_slot[USB_SEND_SLOTS][MAX_USB_MESSAGE_SIZE];
+static uint8_t usb_send_slot_length[USB_SEND_SLOTS];
+static uint8_t usb_send_head = 0;        // next free slot
+static uint8_t usb_send_tail = 0;        // oldest slot that is not completely acknowledged
+static uint8_t usb_send_used = 0;
+static uint8_t usb_send_fill = 0;        // slot that is written to the FIFO
+static uint8_t usb_send_fill_offset = 0; // bytes of fill slot written to the FIFO
+static uint8_t usb_send_unwritten = 0;   // slots that are not completely in the FIFO
+
+// Number of slots that are completed by each packet in the banks,
+// in the order of usb_send_get_packet
+#define USB_SEND_BANKS 2
+static uint8_t usb_send_packet_completes[USB_SEND_BANKS];
+static uint8_t usb_send_packet_first = 0;
+static uint8_t usb_send_packet_num = 0;
+
+#ifdef USB_SEND_COALESCE
+// Several small messages are concatenated into one packet (one bulk
+// transfer). The host has to split the transfer at the message lengths.
+static char usb_send_packet[DEFAULT_EP_SIZE];
+static uint16_t usb_send_unwritten_bytes = 0;
+static uint32_t usb_send_unwritten_time = 0;
+#endif
 
-typedef enum {
-	USB_SEND_STATE_IDLE,
-	USB_SEND_STATE_WAIT_FOR_CALLBACK,
-} USBSendState;
+#ifdef PROFILING
+static uint32_t usb_send_profiling_messages = 0;
+static uint32_t usb_send_profiling_packets = 0;
+static uint32_t usb_send_profiling_bytes = 0;
+static uint32_t usb_send_profiling_time = 0;
+#endif
 
-volatile USBSendState usb_send_state = USB_SEND_STATE_IDLE;
+static void usb_send_fill_next(void) {
+	usb_send_fill = (usb_send_fill + 1) % USB_SEND_SLOTS;
+	usb_send_fill_offset = 0;
+	usb_send_unwritten--;
+}
 
-void usb_send_callback(void *arg,
-                       uint8_t status,
-                       uint32_t transferred,
-                       uint32_t remaining) {
-	static int32_t higher_priority_task_woken;
+// Called from usb_custom_write_hook with disabled interrupts
+const char* usb_send_get_packet(uint16_t *size) {
+	if(usb_send_unwritten == 0 || usb_send_packet_num == USB_SEND_BANKS) {
+		return NULL;
+	}
 
-	usb_send_state = USB_SEND_STATE_IDLE;
+	const char *packet = usb_send_slot[usb_send_fill] + usb_send_fill_offset;
+	uint8_t completes = 0;
+
+#ifdef USB_SEND_COALESCE
+	if(usb_send_fill_offset == 0 && usb_send_slot_length[usb_send_fill] <= DEFAULT_EP_SIZE) {
+		// Pack as many complete messages as fit into one packet
+		*size = 0;
+		while(usb_send_unwritten != 0 &&
+		      *size + usb_send_slot_length[usb_send_fill] <= DEFAULT_EP_SIZE) {
+			memcpy(usb_send_packet + *size, usb_send_slot[usb_send_fill], usb_send_slot_length[usb_send_fill]);
+			*size += usb_send_slot_length[usb_send_fill];
+			usb_send_fill_next();
+			completes++;
+		}
 
-	// If data was not transferred we go back to idle, but re-send the data
-	if(transferred != 0) {
-		usb_send_buffer_length = 0;
+		packet = usb_send_packet;
+	} else
+#endif
+	{
+		*size = MIN(DEFAULT_EP_SIZE, usb_send_slot_length[usb_send_fill] - usb_send_fill_offset);
+		usb_send_fill_offset += *size;
+		if(usb_send_fill_offset == usb_send_slot_length[usb_send_fill]) {
+			usb_send_fill_next();
+			completes = 1;
+		}
 	}
 
-	portEND_SWITCHING_ISR(higher_priority_task_woken);
+#ifdef USB_SEND_COALESCE
+	usb_send_unwritten_bytes -= *size;
+#endif
+
+	usb_send_packet_completes[(usb_send_packet_first + usb_send_packet_num) % USB_SEND_BANKS] = completes;
+	usb_send_packet_num++;
+
+	return packet;
 }
 
-bool is_endpoint_idle(const uint8_t ep);
-void usb_handle_send(void) {
-	if(usb_send_buffer_length == 0) {
+// Called from usb_custom_write_hook after the host acknowledged a packet.
+// Packets are acknowledged in the order of usb_send_get_packet.
+void usb_send_packet_done(void) {
+	if(usb_send_packet_num == 0) {
 		return;
 	}
 
-	switch(usb_send_state) {
-		case USB_SEND_STATE_IDLE: {
-			// It is possible that we got an interrupt between the if and the switch.
-			// If we did, the send buffer is now empty and we can return here.
-			if(usb_send_buffer_length == 0) {
-				return;
-			}
-			usb_send_state = USB_SEND_STATE_WAIT_FOR_CALLBACK;
-			if(!(USBD_Write(IN_EP, usb_send_buffer, usb_send_buffer_length, usb_send_callback, (void*)usb_sequence_number) == USBD_STATUS_SUCCESS)) {
-				usb_send_state = USB_SEND_STATE_IDLE;
-			} else {
+	uint8_t completes = usb_send_packet_completes[usb_send_packet_first];
+	usb_send_packet_first = (usb_send_packet_first + 1) % USB_SEND_BANKS;
+	usb_send_packet_num--;
 
-			}
+#ifdef PROFILING
+	usb_send_profiling_packets++;
+#endif
 
-			break;
-		}
+	if(completes == 0) {
+		return;
+	}
 
-		case USB_SEND_STATE_WAIT_FOR_CALLBACK: {
-			// If we reach this state, we did a write and there was no callback within one ms.
-			// Normally this does not happen.
-			// We disable the irq and check if the endpoint is idling. If it is we have to assume
-			// that the message was lost and we have to send it again.
-			// This can for example happen if a PC goes into suspend during a usb write (before
-			// the message reached the PC).
-			__disable_irq();
-			if(usb_send_state == USB_SEND_STATE_WAIT_FOR_CALLBACK) { // Check again if we got the callback between the switch and the irq disable...
-				if(is_endpoint_idle(IN_EP)) {
-					USBD_Write(IN_EP, usb_send_buffer, usb_send_buffer_length, usb_send_callback, (void*)usb_sequence_number);
-				}
-			}
-			__enable_irq();
+	while(completes > 0 && usb_send_used > 0) {
+		usb_statistics.bytes_in += usb_send_slot_length[usb_send_tail];
+#ifdef PROFILING
+		usb_send_profiling_messages++;
+		usb_send_profiling_bytes += usb_send_slot_length[usb_send_tail];
+#endif
+		usb_send_tail = (usb_send_tail + 1) % USB_SEND_SLOTS;
+		usb_send_used--;
+		completes--;
+	}
+
+	// Hand the next queued message to the endpoint right away
+	com_tx_queue_drain(COM_USB);
+}
 
-			break;
+// Called from USBD_HAL.c if the endpoint was reset or the transfer canceled
+// (e.g. bus reset). The content of the banks is lost, all messages that were
+// not acknowledged yet are send again from the start.
+void usb_send_reset(void) {
+	usb_statistics.resend_count += usb_send_used - usb_send_unwritten + (usb_send_fill_offset > 0 ? 1 : 0);
+
+	usb_send_packet_num = 0;
+	usb_send_fill = usb_send_tail;
+	usb_send_fill_offset = 0;
+	usb_send_unwritten = usb_send_used;
+
+#ifdef USB_SEND_COALESCE
+	usb_send_unwritten_bytes = 0;
+	for(uint8_t i = 0; i < usb_send_used; i++) {
+		usb_send_unwritten_bytes += usb_send_slot_length[(usb_send_tail + i) % USB_SEND_SLOTS];
+	}
+#endif
+}
+
+// With USB_SEND_COALESCE_DELAY the endpoint is not started for a single
+// small message, other messages that follow within the delay can be send
+// in the same packet. If the endpoint is busy anyway, messages are
+// coalesced without delay.
+static bool usb_send_is_flush_due(void) {
+#if defined(USB_SEND_COALESCE) && USB_SEND_COALESCE_DELAY > 0
+	return (usb_send_unwritten_bytes >= DEFAULT_EP_SIZE) ||
+	       (usb_send_used == USB_SEND_SLOTS) ||
+	       system_timer_is_time_elapsed_ms(usb_send_unwritten_time, USB_SEND_COALESCE_DELAY);
+#else
+	return true;
+#endif
+}
+
+void usb_handle_send(void) {
+	// Normally the next packet is written to the endpoint by
+	// usb_custom_write_hook. If the endpoint was reset, was not configured
+	// yet when the message was added or the coalesce delay ran out, we
+	// have to start here.
+	__disable_irq();
+	if(usb_send_unwritten != 0 && usb_send_is_flush_due()) {
+		if(usb_custom_write_start()) {
+			usb_statistics.restart_count++;
 		}
 	}
+	__enable_irq();
+}
+
+// Called from USBD_SuspendHandler/USBD_ResumeHandler in interrupt context
+void usb_statistics_suspended(void) {
+	usb_statistics.suspend_count++;
+	usb_statistics.suspend_time_last = system_timer_get_ms();
+}
+
+void usb_statistics_resumed(void) {
+	usb_statistics.resume_time_last = system_timer_get_ms();
+	usb_statistics.suspend_duration_last = usb_statistics.resume_time_last - usb_statistics.suspend_time_last;
+	usb_statistics.suspend_duration_max = MAX(usb_statistics.suspend_duration_max, usb_statistics.suspend_duration_last);
+}
+
+const USBStatistics* usb_get_statistics(void) {
+	return &usb_statistics;
 }
 
 inline uint16_t usb_send(const void *data, const uint16_t length, uint32_t *options) {
-	if((usb_send_buffer_length != 0) || length > MAX_USB_MESSAGE_SIZE) {
+	const ComIOVec iov = {data, length};
+	return usb_send_v(&iov, 1, options);
+}
+
+uint16_t usb_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options) {
+	// Copy to a send slot and start the endpoint if it is idle.
+	// The slot is only freed after the host acknowledged the message.
+	// In cases of usb errors or suspend/resume the message has to be
+	// written again. Because of this we have to copy the message first,
+	// otherwise the data may be lost in case of an error.
+	__disable_irq();
+	if(usb_send_used == USB_SEND_SLOTS) {
+		__enable_irq();
 		return 0;
 	}
 
-	// Copy to send buffer and call usb_handle_send once.
-	// Normally the send will be handled in the first try and a callback
-	// will be issued after the send finished (and allow for a new send).
+	const uint16_t length = com_iovec_gather(usb_send_slot[usb_send_head], MAX_USB_MESSAGE_SIZE, iov, iov_num);
+	if(length == 0) {
+		__enable_irq();
+		return 0;
+	}
 
-	// But in cases of usb errors or suspend/resume we may need to call the
-	// usb write function again. Because of this we have to copy the buffer first.
-	// Otherwise the data may be lost in case of an error.
-	memcpy(usb_send_buffer, data, length);
-	usb_send_buffer_length = length;
-	usb_handle_send();
+	usb_send_slot_length[usb_send_head] = length;
+	usb_send_head = (usb_send_head + 1) % USB_SEND_SLOTS;
+	usb_send_used++;
+	usb_send_unwritten++;
+
+#ifdef USB_SEND_COALESCE
+	if(usb_send_unwritten_bytes == 0) {
+		usb_send_unwritten_time = system_timer_get_ms();
+	}
+	usb_send_unwritten_bytes += length;
+#endif
+
+	if(usb_send_is_flush_due()) {
+		usb_custom_write_start();
+	}
+	__enable_irq();
 
 	return length;
 }
 
+// Called from usb_custom_read_hook in interrupt context (or with disabled
+// interrupts). Returns NULL if all slots are in use.
+char* usb_recv_ring_get_write_slot(void) {
+	if(usb_recv_ring.used >= USB_RECV_RING_SIZE) {
+		return NULL;
+	}
+
+	return usb_recv_ring.buffer[usb_recv_ring.head];
+}
+
+// Returns false if the ring is full now and the endpoint has to NAK
+bool usb_recv_ring_commit(const uint16_t length) {
+	usb_statistics.bytes_out += length;
+	usb_recv_ring.length[usb_recv_ring.head] = length;
+	usb_recv_ring.head = (usb_recv_ring.head + 1) % USB_RECV_RING_SIZE;
+	usb_recv_ring.used++;
+	if(usb_recv_ring.used > usb_recv_ring.used_high_watermark) {
+		usb_recv_ring.used_high_watermark = usb_recv_ring.used;
+	}
+
+	return usb_recv_ring.used < USB_RECV_RING_SIZE;
+}
+
+// Called from USBD_HAL.c if the host sends a packet while all slots are in use
+void usb_recv_ring_stalled(void) {
+	usb_recv_ring.stall_count++;
+}
+
+const USBRecvRing* usb_recv_ring_get(void) {
+	return &usb_recv_ring;
+}
+
+// Frees the tail slot and lets the endpoint receive again
+static void usb_recv_ring_advance(void) {
+	__disable_irq();
+	usb_recv_ring.tail = (usb_recv_ring.tail + 1) % USB_RECV_RING_SIZE;
+	usb_recv_ring.used--;
+	__enable_irq();
+
+	usb_set_read_endpoint_state_to_receiving();
+}
+
 // usb receive is implemented with a hook in the usb protocol state machine
 // from atmel (see USBD_HAL.c). Unfortunately the USBD_Read is not reliable,
 // it does not always invoke the callback function. Since i could not fix this,
-// we write the usb_recv_buffer directly to the endpoint whenever the pc
-// polls and there is data available. This is a little bit faster and seems
+// the hook reads the endpoint FIFO directly into usb_recv_ring whenever the pc
+// sends data and there is a free slot. This is a little bit faster and seems
 // to work very reliable.
 inline uint16_t usb_recv(void *data, const uint16_t length, uint32_t *options) {
-	if(usb_recv_transferred == 0) {
+	if(usb_recv_ring.used == 0) {
 		usb_set_read_endpoint_state_to_receiving();
 		return 0;
 	}
 
-	memcpy(data, usb_recv_buffer, usb_recv_transferred);
-	usb_set_read_endpoint_state_to_receiving();
-	uint16_t tmp = usb_recv_transferred;
-	usb_recv_transferred = 0;
+	const uint16_t tmp = usb_recv_ring.length[usb_recv_ring.tail];
+	memcpy(data, usb_recv_ring.buffer[usb_recv_ring.tail], tmp);
+	usb_recv_ring_advance();
 
 	return tmp;
 }
 
+static void usb_recv_consume(const uint16_t length) {
+	usb_recv_offset += length;
+	if(usb_recv_offset >= usb_recv_ring.length[usb_recv_ring.tail]) {
+		usb_recv_offset = 0;
+		usb_recv_ring_advance();
+	}
+}
+
+void* usb_recv_frame(uint16_t *length) {
+	while(usb_recv_ring.used != 0) {
+		const uint16_t available = usb_recv_ring.length[usb_recv_ring.tail] - usb_recv_offset;
+		char *frame = usb_recv_ring.buffer[usb_recv_ring.tail] + usb_recv_offset;
+
+		// Normally a packet contains a whole frame, we can lend it out directly
+		if(usb_recv_frame_assembled == 0 && available >= SIZE_OF_MESSAGE_HEADER) {
+			if(!com_message_header_is_valid(frame)) {
+				// Out of sync, check if the next byte is the start of a frame
+				com_recv_discard_count[COM_USB]++;
+				usb_recv_consume(1);
+				continue;
+			}
+
+			const uint8_t frame_length = frame[MESSAGE_HEADER_LENGTH_POSITION];
+			if(frame_length <= available) {
+				usb_recv_frame_lent = frame_length;
+				*length = frame_length;
+				return frame;
+			}
+		}
+
+		// Otherwise the frame spans more than one packet (messages longer than
+		// the endpoint size) and we have to assemble it
+		uint16_t needed = SIZE_OF_MESSAGE_HEADER - usb_recv_frame_assembled;
+		if(usb_recv_frame_assembled >= SIZE_OF_MESSAGE_HEADER) {
+			needed = (uint8_t)usb_recv_frame_buffer[MESSAGE_HEADER_LENGTH_POSITION] - usb_recv_frame_assembled;
+		}
+
+		const uint16_t copy = MIN(needed, available);
+		memcpy(usb_recv_frame_buffer + usb_recv_frame_assembled, frame, copy);
+		usb_recv_frame_assembled += copy;
+		usb_recv_consume(copy);
+
+		if(usb_recv_frame_assembled >= SIZE_OF_MESSAGE_HEADER) {
+			if(!com_message_header_is_valid(usb_recv_frame_buffer)) {
+				com_recv_discard_count[COM_USB]++;
+				usb_recv_frame_assembled--;
+				memmove(usb_recv_frame_buffer, usb_recv_frame_buffer + 1, usb_recv_frame_assembled);
+				continue;
+			}
+
+			if(usb_recv_frame_assembled == (uint8_t)usb_recv_frame_buffer[MESSAGE_HEADER_LENGTH_POSITION]) {
+				*length = usb_recv_frame_assembled;
+				return usb_recv_frame_buffer;
+			}
+		}
+	}
+
+	usb_set_read_endpoint_state_to_receiving();
+	return NULL;
+}
+
+void usb_recv_release(void) {
+	if(usb_recv_frame_lent != 0) {
+		const uint16_t length = usb_recv_frame_lent;
+		usb_recv_frame_lent = 0;
+		usb_recv_consume(length);
+	} else {
+		usb_recv_frame_assembled = 0;
+	}
+}
+
 bool usb_is_connected(void) {
 #ifdef BRICK_CAN_BE_MASTER
 #ifdef BRICK_IS_BRIDGE
@@ -203,15 +470,18 @@ bool usb_is_connected(void) {
 
 bool usb_add_enumerate_connected_request(void) {
 	__disable_irq();
-	if(usb_recv_transferred != 0) {
+	char *slot = usb_recv_ring_get_write_slot();
+	if(slot == NULL) {
 		__enable_irq();
 		return false;
 	}
 
-	com_make_default_header(usb_recv_buffer, 0, sizeof(Enumerate), FID_CREATE_ENUMERATE_CONNECTED);
-	usb_recv_transferred = sizeof(Enumerate);
+	com_make_default_header(slot, 0, sizeof(Enumerate), FID_CREATE_ENUMERATE_CONNECTED);
+	usb_recv_ring_commit(sizeof(Enumerate));
 	__enable_irq();
 
+	com_recv_event_signal(COM_USB);
+
 	usb_handle_send();
 
 	return true;
@@ -239,6 +509,29 @@ void usb_tick_task(const uint8_t tick_type) {
 	// calculation task to be sure that this deadlock can't occur.
 	usb_handle_send();
 
+	// The TX queue is normally drained in usb_send_packet_done. If the
+	// endpoint was reset (see usb_handle_send) we continue here.
+	com_tx_queue_drain(COM_USB);
+
+#ifdef PROFILING
+	// Sustained IN throughput, compare with and without USB_SEND_SLOTS > 1
+	// to see the effect of the second endpoint bank
+	if(tick_type == TICK_TASK_TYPE_MESSAGE) {
+		if(usb_send_profiling_time == 0) {
+			usb_send_profiling_time = system_timer_get_ms();
+		} else if(system_timer_is_time_elapsed_ms(usb_send_profiling_time, USB_SEND_PROFILING_INTERVAL)) {
+			logi("USB IN: %"PRIu32" messages/s, %"PRIu32" packets/s, %"PRIu32" bytes/s\n\r",
+			     profiling_per_second(usb_send_profiling_messages, usb_send_profiling_time),
+			     profiling_per_second(usb_send_profiling_packets, usb_send_profiling_time),
+			     profiling_per_second(usb_send_profiling_bytes, usb_send_profiling_time));
+			usb_send_profiling_messages = 0;
+			usb_send_profiling_packets = 0;
+			usb_send_profiling_bytes = 0;
+			usb_send_profiling_time = system_timer_get_ms();
+		}
+	}
+#endif
+
 	if(tick_type == TICK_TASK_TYPE_CALCULATION) {
 		if(usb_wakeup_counter > 0) {
 			usb_wakeup_counter++;
@@ -270,6 +563,8 @@ bool usb_init() {
 	send_status = 0;
 	receive_status = 0;
 
+	com_tx_queue_init(COM_USB, &usb_tx_queue, usb_tx_queue_buffer, COM_TX_QUEUE_SIZE);
+
 	usb_configure_clock_48mhz();
 
     USBDDriver_Initialize(&usbd_driver, &driver_descriptors, 0);
@@ -294,6 +589,9 @@ void usb_message_loop(void *parameters) {
 	mlp.buffer_size = MAX_USB_MESSAGE_SIZE;
 	mlp.com_type    = COM_USB;
 	mlp.return_func = usb_message_loop_return;
+
+	// usb_custom_read_hook signals new data
+	com_recv_event_init(COM_USB);
 	com_message_loop(&mlp);
 }
 
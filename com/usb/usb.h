@@ -34,11 +34,60 @@
 #define NUM_RECEIVE_TRIES 10000
 #define NUM_CALLBACK_TRIES 10000
 
+// Optional (define USB_SEND_COALESCE in config.h): Small messages are
+// concatenated into one IN packet up to the endpoint size. Only enable
+// this if the host splits transfers at the message length.
+// With USB_SEND_COALESCE_DELAY (in ms) a single small message waits up to
+// this time for further messages if the endpoint is idle.
+#ifdef USB_SEND_COALESCE
+#ifndef USB_SEND_COALESCE_DELAY
+#define USB_SEND_COALESCE_DELAY 0
+#endif
+#endif
+
+// Number of messages that can wait for the IN endpoint. With more than one
+// slot both endpoint banks are used (one is filled while the other is on
+// the wire).
+#ifndef USB_SEND_SLOTS
+#ifdef USB_SEND_COALESCE
+#define USB_SEND_SLOTS 8
+#else
+#define USB_SEND_SLOTS 2
+#endif
+#endif
+
+// Counters to correlate host-side latency with the USB link of the device,
+// see FID_GET_USB_STATISTICS. Times are system times in ms.
+typedef struct {
+	uint32_t bytes_in;              // acknowledged by the host
+	uint32_t bytes_out;             // received from the host
+	uint32_t resend_count;          // messages written again after an endpoint reset
+	uint32_t restart_count;         // transfers started by usb_handle_send instead of usb_send
+	uint32_t suspend_count;
+	uint32_t suspend_time_last;     // start of last suspend
+	uint32_t resume_time_last;      // end of last suspend
+	uint32_t suspend_duration_last;
+	uint32_t suspend_duration_max;
+} USBStatistics;
+
+// Number of OUT packets that can be received while the message loop is busy
+#ifndef USB_RECV_RING_SIZE
+#define USB_RECV_RING_SIZE 4
+#endif
+
+// Receive ring, filled by usb_custom_read_hook (see USBD_HAL.c) and emptied
+// by the message loop. The OUT endpoint is only NAKed if all slots are used.
+typedef struct {
+	char buffer[USB_RECV_RING_SIZE][DEFAULT_EP_SIZE];
+	uint16_t length[USB_RECV_RING_SIZE];
+	uint8_t head;
+	uint8_t tail;
+	volatile uint8_t used;
+	uint8_t used_high_watermark;
+	uint32_t stall_count;
+} USBRecvRing;
+
 
-void usb_send_callback(void *arg,
-                       uint8_t status,
-                       uint32_t transferred,
-                       uint32_t remaining);
 
 void usb_recv_callback(void *arg,
                        uint8_t status,
@@ -46,7 +95,21 @@ void usb_recv_callback(void *arg,
                        uint32_t remaining);
 
 uint16_t usb_send(const void *data, const uint16_t length, uint32_t *options);
+uint16_t usb_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options);
 uint16_t usb_recv(void *data, const uint16_t length, uint32_t *options);
+void* usb_recv_frame(uint16_t *length);
+void usb_recv_release(void);
+const char* usb_send_get_packet(uint16_t *size);
+void usb_send_packet_done(void);
+void usb_statistics_suspended(void);
+void usb_statistics_resumed(void);
+const USBStatistics* usb_get_statistics(void);
+void usb_send_reset(void);
+void usb_handle_send(void);
+char* usb_recv_ring_get_write_slot(void);
+bool usb_recv_ring_commit(const uint16_t length);
+void usb_recv_ring_stalled(void);
+const USBRecvRing* usb_recv_ring_get(void);
 
 void usb_detect_configure(void);
 void usb_detect_task(const uint8_t tick_type);
@@ -24,8 +24,10 @@
 #include "config.h"
 #include "bricklib/drivers/cmsis/core_cm3.h"
 #include "bricklib/drivers/usb/USBD.h"
+#include "bricklib/free_rtos/include/FreeRTOS.h"
 #include "bricklib/logging/logging.h"
 #include "bricklib/utility/init.h"
+#include "bricklib/com/com_common.h"
 
 #include <stdbool.h>
 
@@ -41,6 +43,8 @@ void USBDDriverCallbacks_ConfigurationChanged(uint8_t cfgnum) {
 // Invoked after the USB driver has been initialized.
 // Configures the UDP/UDPHS interrupt.
 void USBDCallbacks_Initialized(void) {
+	// The read hook gives the usb receive event from the UDP interrupt
+	NVIC_SetPriority(UDP_IRQn, COM_RECV_EVENT_MIN_IRQ_PRIORITY);
     NVIC_EnableIRQ(UDP_IRQn);
 	logi("USBDCallbacks_Initialized\n\r");
 }
@@ -19,20 +19,70 @@
  * Boston, MA 02111-1307, USA.
  */
 
+
 #ifndef CRC_H
 #define CRC_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+// The CRCCU is used if available, otherwise (and for CRC types it doesn't
+// calculate like the tables below) everything is done in software
+#ifndef CRC_USE_CRCCU
+#define CRC_USE_CRCCU 1
+#endif
 
 #define CRCCU_TIMEOUT    0xFFFFFFFF
 
+// CRC-16/CCITT (polynomial 0x1021, no reflection) in software,
+// one table lookup per byte. Start with CRC16_CCITT_INIT.
+#define CRC16_CCITT_INIT 0xFFFF
+#define CRC16_CCITT(cur, next) do{ cur = (uint16_t)((cur) << 8) ^ crc16_ccitt_table[(((cur) >> 8) ^ (next)) & 0xFF]; }while(0)
+
+// CRC-32 (polynomial 0x04C11DB7, reflected, as in Ethernet and zlib)
+#define CRC32_INIT 0
+
+extern const uint16_t crc16_ccitt_table[256];
+extern const uint32_t crc32_table[256];
+
+// CRC types of the asynchronous and software API, which return the standard
+// CRC values. The values are the same as the polynomial types of CRCCU_MR.
+// There is no table for CRCCU_MR_PTYPE_CASTAGNOLI, it is not supported:
+// crc_async_start returns false and crc_compute_software returns 0.
+typedef enum {
+	CRC_TYPE_CRC32 = 0,      // CRCCU_MR_PTYPE_CCIT8023
+	CRC_TYPE_CRC16_CCITT = 8 // CRCCU_MR_PTYPE_CCIT16
+} CRCType;
+
+typedef struct {
+	const void *data;
+	uint16_t length;
+} CRCBuffer;
+
+// Called once the CRC over all buffers is calculated
+typedef void (*CRCCallback)(const uint32_t crc, void *context);
+
 typedef struct {
     uint32_t TR_ADDR;
     uint32_t TR_CTRL;
 } CCRCDescriptor;
 
+void crc_init(void);
+bool crc_async_start(const CRCType type, const CRCBuffer *buffers, const uint8_t buffers_num, CRCCallback callback, void *context);
+bool crc_async_poll(void);
+bool crc_async_is_busy(void);
+uint32_t crc_async_result(void);
+uint32_t crc_async_wait(void);
+
+// Synchronous CRCCU calculation, returns CRCCU_SR as is for every
+// polynomial type of CRCCU_MR (including Castagnoli). Only with the CRCCU.
+#if CRC_USE_CRCCU
 uint16_t crc16_compute(uint8_t *buffer, const uint16_t length);
 uint32_t crc32_compute(uint8_t *buffer, const uint16_t length);
 uint32_t crc_compute(uint8_t *buffer, const uint16_t length, const uint32_t polynom_type);
+#endif
+uint32_t crc_compute_software(const CRCType type, const CRCBuffer *buffers, const uint8_t buffers_num);
+uint16_t crc16_ccitt_software(const uint8_t *buffer, const uint16_t length, uint16_t crc);
+uint32_t crc32_software(const uint8_t *buffer, const uint16_t length, uint32_t crc);
 
 #endif
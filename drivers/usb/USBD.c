@@ -49,6 +49,11 @@
 
 #include "USBLib_Trace.h"
 
+#ifndef USB_NO_BRICK_HOOK
+// include bricklib usb.h for usb statistics
+#include "bricklib/com/usb/usb.h"
+#endif
+
 /*---------------------------------------------------------------------------
  *      Definitions
  *---------------------------------------------------------------------------*/
@@ -90,6 +95,10 @@ void USBD_SuspendHandler(void)
         /* Suspend HW interface */
         USBD_HAL_Suspend();
 
+#ifndef USB_NO_BRICK_HOOK
+        usb_statistics_suspended();
+#endif
+
         /* Invoke the User Suspended callback (Suspend System?) */
         USBDCallbacks_Suspended();
     }
@@ -106,6 +115,10 @@ void USBD_ResumeHandler(void)
         /* Active the device */
         USBD_HAL_Activate();
         deviceState = previousDeviceState;
+
+#ifndef USB_NO_BRICK_HOOK
+        usb_statistics_resumed();
+#endif
         if (deviceState >= USBD_STATE_DEFAULT) {
             /* Invoke the Resume callback */
         	// We don't call resumed here, since it is actually too early.
@@ -675,6 +675,12 @@ static void UDP_EndpointHandler(uint8_t bEndpoint)
 
         TRACE_DEBUG_WP("Wr ");
 
+#ifndef USB_NO_BRICK_HOOK
+        if (bEndpoint == IN_EP) {
+            usb_custom_write_hook();
+        }
+        else
+#endif
         // Check that endpoint was in MBL Sending state
         if (pEndpoint->state == UDP_ENDPOINT_SENDINGM) {
 
@@ -806,6 +812,11 @@ static void UDP_EndpointHandler(uint8_t bEndpoint)
 
                 TRACE_DEBUG_WP("Nak ");
                 UDP->UDP_IDR = 1 << bEndpoint;
+#ifndef USB_NO_BRICK_HOOK
+                if(bEndpoint == OUT_EP) {
+                    usb_recv_ring_stalled();
+                }
+#endif
             }
         }
         // Endpoint is in Read state
@@ -1069,12 +1080,12 @@ static inline uint8_t UDP_Read(uint8_t  bEndpoint,
 
 #ifndef USB_NO_BRICK_HOOK
 // brick hooks
-extern char usb_recv_buffer[DEFAULT_EP_SIZE];
-extern unsigned int usb_recv_transferred;
-
 void usb_custom_read_hook(uint32_t status) {
-	if(usb_recv_transferred != 0) {
+	char *usb_recv_buffer = usb_recv_ring_get_write_slot();
+	if(usb_recv_buffer == NULL) {
 		// Host PC is too fast, disable interrupt
+		usb_recv_ring_stalled();
+		endpoints[OUT_EP].state = UDP_ENDPOINT_IDLE;
 		UDP->UDP_IDR = 1 << OUT_EP;
 		return;
 	}
@@ -1085,17 +1096,112 @@ void usb_custom_read_hook(uint32_t status) {
 	for(int i = 0; i < packet_size; i++) {
 		usb_recv_buffer[i] = UDP->UDP_FDR[OUT_EP];
 	}
-	usb_recv_transferred = packet_size;
 
 	UDP_ClearRxFlag(OUT_EP);
 
-	// Check if the transfer is finished
-	if (packet_size < endpoints[OUT_EP].size) {
+	// The endpoint stays in receiving state as long as there is a free
+	// slot in the ring. Otherwise further packets are NAKed until the
+	// message loop frees a slot (see usb_set_read_endpoint_state_to_receiving).
+	if(!usb_recv_ring_commit(packet_size)) {
 		endpoints[OUT_EP].state = UDP_ENDPOINT_IDLE;
 	}
+
+	// Wake up usb message loop
+	com_recv_event_signal_from_isr(COM_USB);
 }
 #endif
 
+// Number of packets in the banks of IN_EP, the first one has TXPKTRDY set
+static uint8_t usb_custom_write_banks = 0;
+
+// Invoked by UDP_EndOfTransfer if IN_EP is reset or canceled while packets
+// are in the banks. The content of the banks is lost.
+static void usb_custom_write_end(void *arg,
+                                 uint8_t status,
+                                 uint32_t transferred,
+                                 uint32_t remaining) {
+	usb_custom_write_banks = 0;
+	usb_send_reset();
+}
+
+static void usb_custom_write_fill(void) {
+	while(usb_custom_write_banks < CHIP_USB_ENDPOINTS_BANKS(IN_EP)) {
+		uint16_t packet_size;
+		const char *packet = usb_send_get_packet(&packet_size);
+		if(packet == NULL) {
+			return;
+		}
+
+		for(int i = 0; i < packet_size; i++) {
+			UDP->UDP_FDR[IN_EP] = packet[i];
+		}
+
+		// Only the first bank is released, the second one is released
+		// after the first one was acknowledged (see usb_custom_write_hook)
+		usb_custom_write_banks++;
+		if(usb_custom_write_banks == 1) {
+			SET_CSR(IN_EP, UDP_CSR_TXPKTRDY);
+		}
+	}
+}
+
+// Called with disabled interrupts if a new message is available.
+// Returns true if a transfer was started on the idle endpoint.
+bool usb_custom_write_start(void) {
+	Endpoint *pEndpoint = &(endpoints[IN_EP]);
+	Transfer *pTransfer = (Transfer*)&(pEndpoint->transfer);
+
+	if(pEndpoint->state == UDP_ENDPOINT_SENDING) {
+		// Use free bank, if there is one
+		usb_custom_write_fill();
+		return false;
+	}
+
+	// Not configured, halted or in use by USBD_Write
+	if(pEndpoint->state != UDP_ENDPOINT_IDLE) {
+		return false;
+	}
+
+	usb_custom_write_banks = 0;
+	usb_custom_write_fill();
+	if(usb_custom_write_banks != 0) {
+		pEndpoint->state = UDP_ENDPOINT_SENDING;
+		pTransfer->fCallback = usb_custom_write_end;
+		pTransfer->pArgument = 0;
+		pTransfer->buffered = 0;
+		pTransfer->remaining = 0;
+		pTransfer->transferred = 0;
+		UDP->UDP_IER = 1 << IN_EP;
+		return true;
+	}
+
+	return false;
+}
+
+// Called on TXCOMP of IN_EP: One packet was acknowledged by the host
+void usb_custom_write_hook(void) {
+	Endpoint *pEndpoint = &(endpoints[IN_EP]);
+
+	if(usb_custom_write_banks > 0) {
+		usb_custom_write_banks--;
+	}
+
+	// The second bank is already filled, release it before TXCOMP is
+	// cleared (see ping-pong sequence in SAM3S datasheet)
+	if(usb_custom_write_banks > 0) {
+		SET_CSR(IN_EP, UDP_CSR_TXPKTRDY);
+	}
+	CLEAR_CSR(IN_EP, UDP_CSR_TXCOMP);
+
+	usb_send_packet_done();
+	usb_custom_write_fill();
+
+	if(usb_custom_write_banks == 0) {
+		pEndpoint->state = UDP_ENDPOINT_IDLE;
+		UDP->UDP_IDR = 1 << IN_EP;
+	}
+}
+
 void usb_set_read_endpoint_state_to_receiving(void) {
 	endpoints[OUT_EP].state = UDP_ENDPOINT_RECEIVING;
 	UDP->UDP_IER = 1 << OUT_EP;
@@ -69,6 +69,8 @@
 
 // brick hooks
 void usb_custom_read_hook(uint32_t status);
+void usb_custom_write_hook(void);
+bool usb_custom_write_start(void);
 void usb_set_read_endpoint_state_to_receiving(void);
 
 /*----------------------------------------------------------------------------
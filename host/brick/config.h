@@ -0,0 +1,168 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * config.h: Brick configuration for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The host build is configured like a Master Brick 2.1 (it can be master or
+// slave of a stack and has co-processor Bricklet support), so that all of
+// the SPI stack, USB and Bricklet code is compiled.
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bricklib/drivers/board/sam3s/SAM3S.h"
+#include "bricklib/drivers/pio/pio.h"
+#include "bricklib/drivers/usart/usart.h"
+
+#define BOARD_NAME "Host"
+#define BOARD_MCK 64000000
+#define BOARD_MAINOSC 16000000
+
+#define BRICK_FIRMWARE_VERSION_MAJOR 2
+#define BRICK_FIRMWARE_VERSION_MINOR 5
+#define BRICK_FIRMWARE_VERSION_REVISION 0
+
+#define BRICK_DEVICE_IDENTIFIER 13
+#define BRICK_HARDWARE_NAME "Master Brick 2.1"
+
+#define BRICK_CAN_BE_MASTER
+#define BRICK_HAS_CO_MCU_SUPPORT
+#define BRICKLET_NUM 4
+// The contexts hold pointers (e.g. CoMCUData), they are 8 byte on the host
+#define BRICKLET_CONTEXT_MAX_SIZE 272
+
+#define COM_MESSAGE_USER_LAST_FID 0
+
+#define LOGGING_LEVEL LOGGING_WARNING
+#define DEBUG_SPI_STACK 0
+#define DEBUG_BRICKLET 0
+#define DEBUG_I2C_EEPROM 0
+#define DEBUG_STARTUP 0
+
+// The host build also has the profiling of the hot paths
+#define PROFILING
+#define PROFILING_TIME 10
+
+#define PRIORITY_EEPROM_MASTER_TWI0 8
+#define PRIORITY_EEPROM_SLAVE_TWI1  8
+#define PRIORITY_STACK_SLAVE_SPI    8
+#define PRIORITY_STACK_MASTER_SPI   8
+#define PRIORITY_PROFILING_TC0      0
+
+// ************** BRICK SETTINGS *****************
+#define MASTER_MODE_NONE   0
+#define MASTER_MODE_MASTER 1
+#define MASTER_MODE_SLAVE  2
+
+#define PRODUCT_DESCRIPTOR { \
+	USBStringDescriptor_LENGTH(4), \
+	USBGenericDescriptor_STRING, \
+	USBStringDescriptor_UNICODE('H'), \
+	USBStringDescriptor_UNICODE('o'), \
+	USBStringDescriptor_UNICODE('s'), \
+	USBStringDescriptor_UNICODE('t') \
+}
+
+#define USB_VOLTAGE_CHANNEL 3
+#define VOLTAGE_MAX_VALUE 4095
+
+// ************** LED *****************
+#define LED_STD_BLUE 0
+#define LED_STD_RED  1
+
+#define PIN_LED_STD_BLUE {PIO_PA28, PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_LED_STD_RED  {PIO_PA29, PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PINS_LED PIN_LED_STD_BLUE, PIN_LED_STD_RED
+
+// ************** SPI STACK *****************
+#define PINS_SPI {PIO_PA12A_MISO | PIO_PA13A_MOSI | PIO_PA14A_SPCK, PIOA, ID_PIOA, PIO_PERIPH_A, PIO_DEFAULT}
+#define PIN_SPI_SELECT_SLAVE {PIO_PA11A_NPCS0, PIOA, ID_PIOA, PIO_PERIPH_A, PIO_DEFAULT}
+
+#define PIN_SPI_SELECT_MASTER_0 {PIO_PC8,  PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_1 {PIO_PC9,  PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_2 {PIO_PC10, PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_3 {PIO_PC11, PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_4 {PIO_PC12, PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_5 {PIO_PC13, PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_6 {PIO_PC14, PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_7_10 {PIO_PC15, PIOC, ID_PIOC, PIO_OUTPUT_1, PIO_DEFAULT}
+#define PIN_SPI_SELECT_MASTER_7_20 {PIO_PA31, PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+
+#define PINS_SPI_SELECT_MASTER PIN_SPI_SELECT_MASTER_0, \
+                               PIN_SPI_SELECT_MASTER_1, \
+                               PIN_SPI_SELECT_MASTER_2, \
+                               PIN_SPI_SELECT_MASTER_3, \
+                               PIN_SPI_SELECT_MASTER_4, \
+                               PIN_SPI_SELECT_MASTER_5, \
+                               PIN_SPI_SELECT_MASTER_6, \
+                               PIN_SPI_SELECT_MASTER_7_20
+
+// ************** I2C *****************
+#define TWI_STACK TWI1
+#define TWI_BRICKLET TWI0
+
+#define PIN_TWI_TWD_BRICKLET  {PIO_PA3A_TWD0, PIOA, ID_PIOA, PIO_PERIPH_A, PIO_DEFAULT}
+#define PIN_TWI_TWCK_BRICKLET {PIO_PA4A_TWCK0, PIOA, ID_PIOA, PIO_PERIPH_A, PIO_DEFAULT}
+#define PINS_TWI_BRICKLET PIN_TWI_TWD_BRICKLET, PIN_TWI_TWCK_BRICKLET
+#define PINS_TWI_STACK {PIO_PB4A_TWD1 | PIO_PB5A_TWCK1, PIOB, ID_PIOB, PIO_PERIPH_A, PIO_DEFAULT}
+
+// ************** BRICKLET SETTINGS **************
+#define BRICKLET_A_ADDRESS 84
+#define BRICKLET_A_ADC_CHANNEL 13
+#define BRICKLET_A_PIN_1_AD   {PIO_PC26, PIOC, ID_PIOC, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_A_PIN_2_DA   {PIO_PA15, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_A_PIN_3_PWM  {PIO_PA0,  PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_A_PIN_4_IO   {PIO_PA16, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_A_PIN_SELECT {PIO_PA6,  PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+
+#define BRICKLET_B_ADDRESS 80
+#define BRICKLET_B_ADC_CHANNEL 12
+#define BRICKLET_B_PIN_1_AD   {PIO_PC29, PIOC, ID_PIOC, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_B_PIN_2_DA   {PIO_PB14, PIOB, ID_PIOB, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_B_PIN_3_PWM  {PIO_PA1,  PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_B_PIN_4_IO   {PIO_PA17, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_B_PIN_SELECT {PIO_PA7,  PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+
+#define BRICKLET_C_ADDRESS 84
+#define BRICKLET_C_ADC_CHANNEL 1
+#define BRICKLET_C_PIN_1_AD   {PIO_PA18, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_C_PIN_2_DA   {PIO_PB13, PIOB, ID_PIOB, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_C_PIN_3_PWM  {PIO_PA2,  PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_C_PIN_4_IO   {PIO_PA19, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_C_PIN_SELECT {PIO_PA8,  PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+
+#define BRICKLET_D_ADDRESS 80
+#define BRICKLET_D_ADC_CHANNEL 2
+#define BRICKLET_D_PIN_1_AD   {PIO_PA20, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_D_PIN_2_DA   {PIO_PB12, PIOB, ID_PIOB, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_D_PIN_3_PWM  {PIO_PA5,  PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_D_PIN_4_IO   {PIO_PA21, PIOA, ID_PIOA, PIO_INPUT, PIO_DEFAULT}
+#define BRICKLET_D_PIN_SELECT {PIO_PA9,  PIOA, ID_PIOA, PIO_OUTPUT_1, PIO_DEFAULT}
+
+// Bricklet port A is connected to USART0 (SPI master mode) as on boards
+// that route RXD/TXD/SCK to the port, the other ports use bit-banging
+#define CO_MCU_USART_A {USART0, ID_USART0, PIO_PERIPH_A}
+
+void tick_task(const uint8_t tick_type);
+uint8_t master_get_hardware_version(void);
+
+#endif
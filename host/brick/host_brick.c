@@ -0,0 +1,106 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_brick.c: Brick specific functions of the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/bricklet/bricklet_config.h"
+#include "bricklib/bricklet/bricklet_init.h"
+#include "bricklib/bricklet/bricklet_communication.h"
+
+void tick_task(const uint8_t tick_type) {
+	(void)tick_type;
+}
+
+uint8_t master_get_hardware_version(void) {
+	return 21;
+}
+
+void vApplicationStackOverflowHook(xTaskHandle *pxTask, signed char *pcTaskName) {
+	(void)pxTask;
+	fprintf(stderr, "Stack overflow in task %s\n", (char*)pcTaskName);
+	abort();
+}
+
+// Bricklet ports. There is no flash for Bricklet plugins, a test attaches
+// co-processor Bricklets (bricklet_attached = BRICKLET_INIT_CO_MCU).
+bool brick_only_supports_7p = false;
+
+const BrickletAddress baddr[BRICKLET_NUM] = {{0}};
+
+BrickletSettings bs[BRICKLET_NUM] = {
+	{'a', BRICKLET_A_ADDRESS, BRICKLET_A_PIN_1_AD, BRICKLET_A_PIN_2_DA, BRICKLET_A_PIN_3_PWM,
+	 BRICKLET_A_PIN_4_IO, BRICKLET_A_PIN_SELECT, BRICKLET_A_ADC_CHANNEL, &baddr[0], 0, {0, 0, 0}, {0, 0, 0}, 0, 0},
+	{'b', BRICKLET_B_ADDRESS, BRICKLET_B_PIN_1_AD, BRICKLET_B_PIN_2_DA, BRICKLET_B_PIN_3_PWM,
+	 BRICKLET_B_PIN_4_IO, BRICKLET_B_PIN_SELECT, BRICKLET_B_ADC_CHANNEL, &baddr[1], 0, {0, 0, 0}, {0, 0, 0}, 0, 0},
+	{'c', BRICKLET_C_ADDRESS, BRICKLET_C_PIN_1_AD, BRICKLET_C_PIN_2_DA, BRICKLET_C_PIN_3_PWM,
+	 BRICKLET_C_PIN_4_IO, BRICKLET_C_PIN_SELECT, BRICKLET_C_ADC_CHANNEL, &baddr[2], 0, {0, 0, 0}, {0, 0, 0}, 0, 0},
+	{'d', BRICKLET_D_ADDRESS, BRICKLET_D_PIN_1_AD, BRICKLET_D_PIN_2_DA, BRICKLET_D_PIN_3_PWM,
+	 BRICKLET_D_PIN_4_IO, BRICKLET_D_PIN_SELECT, BRICKLET_D_ADC_CHANNEL, &baddr[3], 0, {0, 0, 0}, {0, 0, 0}, 0, 0}
+};
+
+uint32_t bc[BRICKLET_NUM][BRICKLET_CONTEXT_MAX_SIZE/4] = {{0}};
+
+uint8_t bricklet_attached[BRICKLET_NUM] = {
+	BRICKLET_INIT_NO_BRICKLET,
+	BRICKLET_INIT_NO_BRICKLET,
+	BRICKLET_INIT_NO_BRICKLET,
+	BRICKLET_INIT_NO_BRICKLET
+};
+
+// Plugins are flashed to the Bricklet EEPROMs, not supported here
+void write_bricklet_plugin(const ComType com, const WriteBrickletPlugin *data) {
+	com_return_error(data, sizeof(MessageHeader), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
+}
+
+void read_bricklet_plugin(const ComType com, const ReadBrickletPlugin *data) {
+	com_return_error(data, sizeof(ReadBrickletPluginReturn), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
+}
+
+void write_bricklet_uid(const ComType com, const WriteBrickletUID *data) {
+	com_return_error(data, sizeof(MessageHeader), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
+}
+
+void read_bricklet_uid(const ComType com, const ReadBrickletUID *data) {
+	com_return_error(data, sizeof(ReadBrickletUIDReturn), MESSAGE_ERROR_CODE_NOT_SUPPORTED, com);
+}
+
+// Brick state that the firmware keeps in init.c and the extensions
+uint8_t master_mode = MASTER_MODE_NONE;
+uint8_t brick_hardware_version[3] = {2, 1, 0};
+uint8_t brick_init_bricklet_new_enumerate = 0;
+uint8_t rs485_first_message = 0;
+uint8_t chibi_first_message = 0;
+uint32_t host_brick_reset_count = 0;
+
+void brick_reset(void) {
+	host_brick_reset_count++;
+}
+
+// Bricklets are enumerated by the Bricklet code of init.c, which is not
+// part of the host build
+void brick_init_handle_bricklet_enumeration(void) {
+}
@@ -0,0 +1,96 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * routing.c: Routing table of the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Reduced version of the routing of the Master Brick firmware: Messages
+// from the PC are routed to the SPI stack by UID, broadcasts go to all
+// stack participants.
+
+#include "routing.h"
+
+#include <string.h>
+
+#include "config.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/spi/spi_stack/spi_stack_common_dma.h"
+
+extern ComInfo com_info;
+
+static RoutingTable routing_table[ROUTING_TABLE_SIZE];
+static uint8_t routing_table_size = 0;
+
+void routing_table_reset(void) {
+	memset(routing_table, 0, sizeof(routing_table));
+	routing_table_size = 0;
+}
+
+void routing_add_route(const uint32_t uid, const RouteTo route_to) {
+	for(uint8_t i = 0; i < routing_table_size; i++) {
+		if(routing_table[i].uid == uid) {
+			routing_table[i].route_to = route_to;
+			return;
+		}
+	}
+
+	if(routing_table_size < ROUTING_TABLE_SIZE) {
+		routing_table[routing_table_size].uid = uid;
+		routing_table[routing_table_size].route_to = route_to;
+		routing_table_size++;
+	}
+}
+
+RouteTo routing_route_to(const uint32_t uid) {
+	for(uint8_t i = 0; i < routing_table_size; i++) {
+		if(routing_table[i].uid == uid) {
+			return routing_table[i].route_to;
+		}
+	}
+
+	RouteTo route_to = {ROUTING_NONE, 0};
+	return route_to;
+}
+
+RouteTo routing_route_stack_to(const uint32_t uid) {
+	RouteTo route_to = routing_route_to(uid);
+	if(route_to.to != ROUTING_STACK) {
+		route_to.to = ROUTING_NONE;
+		route_to.option = 0;
+	}
+
+	return route_to;
+}
+
+void routing_master_from_pc(const char *data, const uint16_t length, const uint8_t com) {
+	const uint32_t uid = ((const MessageHeader*)data)->uid;
+
+	if(uid == 0) {
+		for(uint32_t address = SPI_ADDRESS_MIN; address <= com_info.last_stack_address; address++) {
+			send_blocking_with_timeout_options(data, length, COM_SPI_STACK, &address);
+		}
+		return;
+	}
+
+	const RouteTo route_to = routing_route_to(uid);
+	if(route_to.to == ROUTING_STACK) {
+		uint32_t address = route_to.option;
+		send_blocking_with_timeout_options(data, length, COM_SPI_STACK, &address);
+	}
+}
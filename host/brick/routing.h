@@ -0,0 +1,53 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * routing.h: Routing table of the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Same interface as routing.h of the Master Brick firmware
+
+#ifndef ROUTING_H
+#define ROUTING_H
+
+#include <stdint.h>
+
+#define ROUTING_NONE   0
+#define ROUTING_STACK  1
+#define ROUTING_RS485  2
+#define ROUTING_CHIBI  3
+#define ROUTING_WIFI   4
+
+#define ROUTING_TABLE_SIZE 64
+
+typedef struct {
+	uint8_t to;
+	uint8_t option;
+} __attribute__((__packed__)) RouteTo;
+
+typedef struct {
+	uint32_t uid;
+	RouteTo route_to;
+} __attribute__((__packed__)) RoutingTable;
+
+void routing_table_reset(void);
+void routing_add_route(const uint32_t uid, const RouteTo route_to);
+RouteTo routing_route_to(const uint32_t uid);
+RouteTo routing_route_stack_to(const uint32_t uid);
+void routing_master_from_pc(const char *data, const uint16_t length, const uint8_t com);
+
+#endif
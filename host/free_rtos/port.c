@@ -0,0 +1,157 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * port.c: FreeRTOS port for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The FreeRTOS kernel (tasks.c, queue.c, list.c) is used unchanged, this
+// port switches between the tasks with ucontext in one host thread. As in
+// the firmware the scheduler is cooperative (configUSE_PREEMPTION 0), a
+// task only loses the CPU if it yields, blocks or an interrupt requests a
+// context switch (portEND_SWITCHING_ISR). Interrupts are the mock
+// peripherals of host_hal.c, they only run while no task masks them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+
+#define HOST_TASK_STACK_SIZE (256*1024)
+
+typedef struct {
+	ucontext_t context;
+	pdTASK_CODE code;
+	void *parameters;
+} HostTask;
+
+// The first member of the TCB is the top of stack, it points to the HostTask
+extern void * volatile pxCurrentTCB;
+
+extern volatile uint32_t system_timer_tick;
+
+static ucontext_t host_scheduler_context;
+static unsigned portBASE_TYPE host_critical_nesting = 0;
+static bool host_scheduler_running = false;
+
+static HostTask* host_task_current(void) {
+	return (HostTask*)**((portSTACK_TYPE**)pxCurrentTCB);
+}
+
+static void host_task_start(void) {
+	HostTask *task = host_task_current();
+
+	// Tasks start with interrupts enabled
+	host_critical_nesting = 0;
+	host_irq_unmask();
+
+	task->code(task->parameters);
+
+	// A task must not return, we delete it as the firmware would have to
+	vTaskDelete(NULL);
+}
+
+portSTACK_TYPE *pxPortInitialiseStack(portSTACK_TYPE *pxTopOfStack, pdTASK_CODE pxCode, void *pvParameters) {
+	HostTask *task = malloc(sizeof(HostTask));
+	if(task == NULL || getcontext(&task->context) != 0) {
+		fprintf(stderr, "port: could not create task context\n");
+		abort();
+	}
+
+	// The PDC registers are 32 bit, a buffer on the task stack can only be
+	// given to a mock peripheral if the stack is below 4GB
+	void *stack = mmap(NULL, HOST_TASK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if(stack == MAP_FAILED) {
+		fprintf(stderr, "port: could not allocate task stack\n");
+		abort();
+	}
+
+	task->context.uc_stack.ss_sp = stack;
+	task->context.uc_stack.ss_size = HOST_TASK_STACK_SIZE;
+	task->context.uc_link = NULL;
+	task->code = pxCode;
+	task->parameters = pvParameters;
+	makecontext(&task->context, host_task_start, 0);
+
+	*pxTopOfStack = (portSTACK_TYPE)task;
+	return pxTopOfStack;
+}
+
+void xPortPendSVHandler(void) {
+	if(!host_scheduler_running) {
+		return;
+	}
+
+	HostTask *from = host_task_current();
+	vTaskSwitchContext();
+	HostTask *to = host_task_current();
+
+	if(from != to) {
+		swapcontext(&from->context, &to->context);
+	}
+}
+
+void xPortSysTickHandler(void) {
+	system_timer_tick++;
+	vTaskIncrementTick();
+}
+
+void vPortYieldFromISR(void) {
+	// The context switch is done by host_hal_poll (or right away if nothing
+	// masks it), it also steps the mock peripherals and the time. Thus a task
+	// that polls in a loop with taskYIELD will see interrupts as on the MCU.
+	host_irq_set_pending(PendSV_IRQn);
+	if(!host_hal_in_irq()) {
+		host_hal_poll();
+	}
+}
+
+void vPortEnterCritical(void) {
+	portDISABLE_INTERRUPTS();
+	host_critical_nesting++;
+}
+
+void vPortExitCritical(void) {
+	host_critical_nesting--;
+	if(host_critical_nesting == 0) {
+		portENABLE_INTERRUPTS();
+	}
+}
+
+portBASE_TYPE xPortStartScheduler(void) {
+	// SysTick with configTICK_RATE_HZ, as prvSetupTimerInterrupt
+	SysTick->LOAD = (configCPU_CLOCK_HZ / configTICK_RATE_HZ) - 1UL;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+
+	// Returns when vTaskEndScheduler is called
+	host_scheduler_running = true;
+	swapcontext(&host_scheduler_context, &host_task_current()->context);
+
+	SysTick->CTRL = 0;
+	host_critical_nesting = 0;
+	host_irq_unmask();
+
+	return pdTRUE;
+}
+
+void vPortEndScheduler(void) {
+	host_scheduler_running = false;
+	swapcontext(&host_task_current()->context, &host_scheduler_context);
+}
@@ -0,0 +1,77 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * portmacro.h: FreeRTOS port for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Same guard as GCC/ARM_CM3/portmacro.h, portable.h includes that one
+// only if no other port was included before.
+#ifndef PORTMACRO_H
+#define PORTMACRO_H
+
+#include <stdint.h>
+
+// The tasks run with ucontext on stacks from the host heap. The stack that
+// FreeRTOS allocates for a task only holds a pointer to the context, so
+// portSTACK_TYPE has to be large enough for a pointer.
+#define portCHAR		char
+#define portFLOAT		float
+#define portDOUBLE		double
+#define portLONG		int
+#define portSHORT		short
+#define portSTACK_TYPE	uintptr_t
+#define portBASE_TYPE	int
+
+// Ticks wrap around after 32 bit as on the Cortex-M3
+typedef uint32_t portTickType;
+#define portMAX_DELAY ( portTickType ) 0xffffffff
+
+#define portSTACK_GROWTH			( -1 )
+#define portTICK_RATE_MS			( ( portTickType ) 1000 / configTICK_RATE_HZ )
+#define portBYTE_ALIGNMENT			8
+
+// A yield pends the context switch, it is done as soon as no interrupt is
+// running and interrupts are not masked (like PendSV on the Cortex-M3)
+extern void vPortYieldFromISR( void );
+
+#define portYIELD()					vPortYieldFromISR()
+#define portEND_SWITCHING_ISR( xSwitchRequired ) if( xSwitchRequired ) vPortYieldFromISR()
+
+// BASEPRI of the Cortex-M3 port, the host does not have interrupt priorities
+extern void host_irq_mask( void );
+extern void host_irq_unmask( void );
+
+#define portSET_INTERRUPT_MASK()				host_irq_mask()
+#define portCLEAR_INTERRUPT_MASK()				host_irq_unmask()
+#define portSET_INTERRUPT_MASK_FROM_ISR()		0
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)	(void)x
+
+extern void vPortEnterCritical( void );
+extern void vPortExitCritical( void );
+
+#define portDISABLE_INTERRUPTS()	portSET_INTERRUPT_MASK()
+#define portENABLE_INTERRUPTS()		portCLEAR_INTERRUPT_MASK()
+#define portENTER_CRITICAL()		vPortEnterCritical()
+#define portEXIT_CRITICAL()			vPortExitCritical()
+
+#define portTASK_FUNCTION_PROTO( vFunction, pvParameters ) void vFunction( void *pvParameters )
+#define portTASK_FUNCTION( vFunction, pvParameters ) void vFunction( void *pvParameters )
+
+#define portNOP()
+
+#endif /* PORTMACRO_H */
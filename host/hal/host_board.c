@@ -0,0 +1,40 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_board.c: Mock board functions for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "host_hal.h"
+
+#include "config.h"
+
+// The ADC is not modeled, the Brick reports 0V on all channels
+int32_t adc_offset = 0;
+int32_t adc_gain_div = 1;
+
+uint16_t adc_channel_get_data(const uint8_t c) {
+	(void)c;
+	return 0;
+}
+
+void adc_calibrate(const uint8_t c) {
+	(void)c;
+}
+
+void adc_write_calibration_to_flash(void) {
+}
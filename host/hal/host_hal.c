@@ -0,0 +1,361 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_hal.c: Mock SAM3S core peripherals for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "host_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#define HOST_IRQ_NUM             (16 + 35)
+#define HOST_IRQ_INDEX(irq)      ((irq) + 16)
+#define HOST_PERIPHERAL_STEP_MAX 8
+
+Spi host_spi;
+Tc host_tc0;
+Tc host_tc1;
+Twi host_twi0;
+Twi host_twi1;
+Pwm host_pwm;
+Usart host_usart0;
+Usart host_usart1;
+Udp host_udp;
+Adc host_adc;
+Dacc host_dacc;
+Crccu host_crccu;
+Matrix host_matrix;
+Pmc host_pmc;
+Uart host_uart0;
+Uart host_uart1;
+Chipid host_chipid;
+Efc host_efc;
+Pio host_pioa;
+Pio host_piob;
+Pio host_pioc;
+Rstc host_rstc;
+Supc host_supc;
+Rtt host_rtt;
+Wdt host_wdt;
+Rtc host_rtc;
+Gpbr host_gpbr;
+SCB_Type host_scb;
+NVIC_Type host_nvic;
+
+static SysTick_Type host_systick;
+static DWT_Type host_dwt;
+static CoreDebug_Type host_core_debug_regs;
+
+// Same order as exception_table in board_cstartup_gnu.c. The handlers are
+// weak, a handler that is not linked into the test is NULL.
+#define HOST_WEAK_HANDLER(name) extern void name(void) __attribute__((weak));
+HOST_WEAK_HANDLER(xPortPendSVHandler)
+HOST_WEAK_HANDLER(xPortSysTickHandler)
+HOST_WEAK_HANDLER(SUPC_IrqHandler)
+HOST_WEAK_HANDLER(RSTC_IrqHandler)
+HOST_WEAK_HANDLER(RTC_IrqHandler)
+HOST_WEAK_HANDLER(RTT_IrqHandler)
+HOST_WEAK_HANDLER(WDT_IrqHandler)
+HOST_WEAK_HANDLER(PMC_IrqHandler)
+HOST_WEAK_HANDLER(EEFC_IrqHandler)
+HOST_WEAK_HANDLER(UART0_IrqHandler)
+HOST_WEAK_HANDLER(UART1_IrqHandler)
+HOST_WEAK_HANDLER(SMC_IrqHandler)
+HOST_WEAK_HANDLER(PIOA_IrqHandler)
+HOST_WEAK_HANDLER(PIOB_IrqHandler)
+HOST_WEAK_HANDLER(PIOC_IrqHandler)
+HOST_WEAK_HANDLER(USART0_IrqHandler)
+HOST_WEAK_HANDLER(USART1_IrqHandler)
+HOST_WEAK_HANDLER(MCI_IrqHandler)
+HOST_WEAK_HANDLER(TWI0_IrqHandler)
+HOST_WEAK_HANDLER(TWI1_IrqHandler)
+HOST_WEAK_HANDLER(SPI_IrqHandler)
+HOST_WEAK_HANDLER(SSC_IrqHandler)
+HOST_WEAK_HANDLER(TC0_IrqHandler)
+HOST_WEAK_HANDLER(TC1_IrqHandler)
+HOST_WEAK_HANDLER(TC2_IrqHandler)
+HOST_WEAK_HANDLER(ADC_IrqHandler)
+HOST_WEAK_HANDLER(DAC_IrqHandler)
+HOST_WEAK_HANDLER(PWM_IrqHandler)
+HOST_WEAK_HANDLER(CRCCU_IrqHandler)
+HOST_WEAK_HANDLER(ACC_IrqHandler)
+HOST_WEAK_HANDLER(USBD_IrqHandler)
+
+static HostIrqHandler host_irq_handler[HOST_IRQ_NUM];
+static uint64_t host_irq_pending = 0;
+static uint64_t host_irq_enabled = 0;
+static uint32_t host_irq_priority[HOST_IRQ_NUM];
+static uint32_t host_systick_pending = 0;
+static uint32_t host_irq_primask = 0;
+static uint32_t host_irq_basepri = 0;
+static bool host_irq_active = false;
+
+static HostPeripheralStep host_peripheral_step[HOST_PERIPHERAL_STEP_MAX];
+static void *host_peripheral_step_context[HOST_PERIPHERAL_STEP_MAX];
+static uint8_t host_peripheral_step_num = 0;
+
+static uint64_t host_time_start = 0;
+static uint64_t host_systick_last = 0;
+
+uint64_t host_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec)*1000000000ULL + ts.tv_nsec - host_time_start;
+}
+
+static uint64_t host_time_cycles(void) {
+	return host_time_ns()*(BOARD_MCK/1000000)/1000;
+}
+
+SysTick_Type* host_systick_update(void) {
+	// SysTick counts down from LOAD to 0
+	const uint32_t reload = host_systick.LOAD + 1;
+	host_systick.VAL = host_systick.LOAD - (uint32_t)(host_time_cycles() % reload);
+	return &host_systick;
+}
+
+DWT_Type* host_dwt_update(void) {
+	host_dwt.CYCCNT = (uint32_t)host_time_cycles();
+	return &host_dwt;
+}
+
+CoreDebug_Type* host_core_debug(void) {
+	return &host_core_debug_regs;
+}
+
+void host_irq_set_handler(const IRQn_Type irq, HostIrqHandler handler) {
+	host_irq_handler[HOST_IRQ_INDEX(irq)] = handler;
+}
+
+void host_irq_set_pending(const IRQn_Type irq) {
+	if(irq == SysTick_IRQn) {
+		host_systick_pending++;
+	} else {
+		host_irq_pending |= 1ULL << HOST_IRQ_INDEX(irq);
+	}
+}
+
+// Peripheral interrupts are only handled if they are enabled in the NVIC,
+// a disabled interrupt stays pending. The core exceptions are always enabled.
+static bool host_irq_is_enabled(const uint8_t index) {
+	return index < HOST_IRQ_INDEX(0) || (host_irq_enabled & (1ULL << index));
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq) {
+	host_irq_enabled |= 1ULL << HOST_IRQ_INDEX(irq);
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq) {
+	host_irq_enabled &= ~(1ULL << HOST_IRQ_INDEX(irq));
+}
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irq) {
+	return (host_irq_pending & (1ULL << HOST_IRQ_INDEX(irq))) ? 1 : 0;
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type irq) {
+	host_irq_set_pending(irq);
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq) {
+	host_irq_pending &= ~(1ULL << HOST_IRQ_INDEX(irq));
+}
+
+// The priorities are stored for the tests, the host does not preempt interrupts
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {
+	host_irq_priority[HOST_IRQ_INDEX(irq)] = priority;
+}
+
+uint32_t NVIC_GetPriority(IRQn_Type irq) {
+	return host_irq_priority[HOST_IRQ_INDEX(irq)];
+}
+
+bool host_hal_in_irq(void) {
+	return host_irq_active;
+}
+
+// Handles the pending interrupts if they are not masked. The peripheral
+// interrupts are handled in the order of their number, then SysTick. The
+// FreeRTOS context switch (PendSV) has the lowest priority, it is called
+// after all other interrupts are done (as on the Cortex-M3).
+static void host_irq_dispatch(void) {
+	if(host_irq_active || host_irq_primask || host_irq_basepri) {
+		return;
+	}
+
+	host_irq_active = true;
+	for(;;) {
+		uint8_t index = HOST_IRQ_INDEX(0);
+		while(index < HOST_IRQ_NUM && !((host_irq_pending & (1ULL << index)) && host_irq_is_enabled(index))) {
+			index++;
+		}
+
+		if(index < HOST_IRQ_NUM) {
+			host_irq_pending &= ~(1ULL << index);
+			if(host_irq_handler[index] != NULL) {
+				host_irq_handler[index]();
+			}
+		} else if(host_systick_pending > 0) {
+			host_systick_pending--;
+			if(host_irq_handler[HOST_IRQ_INDEX(SysTick_IRQn)] != NULL) {
+				host_irq_handler[HOST_IRQ_INDEX(SysTick_IRQn)]();
+			}
+		} else {
+			break;
+		}
+	}
+	host_irq_active = false;
+
+	const uint64_t pendsv = 1ULL << HOST_IRQ_INDEX(PendSV_IRQn);
+	if(host_irq_pending & pendsv) {
+		host_irq_pending &= ~pendsv;
+		if(host_irq_handler[HOST_IRQ_INDEX(PendSV_IRQn)] != NULL) {
+			host_irq_handler[HOST_IRQ_INDEX(PendSV_IRQn)]();
+		}
+	}
+}
+
+void host_irq_disable(void) {
+	host_irq_primask = 1;
+}
+
+void host_irq_enable(void) {
+	host_irq_primask = 0;
+	host_irq_dispatch();
+}
+
+uint32_t host_irq_get_primask(void) {
+	return host_irq_primask;
+}
+
+void host_irq_mask(void) {
+	host_irq_basepri = 1;
+}
+
+void host_irq_unmask(void) {
+	host_irq_basepri = 0;
+	host_irq_dispatch();
+}
+
+void host_hal_add_peripheral_step(HostPeripheralStep step, void *context) {
+	if(host_peripheral_step_num == HOST_PERIPHERAL_STEP_MAX) {
+		fprintf(stderr, "host_hal: too many peripheral models\n");
+		abort();
+	}
+
+	host_peripheral_step[host_peripheral_step_num] = step;
+	host_peripheral_step_context[host_peripheral_step_num] = context;
+	host_peripheral_step_num++;
+}
+
+void host_hal_poll(void) {
+	// One SysTick interrupt per elapsed millisecond. They are only counted
+	// if the interrupt is enabled (see SysTick_Config/prvSetupTimerInterrupt).
+	const uint64_t now = host_time_ns();
+	if(host_systick.CTRL & SysTick_CTRL_TICKINT_Msk) {
+		while(now - host_systick_last >= 1000000) {
+			host_systick_last += 1000000;
+			host_irq_set_pending(SysTick_IRQn);
+		}
+	} else {
+		host_systick_last = now;
+	}
+
+	for(uint8_t i = 0; i < host_peripheral_step_num; i++) {
+		host_peripheral_step[i](host_peripheral_step_context[i]);
+	}
+
+	host_irq_dispatch();
+}
+
+void host_sleep_ns(const uint64_t ns) {
+	// Polls at least once, the pins of a bit-banged bus are only
+	// updated by the peripheral step (see host_pio.c)
+	const uint64_t start = host_time_ns();
+	do {
+		host_hal_poll();
+	} while(host_time_ns() - start < ns);
+}
+
+void host_hal_init(void) {
+	host_time_start = 0;
+	host_time_start = host_time_ns();
+	host_systick_last = 0;
+
+	memset(host_irq_handler, 0, sizeof(host_irq_handler));
+	host_irq_pending = 0;
+	host_irq_enabled = 0;
+	memset(host_irq_priority, 0, sizeof(host_irq_priority));
+	host_systick_pending = 0;
+	host_irq_primask = 0;
+	host_irq_basepri = 0;
+	host_irq_active = false;
+	host_peripheral_step_num = 0;
+
+	host_irq_set_handler(PendSV_IRQn,  xPortPendSVHandler);
+	host_irq_set_handler(SysTick_IRQn, xPortSysTickHandler);
+	host_irq_set_handler(SUPC_IRQn,    SUPC_IrqHandler);
+	host_irq_set_handler(RSTC_IRQn,    RSTC_IrqHandler);
+	host_irq_set_handler(RTC_IRQn,     RTC_IrqHandler);
+	host_irq_set_handler(RTT_IRQn,     RTT_IrqHandler);
+	host_irq_set_handler(WDT_IRQn,     WDT_IrqHandler);
+	host_irq_set_handler(PMC_IRQn,     PMC_IrqHandler);
+	host_irq_set_handler(EFC_IRQn,     EEFC_IrqHandler);
+	host_irq_set_handler(UART0_IRQn,   UART0_IrqHandler);
+	host_irq_set_handler(UART1_IRQn,   UART1_IrqHandler);
+	host_irq_set_handler(SMC_IRQn,     SMC_IrqHandler);
+	host_irq_set_handler(PIOA_IRQn,    PIOA_IrqHandler);
+	host_irq_set_handler(PIOB_IRQn,    PIOB_IrqHandler);
+	host_irq_set_handler(PIOC_IRQn,    PIOC_IrqHandler);
+	host_irq_set_handler(USART0_IRQn,  USART0_IrqHandler);
+	host_irq_set_handler(USART1_IRQn,  USART1_IrqHandler);
+	host_irq_set_handler(HSMCI_IRQn,   MCI_IrqHandler);
+	host_irq_set_handler(TWI0_IRQn,    TWI0_IrqHandler);
+	host_irq_set_handler(TWI1_IRQn,    TWI1_IrqHandler);
+	host_irq_set_handler(SPI_IRQn,     SPI_IrqHandler);
+	host_irq_set_handler(SSC_IRQn,     SSC_IrqHandler);
+	host_irq_set_handler(TC0_IRQn,     TC0_IrqHandler);
+	host_irq_set_handler(TC1_IRQn,     TC1_IrqHandler);
+	host_irq_set_handler(TC2_IRQn,     TC2_IrqHandler);
+	host_irq_set_handler(ADC_IRQn,     ADC_IrqHandler);
+	host_irq_set_handler(DACC_IRQn,    DAC_IrqHandler);
+	host_irq_set_handler(PWM_IRQn,     PWM_IrqHandler);
+	host_irq_set_handler(CRCCU_IRQn,   CRCCU_IrqHandler);
+	host_irq_set_handler(ACC_IRQn,     ACC_IrqHandler);
+	host_irq_set_handler(UDP_IRQn,     USBD_IrqHandler);
+
+	// Reset values that the firmware waits for
+	memset(&host_systick, 0, sizeof(host_systick));
+	host_systick.LOAD = BOARD_MCK/1000 - 1;
+	HOST_REG(host_chipid.CHIPID_CIDR) = 0x28A00960; // SAM3S4C
+	HOST_REG(host_efc.EEFC_FSR) = EEFC_FSR_FRDY;
+	HOST_REG(host_pmc.PMC_SR) = PMC_SR_MOSCXTS | PMC_SR_LOCKA | PMC_SR_MCKRDY | PMC_SR_LOCKB | PMC_SR_MOSCSELS | PMC_SR_MOSCRCS;
+	HOST_REG(host_twi0.TWI_SR) = TWI_SR_TXCOMP | TWI_SR_TXRDY;
+	HOST_REG(host_twi1.TWI_SR) = host_twi0.TWI_SR;
+	HOST_REG(host_adc.ADC_ISR) = ADC_ISR_DRDY;
+
+	host_pio_init();
+	host_spi_init();
+	host_usart_init();
+	host_udp_init();
+}
@@ -0,0 +1,267 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_hal.h: Mock SAM3S peripherals for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// This header is included in front of every source file of the host build
+// (-include host_hal.h). It replaces the Cortex-M3 intrinsics and points
+// the peripheral base addresses of SAM3S.h and core_cm3.h to register
+// blocks in RAM, so that the firmware code runs unchanged on a PC.
+//
+// Peripherals that have a behaviour (SysTick, DWT, SPI and USART PDC
+// transfers, interrupts) are modeled in host_hal.c, everything else is
+// plain memory that the code under test writes to and a test can check.
+
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The CMSIS intrinsics are ARM assembler, we provide our own
+#define __CORE_CMINSTR_H
+#define __CORE_CMFUNC_H
+
+// PRIMASK (__disable_irq) and BASEPRI (FreeRTOS critical sections)
+void host_irq_disable(void);
+void host_irq_enable(void);
+uint32_t host_irq_get_primask(void);
+void host_irq_mask(void);
+void host_irq_unmask(void);
+
+#define __disable_irq()    host_irq_disable()
+#define __enable_irq()     host_irq_enable()
+#define __get_PRIMASK()    host_irq_get_primask()
+#define __NOP()            do {} while(0)
+#define __WFI()            host_hal_poll()
+#define __WFE()            host_hal_poll()
+#define __DSB()            __sync_synchronize()
+#define __DMB()            __sync_synchronize()
+#define __ISB()            __sync_synchronize()
+#define __REV(value)       __builtin_bswap32(value)
+#define __CLZ(value)       ((uint8_t)((value) == 0 ? 32 : __builtin_clz(value)))
+
+// Busy waits of util_definitions.h
+void host_sleep_ns(const uint64_t ns);
+
+#define SLEEP_NS(x) host_sleep_ns(x)
+#define SLEEP_US(x) host_sleep_ns((uint64_t)(x)*1000)
+#define SLEEP_MS(x) host_sleep_ns((uint64_t)(x)*1000000)
+
+// FreeRTOS port for the host (host/free_rtos) instead of GCC/ARM_CM3
+#include "portmacro.h"
+
+// The NVIC functions of core_cm3.h are compiled with the hardware address
+// of the NVIC, they are renamed and replaced by the ones of host_hal.c
+#define NVIC_EnableIRQ       cm3_NVIC_EnableIRQ
+#define NVIC_DisableIRQ      cm3_NVIC_DisableIRQ
+#define NVIC_GetPendingIRQ   cm3_NVIC_GetPendingIRQ
+#define NVIC_SetPendingIRQ   cm3_NVIC_SetPendingIRQ
+#define NVIC_ClearPendingIRQ cm3_NVIC_ClearPendingIRQ
+#define NVIC_SetPriority     cm3_NVIC_SetPriority
+#define NVIC_GetPriority     cm3_NVIC_GetPriority
+
+#define sam3s4
+#include "bricklib/drivers/board/sam3s/SAM3S.h"
+
+#undef NVIC_EnableIRQ
+#undef NVIC_DisableIRQ
+#undef NVIC_GetPendingIRQ
+#undef NVIC_SetPendingIRQ
+#undef NVIC_ClearPendingIRQ
+#undef NVIC_SetPriority
+#undef NVIC_GetPriority
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irq);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irq);
+
+// Register blocks of the peripherals (see host_hal.c)
+extern Spi host_spi;
+extern Tc host_tc0;
+extern Tc host_tc1;
+extern Twi host_twi0;
+extern Twi host_twi1;
+extern Pwm host_pwm;
+extern Usart host_usart0;
+extern Usart host_usart1;
+extern Udp host_udp;
+extern Adc host_adc;
+extern Dacc host_dacc;
+extern Crccu host_crccu;
+extern Matrix host_matrix;
+extern Pmc host_pmc;
+extern Uart host_uart0;
+extern Uart host_uart1;
+extern Chipid host_chipid;
+extern Efc host_efc;
+extern Pio host_pioa;
+extern Pio host_piob;
+extern Pio host_pioc;
+extern Rstc host_rstc;
+extern Supc host_supc;
+extern Rtt host_rtt;
+extern Wdt host_wdt;
+extern Rtc host_rtc;
+extern Gpbr host_gpbr;
+extern SCB_Type host_scb;
+extern NVIC_Type host_nvic;
+
+SysTick_Type* host_systick_update(void);
+DWT_Type* host_dwt_update(void);
+CoreDebug_Type* host_core_debug(void);
+
+#undef SPI
+#undef TC0
+#undef TC1
+#undef TWI0
+#undef TWI1
+#undef PWM
+#undef USART0
+#undef USART1
+#undef UDP
+#undef ADC
+#undef DACC
+#undef CRCCU
+#undef MATRIX
+#undef PMC
+#undef UART0
+#undef UART1
+#undef CHIPID
+#undef EFC
+#undef PIOA
+#undef PIOB
+#undef PIOC
+#undef RSTC
+#undef SUPC
+#undef RTT
+#undef WDT
+#undef RTC
+#undef GPBR
+#undef SCB
+#undef NVIC
+#undef SysTick
+#undef DWT
+#undef CoreDebug
+#undef REG_RSTC_MR
+#undef REG_CHIPID_CIDR
+
+#define SPI       (&host_spi)
+#define TC0       (&host_tc0)
+#define TC1       (&host_tc1)
+#define TWI0      (&host_twi0)
+#define TWI1      (&host_twi1)
+#define PWM       (&host_pwm)
+#define USART0    (&host_usart0)
+#define USART1    (&host_usart1)
+#define UDP       (&host_udp)
+#define ADC       (&host_adc)
+#define DACC      (&host_dacc)
+#define CRCCU     (&host_crccu)
+#define MATRIX    (&host_matrix)
+#define PMC       (&host_pmc)
+#define UART0     (&host_uart0)
+#define UART1     (&host_uart1)
+#define CHIPID    (&host_chipid)
+#define EFC       (&host_efc)
+#define PIOA      (&host_pioa)
+#define PIOB      (&host_piob)
+#define PIOC      (&host_pioc)
+#define RSTC      (&host_rstc)
+#define SUPC      (&host_supc)
+#define RTT       (&host_rtt)
+#define WDT       (&host_wdt)
+#define RTC       (&host_rtc)
+#define GPBR      (&host_gpbr)
+#define SCB       (&host_scb)
+#define NVIC      (&host_nvic)
+#define SysTick   (host_systick_update())
+#define DWT       (host_dwt_update())
+#define CoreDebug (host_core_debug())
+
+#define REG_RSTC_MR     (host_rstc.RSTC_MR)
+#define REG_CHIPID_CIDR (host_chipid.CHIPID_CIDR)
+
+// Time and interrupts. The peripherals are stepped and pending interrupts
+// are handled whenever the code under test yields, waits for an interrupt
+// or enables interrupts again (or if a test calls host_hal_poll directly).
+// Time is taken from the monotonic clock of the host, SysTick and the DWT
+// cycle counter run with BOARD_MCK as on the real hardware.
+typedef void (*HostIrqHandler)(void);
+typedef void (*HostPeripheralStep)(void *context);
+
+void host_hal_init(void);
+void host_hal_poll(void);
+bool host_hal_in_irq(void);
+void host_hal_add_peripheral_step(HostPeripheralStep step, void *context);
+void host_irq_set_handler(const IRQn_Type irq, HostIrqHandler handler);
+void host_irq_set_pending(const IRQn_Type irq);
+uint64_t host_time_ns(void);
+
+// Write access to read-only registers (status registers of the models)
+#define HOST_REG(reg) (*(volatile uint32_t*)&(reg))
+
+// DMA buffers are given to the PDC as 32 bit addresses. The host build is
+// linked without PIE, so static buffers and the heap are below 4GB and the
+// address can be converted back.
+#define HOST_PDC_POINTER(address) ((uint8_t*)(uintptr_t)(address))
+
+// PIO model (host_pio.c): The input level of pins that are not outputs
+// is set by the test. A listener is called with the SODR/CODR writes
+// since the last step, after they were applied to ODSR and PDSR.
+typedef void (*HostPIOListener)(void *context, Pio *pio, const uint32_t set, const uint32_t clear);
+void host_pio_set_input(Pio *pio, const uint32_t mask, const bool high);
+void host_pio_add_listener(HostPIOListener listener, void *context);
+
+// SPI bus model (host_spi.c): The PDC transfer that the firmware starts as
+// master is handed to the device function, which gets the MOSI bytes and
+// fills the MISO bytes. The device can find out which chip select is active
+// with PIO_GetOutputDataStatus. ENDRX/ENDTX are set after the time that the
+// transfer takes on the wire.
+typedef void (*HostSPIDevice)(void *context, const uint8_t *mosi, uint8_t *miso, const uint16_t length);
+void host_spi_set_device(HostSPIDevice device, void *context);
+uint32_t host_spi_get_transfer_count(void);
+
+// If the firmware is SPI slave, the test is the master. It clocks a frame
+// through the PDC buffers of the firmware and releases the slave select
+// (NSSR interrupt). Returns after the interrupt was handled.
+void host_spi_slave_transfer(const uint8_t *mosi, uint8_t *miso, const uint16_t length);
+
+// USART in SPI master mode (co-MCU Bricklets), same as the SPI bus model
+void host_usart_set_device(Usart *usart, HostSPIDevice device, void *context);
+
+// USB device (host_udp.c): The PC side of the bulk endpoints. The test
+// writes messages to OUT_EP and reads the bytes that the firmware sent
+// on IN_EP (in packets of at most 64 bytes).
+bool host_udp_write(const void *data, const uint16_t length);
+uint16_t host_udp_read(void *data, const uint16_t length);
+uint16_t host_udp_read_available(void);
+uint32_t host_udp_get_in_packet_count(void);
+
+// Called by host_hal_init
+void host_pio_init(void);
+void host_spi_init(void);
+void host_usart_init(void);
+void host_udp_init(void);
+
+#endif
@@ -0,0 +1,131 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_pio.c: Mock PIO controllers for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The set/clear register pairs (SODR/CODR, OER/ODR, PER/PDR) are plain
+// memory. The writes are collected in the registers and applied to the
+// status registers (ODSR, OSR, PSR) the next time the peripherals are
+// stepped. The firmware always waits (SLEEP_NS, taskYIELD, interrupt)
+// before it depends on the pin state, so this is early enough.
+//
+// If a pin is set and cleared in the same step, we take the clear as the
+// later write: Bit-banged clocks are set at the end of a bit and cleared
+// at the start of the next one and a select is cleared before a transfer.
+
+#include "host_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#define HOST_PIO_NUM 3
+#define HOST_PIO_LISTENER_MAX 4
+
+static Pio* const host_pio[HOST_PIO_NUM] = {PIOA, PIOB, PIOC};
+static uint32_t host_pio_input[HOST_PIO_NUM];
+
+static HostPIOListener host_pio_listener[HOST_PIO_LISTENER_MAX];
+static void *host_pio_listener_context[HOST_PIO_LISTENER_MAX];
+static uint8_t host_pio_listener_num = 0;
+
+static uint8_t host_pio_index(const Pio *pio) {
+	for(uint8_t i = 0; i < HOST_PIO_NUM; i++) {
+		if(host_pio[i] == pio) {
+			return i;
+		}
+	}
+
+	fprintf(stderr, "host_pio: unknown PIO controller %p\n", (void*)pio);
+	abort();
+}
+
+static void host_pio_update_pdsr(const uint8_t i) {
+	Pio *pio = host_pio[i];
+	HOST_REG(pio->PIO_PDSR) = (pio->PIO_ODSR & pio->PIO_OSR) | (host_pio_input[i] & ~pio->PIO_OSR);
+}
+
+static void host_pio_step(void *context) {
+	(void)context;
+
+	for(uint8_t i = 0; i < HOST_PIO_NUM; i++) {
+		Pio *pio = host_pio[i];
+
+		HOST_REG(pio->PIO_PSR) = (pio->PIO_PSR | pio->PIO_PER) & ~pio->PIO_PDR;
+		HOST_REG(pio->PIO_OSR) = (pio->PIO_OSR | pio->PIO_OER) & ~pio->PIO_ODR;
+		HOST_REG(pio->PIO_IMR) = (pio->PIO_IMR | pio->PIO_IER) & ~pio->PIO_IDR;
+		pio->PIO_PER = 0;
+		pio->PIO_PDR = 0;
+		pio->PIO_OER = 0;
+		pio->PIO_ODR = 0;
+		pio->PIO_IER = 0;
+		pio->PIO_IDR = 0;
+
+		const uint32_t set = pio->PIO_SODR;
+		const uint32_t clear = pio->PIO_CODR;
+		if(set == 0 && clear == 0) {
+			continue;
+		}
+
+		pio->PIO_SODR = 0;
+		pio->PIO_CODR = 0;
+		pio->PIO_ODSR = (pio->PIO_ODSR | set) & ~clear;
+		host_pio_update_pdsr(i);
+
+		for(uint8_t j = 0; j < host_pio_listener_num; j++) {
+			host_pio_listener[j](host_pio_listener_context[j], pio, set, clear);
+		}
+	}
+}
+
+void host_pio_set_input(Pio *pio, const uint32_t mask, const bool high) {
+	const uint8_t i = host_pio_index(pio);
+	if(high) {
+		host_pio_input[i] |= mask;
+	} else {
+		host_pio_input[i] &= ~mask;
+	}
+
+	host_pio_update_pdsr(i);
+}
+
+void host_pio_add_listener(HostPIOListener listener, void *context) {
+	if(host_pio_listener_num == HOST_PIO_LISTENER_MAX) {
+		fprintf(stderr, "host_pio: too many listeners\n");
+		abort();
+	}
+
+	host_pio_listener[host_pio_listener_num] = listener;
+	host_pio_listener_context[host_pio_listener_num] = context;
+	host_pio_listener_num++;
+}
+
+void host_pio_init(void) {
+	for(uint8_t i = 0; i < HOST_PIO_NUM; i++) {
+		memset(host_pio[i], 0, sizeof(Pio));
+		HOST_REG(host_pio[i]->PIO_PSR) = 0xFFFFFFFF;
+		host_pio_input[i] = 0xFFFFFFFF; // Pull-ups
+		host_pio_update_pdsr(i);
+	}
+
+	host_pio_listener_num = 0;
+	host_hal_add_peripheral_step(host_pio_step, NULL);
+}
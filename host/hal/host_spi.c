@@ -0,0 +1,227 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_spi.c: Mock SPI and USART (SPI mode) PDC transfers for the host build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// PTCR is write-only, a transfer is started if the last write to it enabled
+// RX and TX and both counters are set (the firmware always writes the
+// pointers and counters first). When the transfer starts, the device is
+// called and the counters are set to 0. The END flags are set after the
+// time the bytes take on the wire, unless PTCR is written before (the
+// firmware stops the transfer).
+//
+// The END flags are cleared if the next transfer is started. On the MCU
+// writing the counter clears them right away, here only with the next
+// step. Code that starts a transfer has to yield (or wait for the
+// interrupt) before it polls for ENDRX, otherwise it sees the old flag.
+
+#include "host_hal.h"
+
+#include <string.h>
+
+#include "config.h"
+#include "bricklib/utility/util_definitions.h"
+
+typedef struct {
+	volatile uint32_t *ptcr;
+	volatile uint32_t *status;
+	volatile uint32_t *rpr;
+	volatile uint32_t *rcr;
+	volatile uint32_t *tpr;
+	volatile uint32_t *tcr;
+	uint32_t status_end;
+	HostSPIDevice device;
+	void *context;
+	bool busy;
+	uint64_t done_time;
+	uint32_t transfer_count;
+} HostPDCBus;
+
+static HostPDCBus host_spi_bus;
+static HostPDCBus host_usart_bus[2];
+
+// Time of a transfer with clock divider (SCBR or CD) of MCK
+static uint64_t host_pdc_wire_time_ns(const uint32_t divider, const uint16_t length) {
+	return ((uint64_t)length)*8*MAX(divider, 1)*1000000000ULL/BOARD_MCK;
+}
+
+static void host_pdc_step(HostPDCBus *bus, const uint32_t divider) {
+	if(bus->busy) {
+		if(*bus->ptcr != 0) {
+			// Stopped by the firmware (timeout), maybe the next transfer is set up
+			bus->busy = false;
+		} else {
+			if(host_time_ns() >= bus->done_time) {
+				bus->busy = false;
+				*bus->status |= bus->status_end;
+			}
+			return;
+		}
+	}
+
+	if((*bus->ptcr & (SPI_PTCR_RXTEN | SPI_PTCR_TXTEN)) != (SPI_PTCR_RXTEN | SPI_PTCR_TXTEN) ||
+	   *bus->rcr == 0 || *bus->tcr == 0) {
+		return;
+	}
+
+	const uint16_t length = MIN(*bus->rcr, *bus->tcr);
+	*bus->status &= ~bus->status_end;
+	*bus->ptcr = 0;
+
+	if(bus->device != NULL) {
+		bus->device(bus->context, HOST_PDC_POINTER(*bus->tpr), HOST_PDC_POINTER(*bus->rpr), length);
+	} else {
+		memset(HOST_PDC_POINTER(*bus->rpr), 0xFF, length);
+	}
+
+	*bus->rpr += length;
+	*bus->tpr += length;
+	*bus->rcr -= length;
+	*bus->tcr -= length;
+	bus->transfer_count++;
+	bus->busy = true;
+	bus->done_time = host_time_ns() + host_pdc_wire_time_ns(divider, length);
+}
+
+static void host_spi_step(void *context) {
+	(void)context;
+
+	// If both are written in one step, we take IER as the later write: The
+	// master disables the interrupts with the end of a transfer and enables
+	// them again if it starts the next one from the interrupt.
+	HOST_REG(SPI->SPI_IMR) = (SPI->SPI_IMR & ~SPI->SPI_IDR) | SPI->SPI_IER;
+	SPI->SPI_IER = 0;
+	SPI->SPI_IDR = 0;
+
+	if(SPI->SPI_CR & SPI_CR_SWRST) {
+		SPI->SPI_MR = 0;
+		HOST_REG(SPI->SPI_IMR) = 0;
+		HOST_REG(SPI->SPI_SR) &= ~SPI_SR_SPIENS;
+	}
+	if(SPI->SPI_CR & SPI_CR_SPIEN) {
+		HOST_REG(SPI->SPI_SR) |= SPI_SR_SPIENS;
+	}
+	if(SPI->SPI_CR & SPI_CR_SPIDIS) {
+		HOST_REG(SPI->SPI_SR) &= ~SPI_SR_SPIENS;
+	}
+	SPI->SPI_CR = 0;
+
+	// As slave the test clocks the transfers (host_spi_slave_transfer)
+	if(SPI->SPI_MR & SPI_MR_MSTR) {
+		const uint32_t scbr = (SPI->SPI_CSR[0] & SPI_CSR_SCBR_Msk) >> SPI_CSR_SCBR_Pos;
+		host_pdc_step(&host_spi_bus, scbr);
+	}
+
+	if((SPI->SPI_SR & SPI->SPI_IMR) && (SPI->SPI_SR & SPI_SR_SPIENS)) {
+		host_irq_set_pending(SPI_IRQn);
+	}
+}
+
+static void host_usart_step(void *context) {
+	HostPDCBus *bus = context;
+	Usart *usart = bus == &host_usart_bus[0] ? USART0 : USART1;
+
+	HOST_REG(usart->US_IMR) = (usart->US_IMR | usart->US_IER) & ~usart->US_IDR;
+	usart->US_IER = 0;
+	usart->US_IDR = 0;
+
+	host_pdc_step(bus, usart->US_BRGR & US_BRGR_CD_Msk);
+
+	if(usart->US_CSR & usart->US_IMR) {
+		host_irq_set_pending(bus == &host_usart_bus[0] ? USART0_IRQn : USART1_IRQn);
+	}
+}
+
+void host_spi_set_device(HostSPIDevice device, void *context) {
+	host_spi_bus.device = device;
+	host_spi_bus.context = context;
+}
+
+uint32_t host_spi_get_transfer_count(void) {
+	return host_spi_bus.transfer_count;
+}
+
+void host_usart_set_device(Usart *usart, HostSPIDevice device, void *context) {
+	HostPDCBus *bus = &host_usart_bus[usart == USART0 ? 0 : 1];
+	bus->device = device;
+	bus->context = context;
+}
+
+void host_spi_slave_transfer(const uint8_t *mosi, uint8_t *miso, const uint16_t length) {
+	// Make sure that the PDC setup of the firmware is seen
+	host_hal_poll();
+
+	uint8_t *recv = HOST_PDC_POINTER(SPI->SPI_RPR);
+	const uint8_t *send = HOST_PDC_POINTER(SPI->SPI_TPR);
+	for(uint16_t i = 0; i < length; i++) {
+		if(SPI->SPI_RCR > 0) {
+			*recv++ = mosi[i];
+			SPI->SPI_RPR++;
+			SPI->SPI_RCR--;
+		}
+
+		if(SPI->SPI_TCR > 0) {
+			if(miso != NULL) {
+				miso[i] = *send;
+			}
+			send++;
+			SPI->SPI_TPR++;
+			SPI->SPI_TCR--;
+		} else if(miso != NULL) {
+			miso[i] = 0;
+		}
+	}
+
+	if(SPI->SPI_RCR == 0) {
+		HOST_REG(SPI->SPI_SR) |= SPI_SR_ENDRX | SPI_SR_RXBUFF;
+	}
+	if(SPI->SPI_TCR == 0) {
+		HOST_REG(SPI->SPI_SR) |= SPI_SR_ENDTX | SPI_SR_TXBUFE;
+	}
+
+	// Slave select is released, the flag is cleared when the
+	// interrupt handler reads the status register
+	HOST_REG(SPI->SPI_SR) |= SPI_SR_NSSR;
+	host_hal_poll();
+	HOST_REG(SPI->SPI_SR) &= ~SPI_SR_NSSR;
+}
+
+void host_spi_init(void) {
+	memset(&host_spi, 0, sizeof(host_spi));
+	memset(&host_usart0, 0, sizeof(host_usart0));
+	memset(&host_usart1, 0, sizeof(host_usart1));
+
+	const uint32_t spi_end = SPI_SR_ENDRX | SPI_SR_ENDTX | SPI_SR_RXBUFF | SPI_SR_TXBUFE;
+	HOST_REG(host_spi.SPI_SR) = SPI_SR_TDRE | SPI_SR_TXEMPTY | spi_end;
+	host_spi_bus = (HostPDCBus){&SPI->SPI_PTCR, &HOST_REG(SPI->SPI_SR), &SPI->SPI_RPR, &SPI->SPI_RCR,
+	                            &SPI->SPI_TPR, &SPI->SPI_TCR, spi_end, NULL, NULL, false, 0, 0};
+	host_hal_add_peripheral_step(host_spi_step, NULL);
+}
+
+void host_usart_init(void) {
+	Usart *usart[2] = {USART0, USART1};
+	const uint32_t usart_end = US_CSR_ENDRX | US_CSR_ENDTX | US_CSR_RXBUFF | US_CSR_TXBUFE;
+
+	for(uint8_t i = 0; i < 2; i++) {
+		HOST_REG(usart[i]->US_CSR) = US_CSR_TXRDY | US_CSR_TXEMPTY;
+		host_usart_bus[i] = (HostPDCBus){&usart[i]->US_PTCR, &HOST_REG(usart[i]->US_CSR), &usart[i]->US_RPR, &usart[i]->US_RCR,
+		                                 &usart[i]->US_TPR, &usart[i]->US_TCR, usart_end, NULL, NULL, false, 0, 0};
+		host_hal_add_peripheral_step(host_usart_step, &host_usart_bus[i]);
+	}
+}
@@ -0,0 +1,245 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_udp.c: Mock USB device port for the host (x86) build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Replaces USBD.c, USBDDriver.c and USBD_HAL.c. The device is always
+// configured, the bulk endpoints are modeled with the hooks that usb.c
+// uses with USBD_HAL.c (usb_custom_write_start, usb_send_get_packet,
+// usb_send_packet_done, usb_recv_ring_get_write_slot/commit).
+//
+// IN_EP has two banks as on the SAM3S. The PC acknowledges a packet after
+// its wire time at full speed. A packet that was already in the second bank
+// follows right away, otherwise it starts when it is written. OUT packets
+// that the test writes are read into the ring in the USB interrupt, as long
+// as it has free slots.
+
+#include "host_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/usb/usb.h"
+#include "bricklib/com/usb/usb_descriptors.h"
+#include "bricklib/utility/util_definitions.h"
+#include "bricklib/drivers/usb/USBD.h"
+#include "bricklib/drivers/usb/USBDDriver.h"
+#include "bricklib/drivers/usb/USBD_HAL.h"
+
+#define HOST_UDP_BANKS 2
+#define HOST_UDP_OUT_PACKETS 64
+#define HOST_UDP_IN_SIZE (64*1024)
+
+// 12 Mbit/s, token, sync, CRC, handshake and gaps of a bulk transaction
+// are counted as HOST_UDP_PACKET_OVERHEAD bytes
+#define HOST_UDP_BIT_TIME_NS 83
+#define HOST_UDP_PACKET_OVERHEAD 13
+
+typedef struct {
+	uint8_t data[DEFAULT_EP_SIZE];
+	uint16_t length;
+} HostUDPPacket;
+
+static HostUDPPacket host_udp_in_bank[HOST_UDP_BANKS];
+static uint8_t host_udp_in_banks = 0;
+static bool host_udp_in_sending = false;
+static uint64_t host_udp_in_done = 0; // end of the wire time of the first bank
+
+static uint8_t host_udp_in_data[HOST_UDP_IN_SIZE];
+static uint32_t host_udp_in_start = 0;
+static uint32_t host_udp_in_end = 0;
+static uint32_t host_udp_in_packets = 0;
+
+static HostUDPPacket host_udp_out[HOST_UDP_OUT_PACKETS];
+static uint8_t host_udp_out_start = 0;
+static uint8_t host_udp_out_used = 0;
+static bool host_udp_out_receiving = true;
+
+static void host_udp_in_fill(void) {
+	while(host_udp_in_banks < HOST_UDP_BANKS) {
+		uint16_t size;
+		const char *packet = usb_send_get_packet(&size);
+		if(packet == NULL) {
+			return;
+		}
+
+		memcpy(host_udp_in_bank[host_udp_in_banks].data, packet, size);
+		host_udp_in_bank[host_udp_in_banks].length = size;
+		host_udp_in_banks++;
+	}
+}
+
+static void host_udp_in_transfer(const uint64_t start) {
+	host_udp_in_sending = true;
+	host_udp_in_done = start + (host_udp_in_bank[0].length + HOST_UDP_PACKET_OVERHEAD)*8*HOST_UDP_BIT_TIME_NS;
+}
+
+bool usb_custom_write_start(void) {
+	host_udp_in_fill();
+	if(!host_udp_in_sending && host_udp_in_banks > 0) {
+		host_udp_in_transfer(host_time_ns());
+		return true;
+	}
+
+	return false;
+}
+
+void usb_set_read_endpoint_state_to_receiving(void) {
+	host_udp_out_receiving = true;
+}
+
+bool usbd_hal_is_disabled(const uint8_t bEndpoint) {
+	(void)bEndpoint;
+	return false;
+}
+
+// Interrupt of the UDP: PC has acknowledged the first IN bank, OUT packets
+void USBD_IrqHandler(void) {
+	if(host_udp_in_sending && host_time_ns() >= host_udp_in_done) {
+		const HostUDPPacket *packet = &host_udp_in_bank[0];
+		if(host_udp_in_end - host_udp_in_start + packet->length > HOST_UDP_IN_SIZE) {
+			fprintf(stderr, "host_udp: IN data is not read by the test\n");
+			abort();
+		}
+
+		for(uint16_t i = 0; i < packet->length; i++) {
+			host_udp_in_data[(host_udp_in_end + i) % HOST_UDP_IN_SIZE] = packet->data[i];
+		}
+		host_udp_in_end += packet->length;
+		host_udp_in_packets++;
+
+		host_udp_in_banks--;
+		memmove(&host_udp_in_bank[0], &host_udp_in_bank[1], sizeof(HostUDPPacket)*host_udp_in_banks);
+		const bool next_in_bank = host_udp_in_banks > 0;
+
+		usb_send_packet_done();
+		host_udp_in_fill();
+		host_udp_in_sending = false;
+		if(host_udp_in_banks > 0) {
+			host_udp_in_transfer(next_in_bank ? host_udp_in_done : host_time_ns());
+		}
+	}
+
+	while(host_udp_out_receiving && host_udp_out_used > 0) {
+		char *slot = usb_recv_ring_get_write_slot();
+		if(slot == NULL) {
+			usb_recv_ring_stalled();
+			host_udp_out_receiving = false;
+			break;
+		}
+
+		const HostUDPPacket *packet = &host_udp_out[host_udp_out_start];
+		memcpy(slot, packet->data, packet->length);
+		host_udp_out_start = (host_udp_out_start + 1) % HOST_UDP_OUT_PACKETS;
+		host_udp_out_used--;
+
+		if(!usb_recv_ring_commit(packet->length)) {
+			host_udp_out_receiving = false;
+		}
+
+		com_recv_event_signal_from_isr(COM_USB);
+	}
+}
+
+static void host_udp_step(void *context) {
+	(void)context;
+
+	if((host_udp_in_sending && host_time_ns() >= host_udp_in_done) ||
+	   (host_udp_out_receiving && host_udp_out_used > 0)) {
+		host_irq_set_pending(UDP_IRQn);
+	}
+}
+
+bool host_udp_write(const void *data, const uint16_t length) {
+	const uint8_t packets = (length + DEFAULT_EP_SIZE - 1) / DEFAULT_EP_SIZE;
+	if(host_udp_out_used + packets > HOST_UDP_OUT_PACKETS) {
+		return false;
+	}
+
+	for(uint16_t offset = 0; offset < length; offset += DEFAULT_EP_SIZE) {
+		HostUDPPacket *packet = &host_udp_out[(host_udp_out_start + host_udp_out_used) % HOST_UDP_OUT_PACKETS];
+		packet->length = MIN(DEFAULT_EP_SIZE, length - offset);
+		memcpy(packet->data, ((const uint8_t*)data) + offset, packet->length);
+		host_udp_out_used++;
+	}
+
+	return true;
+}
+
+uint16_t host_udp_read(void *data, const uint16_t length) {
+	const uint16_t available = MIN(length, host_udp_in_end - host_udp_in_start);
+	for(uint16_t i = 0; i < available; i++) {
+		((uint8_t*)data)[i] = host_udp_in_data[(host_udp_in_start + i) % HOST_UDP_IN_SIZE];
+	}
+	host_udp_in_start += available;
+
+	return available;
+}
+
+uint16_t host_udp_read_available(void) {
+	return host_udp_in_end - host_udp_in_start;
+}
+
+uint32_t host_udp_get_in_packet_count(void) {
+	return host_udp_in_packets;
+}
+
+void host_udp_init(void) {
+	host_udp_in_banks = 0;
+	host_udp_in_sending = false;
+	host_udp_in_done = 0;
+	host_udp_in_start = 0;
+	host_udp_in_end = 0;
+	host_udp_in_packets = 0;
+	host_udp_out_start = 0;
+	host_udp_out_used = 0;
+	host_udp_out_receiving = true;
+	host_hal_add_peripheral_step(host_udp_step, NULL);
+}
+
+// USB framework, the device is configured right away
+void USBD_Init(void) {
+	// As USBDCallbacks_Initialized, which USBD_Init of the firmware calls
+	NVIC_EnableIRQ(UDP_IRQn);
+}
+
+void USBD_Connect(void) {
+}
+
+void USBD_RemoteWakeUp(void) {
+}
+
+uint8_t USBD_GetState(void) {
+	return USBD_STATE_CONFIGURED;
+}
+
+void USBDDriver_Initialize(USBDDriver *pDriver, const USBDDriverDescriptors *pDescriptors, uint8_t *pInterfaces) {
+	(void)pDriver;
+	(void)pDescriptors;
+	(void)pInterfaces;
+}
+
+void USBDDriver_RequestHandler(USBDDriver *pDriver, const USBGenericRequest *pRequest) {
+	(void)pDriver;
+	(void)pRequest;
+}
@@ -0,0 +1,211 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * bench_message_path.c: Benchmark of the message path with in-memory transports
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// GetIdentity requests go through com_message_loop, com_route_message_from_pc,
+// get_com_from_header, the reply function and send_blocking_with_timeout.
+// The transports are Com entries that hand out the requests from memory and
+// take the responses, once with recv (the request is copied to the message
+// loop) and once with recv_frame (the request is lent out).
+//
+// Reported are messages/s, the latency from handing out the request to the
+// complete response (p50/p99) and the bytes that the transport copied per
+// message. The times are host times, they show relative changes of the path,
+// not the times on the SAM3S.
+//
+//   bench_message_path [number of messages]
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/com_messages.h"
+#include "bricklib/utility/util_definitions.h"
+
+#define BENCH_UID 0x12345678
+#define BENCH_MESSAGE_NUM_DEFAULT 20000
+
+extern Com com_list[];
+extern ComInfo com_info;
+
+typedef struct {
+	ComType com;
+	const char *name;
+	uint32_t message_num;
+
+	GetIdentity request;
+	uint32_t handed_out;
+	uint32_t received;
+	uint8_t recv_offset;
+	uint64_t time_handed_out;
+
+	uint32_t *latency_ns;
+	uint64_t bytes_copied;
+} BenchTransport;
+
+static BenchTransport *bench_transport[COM_TYPE_NUM] = {NULL};
+static uint32_t bench_message_num = BENCH_MESSAGE_NUM_DEFAULT;
+
+static void bench_next_request(BenchTransport *bt) {
+	bt->request.header.sequence_num = (bt->handed_out % 15) + 1;
+	bt->time_handed_out = host_time_ns();
+	bt->handed_out++;
+}
+
+static void bench_response(BenchTransport *bt, const void *data, const uint16_t length) {
+	// The response is copied by the transport, as a real one would do
+	static uint8_t response[MESSAGE_MAX_LENGTH];
+	memcpy(response, data, length);
+	bt->bytes_copied += length;
+
+	const MessageHeader *header = (const MessageHeader*)response;
+	HOST_TEST_CHECK(header->fid == FID_GET_IDENTITY);
+	HOST_TEST_CHECK(header->length == sizeof(GetIdentityReturn));
+	HOST_TEST_CHECK(length == sizeof(GetIdentityReturn));
+
+	bt->latency_ns[bt->received] = host_time_ns() - bt->time_handed_out;
+	bt->received++;
+}
+
+// recv: The request is copied to the buffer of the message loop
+static uint16_t bench_recv(BenchTransport *bt, void *data, const uint16_t length) {
+	if(bt->recv_offset == 0) {
+		if(bt->handed_out == bt->message_num || bt->handed_out != bt->received) {
+			return 0;
+		}
+		bench_next_request(bt);
+	}
+
+	const uint16_t copy = MIN(length, sizeof(GetIdentity) - bt->recv_offset);
+	memcpy(data, ((uint8_t*)&bt->request) + bt->recv_offset, copy);
+	bt->bytes_copied += copy;
+	bt->recv_offset = (bt->recv_offset + copy) % sizeof(GetIdentity);
+
+	return copy;
+}
+
+// recv_frame: The request is lent out
+static void* bench_recv_frame(BenchTransport *bt, uint16_t *length) {
+	if(bt->handed_out == bt->message_num || bt->handed_out != bt->received) {
+		return NULL;
+	}
+
+	bench_next_request(bt);
+	*length = sizeof(GetIdentity);
+	return &bt->request;
+}
+
+#define BENCH_COM_FUNCTIONS(com) \
+	static uint16_t bench_send_##com(const void *data, const uint16_t length, uint32_t *options) { \
+		bench_response(bench_transport[com], data, length); \
+		return length; \
+	} \
+	static uint16_t bench_recv_##com(void *data, const uint16_t length, uint32_t *options) { \
+		return bench_recv(bench_transport[com], data, length); \
+	} \
+	static void bench_message_loop_return_##com(const char *data, const uint16_t length) { \
+		com_route_message_from_pc(data, length, com); \
+	}
+
+// Only for the transports that lend out their requests
+#define BENCH_COM_FRAME_FUNCTIONS(com) \
+	static void* bench_recv_frame_##com(uint16_t *length) { \
+		return bench_recv_frame(bench_transport[com], length); \
+	} \
+	static void bench_recv_release_##com(void) { \
+	}
+
+BENCH_COM_FUNCTIONS(COM_USB)
+BENCH_COM_FRAME_FUNCTIONS(COM_USB)
+BENCH_COM_FUNCTIONS(COM_SPI_STACK)
+
+static void bench_message_loop(void *parameters) {
+	com_message_loop(parameters);
+}
+
+static bool bench_transport_done(void *context) {
+	const BenchTransport *bt = context;
+	return bt->received == bt->message_num;
+}
+
+static void bench_run(BenchTransport *bt, MessageLoopParameter *mlp) {
+	bt->message_num = bench_message_num;
+	bt->latency_ns = malloc(sizeof(uint32_t)*bt->message_num);
+	HOST_TEST_CHECK(bt->latency_ns != NULL);
+
+	com_make_default_header(&bt->request, BENCH_UID, sizeof(GetIdentity), FID_GET_IDENTITY);
+	bench_transport[bt->com] = bt;
+
+	xTaskHandle message_loop;
+	const uint64_t time_start = host_time_ns();
+	xTaskCreate(bench_message_loop,
+	            (signed char *)"ml",
+	            2500,
+	            mlp,
+	            1,
+	            &message_loop);
+
+	HOST_TEST_CHECK(host_test_wait_for(bench_transport_done, bt, 60000));
+	const uint64_t time_ns = host_time_ns() - time_start;
+
+	// The message loop would poll its transport during the next run
+	vTaskDelete(message_loop);
+
+	printf("%-10s %8lu msgs/s, latency p50 %6lu ns, p99 %6lu ns, %3lu bytes copied/msg\n",
+	       bt->name,
+	       (unsigned long)(bt->message_num*1000000000ULL/time_ns),
+	       (unsigned long)host_test_percentile(bt->latency_ns, bt->message_num, 50),
+	       (unsigned long)host_test_percentile(bt->latency_ns, bt->message_num, 99),
+	       (unsigned long)(bt->bytes_copied/bt->message_num));
+}
+
+static void bench_message_path(void) {
+	com_info.uid = BENCH_UID;
+
+	static BenchTransport bt_recv = {COM_SPI_STACK, "recv"};
+	static MessageLoopParameter mlp_recv = {MESSAGE_MAX_LENGTH, COM_SPI_STACK, bench_message_loop_return_COM_SPI_STACK};
+	com_list[COM_SPI_STACK].send         = bench_send_COM_SPI_STACK;
+	com_list[COM_SPI_STACK].send_v       = NULL;
+	com_list[COM_SPI_STACK].recv         = bench_recv_COM_SPI_STACK;
+	com_list[COM_SPI_STACK].recv_frame   = NULL;
+	com_list[COM_SPI_STACK].recv_release = NULL;
+	bench_run(&bt_recv, &mlp_recv);
+
+	static BenchTransport bt_frame = {COM_USB, "recv_frame"};
+	static MessageLoopParameter mlp_frame = {MESSAGE_MAX_LENGTH, COM_USB, bench_message_loop_return_COM_USB};
+	com_list[COM_USB].send         = bench_send_COM_USB;
+	com_list[COM_USB].send_v       = NULL;
+	com_list[COM_USB].recv         = bench_recv_COM_USB;
+	com_list[COM_USB].recv_frame   = bench_recv_frame_COM_USB;
+	com_list[COM_USB].recv_release = bench_recv_release_COM_USB;
+	bench_run(&bt_frame, &mlp_frame);
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1) {
+		bench_message_num = strtoul(argv[1], NULL, 0);
+	}
+
+	return host_test_run(bench_message_path);
+}
@@ -0,0 +1,340 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * bench_spi_stack_master.c: SPI stack master with eight slaves
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The Brick is master of a stack with eight slaves. The slaves are models
+// of spi_stack_slave_dma.c on the SPI bus (selected by the select pins),
+// they announce multi message and short poll support. The master polls
+// them with its message loop and forwards their callbacks to USB.
+//
+// Three phases are measured: All slaves idle (the master only polls), one
+// slave with a burst of callbacks while the others are idle and all slaves
+// with a burst of callbacks. Reported are frames/s (short polls included),
+// packets with payload/s, callbacks/s and the empty polls per slave (the
+// busy one against the idle ones). For the idle phase also the turns of the
+// message loop/s (wakeups) and the share of the CPU that is left for tasks
+// with idle priority, relative to the same time without the master. The
+// PDC model takes
+// the wire time of SPI_CLOCK for every frame, the rest is host time. The
+// numbers show relative changes of the master, not the rates on the SAM3S.
+//
+//   bench_spi_stack_master [callbacks per slave]
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/spi/spi_stack/spi_stack_common_dma.h"
+#include "bricklib/com/spi/spi_stack/spi_stack_master_dma.h"
+#include "bricklib/drivers/pio/pio.h"
+
+#define BENCH_UID 0x12340000
+#define BENCH_CALLBACK_FID 42
+#define BENCH_CALLBACK_NUM_DEFAULT 2000
+#define BENCH_IDLE_TIME 200 // in ms
+#define BENCH_TIMEOUT 60000 // in ms
+#define BENCH_IDLE_TASK_PRIORITY 0
+
+typedef struct {
+	MessageHeader header;
+	uint32_t counter;
+} __attribute__((__packed__)) BenchCallback;
+
+typedef struct {
+	uint8_t packet[SPI_STACK_MAX_MESSAGE_LENGTH];
+	bool send_unacked;
+	bool crc16;
+	uint8_t slave_seq;
+	uint8_t master_seq;
+
+	uint32_t callbacks_num;
+	uint32_t callbacks_sent;
+	uint32_t callbacks_received;
+} BenchSlave;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t short_frames;
+	uint32_t payloads;
+} BenchCount;
+
+extern Com com_list[];
+extern ComInfo com_info;
+extern uint8_t master_mode;
+extern Pin spi_select_master[];
+extern SPIStackMasterSlaveStatus slave_status[];
+extern uint32_t spi_stack_master_poll_count[];
+
+static BenchSlave bench_slave[SPI_ADDRESS_MAX];
+static BenchCount bench_count;
+static uint32_t bench_callback_num = BENCH_CALLBACK_NUM_DEFAULT;
+static uint32_t bench_poll_count[SPI_ADDRESS_MAX];
+static uint32_t bench_turns = 0;
+static volatile uint32_t bench_idle_count = 0;
+static function_recv_frame_t bench_recv_frame = NULL;
+
+// Counts the turns of the message loop, it asks for a frame on every turn
+static void* bench_recv_frame_count(uint16_t *length) {
+	bench_turns++;
+	return bench_recv_frame(length);
+}
+
+// Runs whenever no other task is ready, like the FreeRTOS idle task
+static void bench_idle_task(void *parameters) {
+	while(true) {
+		bench_idle_count++;
+		taskYIELD();
+	}
+}
+
+// The test task blocks, so that only the master and the idle tasks run
+static uint32_t bench_idle_count_during(const uint32_t time_ms) {
+	const uint32_t start = bench_idle_count;
+	vTaskDelay(time_ms/portTICK_RATE_MS);
+	return bench_idle_count - start;
+}
+
+static uint8_t bench_selected_slave(void) {
+	uint8_t selected = SPI_ADDRESS_MAX;
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		if(!(spi_select_master[i].pio->PIO_ODSR & spi_select_master[i].mask)) {
+			HOST_TEST_CHECK(selected == SPI_ADDRESS_MAX);
+			selected = i;
+		}
+	}
+
+	HOST_TEST_CHECK(selected != SPI_ADDRESS_MAX);
+	return selected;
+}
+
+static uint8_t bench_slave_info(const BenchSlave *slave) {
+	return SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_SHORT_POLL | slave->slave_seq | slave->master_seq;
+}
+
+// Same as spi_stack_slave_handle_irq_recv, without a receive buffer
+// (the master only polls)
+static void bench_slave_recv(BenchSlave *slave, const uint8_t *mosi, const uint16_t length) {
+	uint8_t payload[SPI_STACK_MAX_MESSAGE_LENGTH];
+	uint8_t payload_length = 0;
+	uint8_t info = 0;
+	if(spi_stack_check_packet(mosi, length, payload, &payload_length, &info) != SPI_STACK_PACKET_OK) {
+		return;
+	}
+
+	slave->crc16 = (info & SPI_STACK_INFO_CRC16) != 0;
+
+	if(((info & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK) == slave->slave_seq) ||
+	   (slave->packet[SPI_STACK_LENGTH] == SPI_STACK_EMPTY_MESSAGE_LENGTH)) {
+		slave->send_unacked = false;
+		spi_stack_increase_slave_seq(&slave->slave_seq);
+	}
+
+	slave->master_seq = info & SPI_STACK_INFO_SEQUENCE_MASTER_MASK;
+}
+
+// Same as spi_stack_slave_handle_irq_send, the slave always has as many
+// callbacks as fit into a packet until its burst is sent
+static void bench_slave_send(BenchSlave *slave, const uint8_t address) {
+	if(slave->send_unacked) {
+		const uint8_t payload_length = spi_stack_packet_info_position(slave->packet) - 2;
+		spi_stack_finish_packet(slave->packet, payload_length, bench_slave_info(slave));
+		return;
+	}
+
+	const uint8_t payload_max = slave->crc16 ? SPI_STACK_CRC16_BUFFER_SIZE : SPI_STACK_BUFFER_SIZE;
+	BenchCallback callbacks[SPI_STACK_BUFFER_SIZE/sizeof(BenchCallback)];
+	uint8_t callbacks_num = 0;
+
+	while(slave->callbacks_sent < slave->callbacks_num &&
+	      (callbacks_num + 1)*sizeof(BenchCallback) <= payload_max) {
+		BenchCallback *cb = &callbacks[callbacks_num];
+		memset(cb, 0, sizeof(BenchCallback));
+		com_make_default_header(cb, BENCH_UID + address, sizeof(BenchCallback), BENCH_CALLBACK_FID);
+		cb->counter = slave->callbacks_sent;
+
+		slave->callbacks_sent++;
+		callbacks_num++;
+	}
+
+	const ComIOVec iov = {callbacks, callbacks_num*sizeof(BenchCallback)};
+	spi_stack_make_packet(slave->packet, &iov, 1, iov.length, bench_slave_info(slave), callbacks_num > 0 && slave->crc16);
+	slave->send_unacked = callbacks_num > 0;
+}
+
+static void bench_spi_transfer(void *context, const uint8_t *mosi, uint8_t *miso, const uint16_t length) {
+	const uint8_t address = bench_selected_slave();
+	BenchSlave *slave = &bench_slave[address];
+
+	// A short poll only clocks the empty packet of the master,
+	// the slave handles it like a complete transfer
+	memcpy(miso, slave->packet, length);
+	bench_slave_recv(slave, mosi, length);
+	bench_slave_send(slave, address);
+
+	bench_count.frames++;
+	if(length == SPI_STACK_EMPTY_MESSAGE_LENGTH) {
+		bench_count.short_frames++;
+	} else if(miso[SPI_STACK_LENGTH] > SPI_STACK_EMPTY_MESSAGE_LENGTH) {
+		bench_count.payloads++;
+	}
+}
+
+static uint16_t bench_usb_send(const void *data, const uint16_t length, uint32_t *options) {
+	const BenchCallback *cb = data;
+	HOST_TEST_CHECK(length == sizeof(BenchCallback));
+	HOST_TEST_CHECK(cb->header.fid == BENCH_CALLBACK_FID);
+
+	const uint32_t address = cb->header.uid - BENCH_UID;
+	HOST_TEST_CHECK(address < SPI_ADDRESS_MAX);
+	HOST_TEST_CHECK(cb->counter == bench_slave[address].callbacks_received);
+	bench_slave[address].callbacks_received++;
+
+	return length;
+}
+
+static bool bench_callbacks_done(void *context) {
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		if(bench_slave[i].callbacks_received < bench_slave[i].callbacks_num) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void bench_start(void) {
+	memset(&bench_count, 0, sizeof(BenchCount));
+	memcpy(bench_poll_count, spi_stack_master_poll_count, sizeof(bench_poll_count));
+}
+
+static void bench_print(const char *name, const uint64_t time_ns) {
+	const double seconds = time_ns/1e9;
+	printf("%-10s %8.0f frames/s (%3.0f%% short), %8.0f payloads/s\n",
+	       name,
+	       bench_count.frames/seconds,
+	       bench_count.frames > 0 ? 100.0*bench_count.short_frames/bench_count.frames : 0.0,
+	       bench_count.payloads/seconds);
+}
+
+static void bench_print_polls(const uint64_t time_ns, const uint8_t busy) {
+	const double seconds = time_ns/1e9;
+	uint32_t idle_polls = 0;
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		if(i != busy) {
+			idle_polls += spi_stack_master_poll_count[i] - bench_poll_count[i];
+		}
+	}
+
+	printf("%-10s %8.0f polls/s of slave %d, %8.0f polls/s of each idle slave\n",
+	       "",
+	       (spi_stack_master_poll_count[busy] - bench_poll_count[busy])/seconds,
+	       busy + 1,
+	       idle_polls/seconds/(SPI_ADDRESS_MAX - 1));
+}
+
+static void bench_spi_stack_master(void) {
+	master_mode = MASTER_MODE_MASTER;
+	com_info.current = COM_USB;
+	com_info.last_stack_address = SPI_ADDRESS_MAX;
+	com_list[COM_USB].send   = bench_usb_send;
+	com_list[COM_USB].send_v = NULL;
+
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		bench_slave_send(&bench_slave[i], i);
+	}
+	host_spi_set_device(bench_spi_transfer, NULL);
+
+	spi_stack_master_init();
+
+	// The PIO model only keeps the last write to OER/SODR before a step
+	// (host_pio.c), the init configures all select pins at once
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		PIO_Configure(&spi_select_master[i], 1);
+		host_hal_poll();
+		slave_status[i] = SLAVE_STATUS_AVAILABLE;
+	}
+
+	bench_recv_frame = com_list[COM_SPI_STACK].recv_frame;
+	com_list[COM_SPI_STACK].recv_frame = bench_recv_frame_count;
+
+	xTaskCreate(bench_idle_task, (signed char *)"idle", 1000, NULL, BENCH_IDLE_TASK_PRIORITY, (xTaskHandle *)NULL);
+	// The first run also warms up, the faster one is the reference
+	uint32_t idle_count_alone = 0;
+	for(uint8_t i = 0; i < 2; i++) {
+		const uint32_t count = bench_idle_count_during(BENCH_IDLE_TIME);
+		if(count > idle_count_alone) {
+			idle_count_alone = count;
+		}
+	}
+
+	xTaskCreate(spi_stack_master_message_loop, (signed char *)"spi", 1000, NULL, 1, (xTaskHandle *)NULL);
+
+	bench_start();
+	bench_turns = 0;
+	uint64_t start = host_time_ns();
+	const uint32_t idle_count = bench_idle_count_during(BENCH_IDLE_TIME);
+	uint64_t time_ns = host_time_ns() - start;
+	bench_print("idle", time_ns);
+	printf("%-10s %8.0f wakeups/s, %3.0f%% idle\n",
+	       "",
+	       bench_turns/(time_ns/1e9),
+	       100.0*idle_count/idle_count_alone);
+	HOST_TEST_CHECK(bench_count.frames > 0);
+	HOST_TEST_CHECK(bench_count.payloads == 0);
+
+	bench_slave[0].callbacks_num = bench_callback_num;
+	bench_start();
+	start = host_time_ns();
+	HOST_TEST_CHECK(host_test_wait_for(bench_callbacks_done, NULL, BENCH_TIMEOUT));
+	time_ns = host_time_ns() - start;
+	bench_print("one busy", time_ns);
+	bench_print_polls(time_ns, 0);
+
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		bench_slave[i].callbacks_num += bench_callback_num;
+	}
+	bench_start();
+	start = host_time_ns();
+	HOST_TEST_CHECK(host_test_wait_for(bench_callbacks_done, NULL, BENCH_TIMEOUT));
+	time_ns = host_time_ns() - start;
+	bench_print("callbacks", time_ns);
+	printf("%-10s %8.0f callbacks/s from %d slaves\n",
+	       "",
+	       bench_callback_num*SPI_ADDRESS_MAX/(time_ns/1e9),
+	       SPI_ADDRESS_MAX);
+
+	for(uint8_t i = 0; i < SPI_ADDRESS_MAX; i++) {
+		const SPIStackMasterErrorCount *error_count = spi_stack_master_get_error_count(i+1);
+		HOST_TEST_CHECK(error_count->error_count_checksum == 0);
+		HOST_TEST_CHECK(error_count->error_count_length == 0);
+	}
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1) {
+		bench_callback_num = strtoul(argv[1], NULL, 0);
+	}
+
+	return host_test_run(bench_spi_stack_master);
+}
@@ -0,0 +1,132 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * bench_spi_stack_pearson.c: Fused copy and Pearson hash against byte loop
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Copies a payload out of a packet and calculates its Pearson hash, once
+// with memcpy and spi_stack_calculate_pearson (byte loop) and once with
+// spi_stack_copy_pearson (fused, word-wise if aligned). The payloads are
+// taken from SPIStackDMABuffer like in the master and slave, so they are
+// word aligned. The unaligned case shows the byte fallback of the fused
+// copy.
+//
+// Reported are cycles per payload (rdtsc on x86, otherwise ns), the minimum
+// of several rounds. The cycles are host cycles, they show the relative
+// difference of the two loops, not the cycles on the SAM3S.
+//
+//   bench_spi_stack_pearson [payloads per round]
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/com/spi/spi_stack/spi_stack_common_dma.h"
+
+#define BENCH_PAYLOAD_NUM_DEFAULT 100000
+#define BENCH_ROUNDS 10
+
+static uint32_t bench_payload_num = BENCH_PAYLOAD_NUM_DEFAULT;
+
+static SPIStackDMABuffer bench_src;
+static SPIStackDMABuffer bench_dest;
+
+// The checksums go here, so that the loops are not optimized away
+static volatile uint8_t bench_sink;
+
+// x86intrin.h does not go together with the CMSIS macros of host_hal.h
+static uint64_t bench_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t low, high;
+	__asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+	return (((uint64_t)high) << 32) | low;
+#else
+	return host_time_ns();
+#endif
+}
+
+static uint64_t bench_byte_loop(const uint8_t *src, uint8_t *dest, const uint8_t length) {
+	const uint64_t start = bench_cycles();
+	for(uint32_t i = 0; i < bench_payload_num; i++) {
+		memcpy(dest, src, length);
+		bench_sink = spi_stack_calculate_pearson(dest, length);
+	}
+
+	return bench_cycles() - start;
+}
+
+static uint64_t bench_fused(const uint8_t *src, uint8_t *dest, const uint8_t length) {
+	const uint64_t start = bench_cycles();
+	for(uint32_t i = 0; i < bench_payload_num; i++) {
+		bench_sink = spi_stack_copy_pearson(dest, src, length, 0);
+	}
+
+	return bench_cycles() - start;
+}
+
+static void bench_payload(const char *name, const uint8_t *src, uint8_t *dest, const uint8_t length) {
+	// Both have to calculate the same hash and copy the same data
+	const uint8_t expected = spi_stack_calculate_pearson(src, length);
+	memset(dest, 0, length);
+	HOST_TEST_CHECK(spi_stack_copy_pearson(dest, src, length, 0) == expected);
+	HOST_TEST_CHECK(memcmp(dest, src, length) == 0);
+
+	// The rounds alternate, so that both see the same clock and cache state
+	uint64_t byte_loop_best = UINT64_MAX;
+	uint64_t fused_best = UINT64_MAX;
+	for(uint8_t round = 0; round < BENCH_ROUNDS; round++) {
+		const uint64_t byte_loop_cycles = bench_byte_loop(src, dest, length);
+		const uint64_t fused_cycles = bench_fused(src, dest, length);
+		if(byte_loop_cycles < byte_loop_best) {
+			byte_loop_best = byte_loop_cycles;
+		}
+		if(fused_cycles < fused_best) {
+			fused_best = fused_cycles;
+		}
+	}
+
+	const double byte_loop = ((double)byte_loop_best)/bench_payload_num;
+	const double fused = ((double)fused_best)/bench_payload_num;
+	printf("%-10s %2d bytes: byte loop %6.1f, fused %6.1f cycles/payload (%3.0f%%)\n",
+	       name, length, byte_loop, fused, 100.0*fused/byte_loop);
+}
+
+static void bench_spi_stack_pearson(void) {
+	for(uint8_t i = 0; i < SPI_STACK_MAX_MESSAGE_LENGTH; i++) {
+		bench_src.packet[i] = i*7 + 3;
+	}
+
+	// The payload starts behind preamble and length (see SPIStackDMABuffer)
+	const uint8_t *src = &bench_src.packet[SPI_STACK_LENGTH + 1];
+	uint8_t *dest = &bench_dest.packet[SPI_STACK_LENGTH + 1];
+
+	const uint8_t lengths[] = {8, 32, SPI_STACK_BUFFER_SIZE};
+	for(uint8_t i = 0; i < sizeof(lengths); i++) {
+		bench_payload("aligned", src, dest, lengths[i]);
+	}
+
+	bench_payload("unaligned", src + 1, dest, SPI_STACK_BUFFER_SIZE - 1);
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1) {
+		bench_payload_num = strtoul(argv[1], NULL, 0);
+	}
+
+	return host_test_run(bench_spi_stack_pearson);
+}
@@ -0,0 +1,148 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * bench_usb_send_slots.c: Sustained callback throughput over USB
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// A task sends callbacks as fast as send_blocking allows, the PC reads them
+// from the IN endpoint of the USB model. The model takes the wire time of a
+// full speed bulk packet for every packet (host_udp.c). The benchmark is
+// built once for every USB_SEND_SLOTS (see CMakeLists.txt), with one slot
+// the second bank of the endpoint can't be filled while a packet is on the
+// wire.
+//
+// Reported are callbacks/s, bytes/s and packets/s for callbacks of 12 (one
+// short packet), 64 (one full packet) and 80 bytes (two packets), and the
+// share of the wire that was used.
+//
+//   bench_usb_send_slots_<slots> [callbacks per size]
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/usb/usb.h"
+#include "bricklib/com/usb/usb_descriptors.h"
+
+#define BENCH_UID 0x12345678
+#define BENCH_CALLBACK_FID 42
+#define BENCH_CALLBACK_NUM_DEFAULT 20000
+#define BENCH_TIMEOUT 60000 // in ms
+
+// Same as in host_udp.c
+#define BENCH_BIT_TIME_NS 83
+#define BENCH_PACKET_OVERHEAD 13
+
+typedef struct {
+	MessageHeader header;
+	uint32_t counter;
+	uint8_t payload[68];
+} __attribute__((__packed__)) BenchCallback;
+
+typedef struct {
+	uint8_t length;
+	uint32_t sent;
+	uint32_t received;
+	uint32_t read_offset;
+	BenchCallback read;
+} BenchRun;
+
+extern ComInfo com_info;
+
+static uint32_t bench_callback_num = BENCH_CALLBACK_NUM_DEFAULT;
+static BenchRun bench_run;
+
+static void bench_producer(void *parameters) {
+	BenchCallback cb;
+	memset(&cb, 0, sizeof(BenchCallback));
+
+	while(true) {
+		if(bench_run.sent == bench_callback_num) {
+			taskYIELD();
+			continue;
+		}
+
+		com_make_default_header(&cb, BENCH_UID, bench_run.length, BENCH_CALLBACK_FID);
+		cb.counter = bench_run.sent;
+		send_blocking(&cb, bench_run.length, COM_USB);
+		bench_run.sent++;
+	}
+}
+
+// Reads what the PC got so far, the callbacks have to arrive in order
+static bool bench_read(void *context) {
+	while(host_udp_read_available() > 0) {
+		bench_run.read_offset += host_udp_read(((uint8_t*)&bench_run.read) + bench_run.read_offset,
+		                                       bench_run.length - bench_run.read_offset);
+		if(bench_run.read_offset < bench_run.length) {
+			break;
+		}
+
+		HOST_TEST_CHECK(bench_run.read.header.fid == BENCH_CALLBACK_FID);
+		HOST_TEST_CHECK(bench_run.read.header.length == bench_run.length);
+		HOST_TEST_CHECK(bench_run.read.counter == bench_run.received);
+		bench_run.read_offset = 0;
+		bench_run.received++;
+	}
+
+	return bench_run.received == bench_callback_num;
+}
+
+static void bench_size(const uint8_t length) {
+	memset(&bench_run, 0, sizeof(BenchRun));
+	bench_run.length = length;
+
+	const uint32_t packets_start = host_udp_get_in_packet_count();
+	const uint64_t start = host_time_ns();
+	HOST_TEST_CHECK(host_test_wait_for(bench_read, NULL, BENCH_TIMEOUT));
+
+	const double seconds = (host_time_ns() - start)/1e9;
+	const uint32_t packets = host_udp_get_in_packet_count() - packets_start;
+	const double wire_ns = ((double)bench_callback_num*length + packets*BENCH_PACKET_OVERHEAD)*8*BENCH_BIT_TIME_NS;
+
+	printf("slots %d, %2d bytes: %8.0f callbacks/s, %8.0f bytes/s, %6.0f packets/s (%3.0f%% of wire)\n",
+	       USB_SEND_SLOTS,
+	       length,
+	       bench_callback_num/seconds,
+	       bench_callback_num*length/seconds,
+	       packets/seconds,
+	       100.0*wire_ns/1e9/seconds);
+}
+
+static void bench_usb_send_slots(void) {
+	com_info.uid = BENCH_UID;
+	HOST_TEST_CHECK(usb_init());
+
+	xTaskCreate(bench_producer, (signed char *)"producer", 1000, NULL, 1, (xTaskHandle *)NULL);
+
+	bench_size(sizeof(MessageHeader) + sizeof(uint32_t));
+	bench_size(DEFAULT_EP_SIZE);
+	bench_size(sizeof(BenchCallback));
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1) {
+		bench_callback_num = strtoul(argv[1], NULL, 0);
+	}
+
+	return host_test_run(bench_usb_send_slots);
+}
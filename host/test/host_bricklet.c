@@ -0,0 +1,151 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_bricklet.c: SPITFP model of a co-processor Bricklet for the tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "host_bricklet.h"
+
+#include <string.h>
+
+#include "bricklib/com/com_common.h"
+#include "bricklib/utility/pearson_hash.h"
+
+#define HOST_BRICKLET_RESEND_BYTES 500
+
+void host_bricklet_init(HostBricklet *b, const uint32_t uid, const uint8_t request_fid, const uint8_t callback_fid, const uint32_t callback_num) {
+	memset(b, 0, sizeof(HostBricklet));
+	b->uid = uid;
+	b->request_fid = request_fid;
+	b->callback_fid = callback_fid;
+	b->callback_num = callback_num;
+}
+
+static void host_bricklet_make_frame(HostBricklet *b, const void *payload, const uint8_t payload_length, const uint8_t sequence_byte) {
+	uint8_t checksum = 0;
+
+	b->out_length = payload_length + HOST_BRICKLET_FRAME_OVERHEAD;
+	b->out_position = 0;
+	b->out[0] = b->out_length;
+	b->out[1] = sequence_byte;
+	memcpy(&b->out[2], payload, payload_length);
+	for(uint8_t i = 0; i < b->out_length - 1; i++) {
+		PEARSON(checksum, b->out[i]);
+	}
+	b->out[b->out_length - 1] = checksum;
+}
+
+uint8_t host_bricklet_out(HostBricklet *b) {
+	if(b->out_position == b->out_length) {
+		b->out_length = 0;
+		b->out_position = 0;
+
+		if(b->ack_pending) {
+			host_bricklet_make_frame(b, NULL, 0, b->sequence_number_seen << 4);
+			b->ack_pending = false;
+		} else if(b->requests > 0 && b->callbacks_acked < b->callback_num) {
+			// Callbacks are enabled by the first request. Before, the Bricklet
+			// acks sequence number 0 with every frame, which is also the
+			// sequence number of the Brick before its first message.
+			if(!b->callback_in_flight) {
+				b->sequence_number++;
+				if(b->sequence_number > 0xF) {
+					b->sequence_number = 2;
+				}
+				b->callback_in_flight = true;
+				b->bytes_since_callback = HOST_BRICKLET_RESEND_BYTES;
+			}
+
+			// Sent again if the ack does not come
+			if(b->bytes_since_callback >= HOST_BRICKLET_RESEND_BYTES) {
+				HostBrickletMessage cb = MESSAGE_EMPTY_INITIALIZER;
+				com_make_default_header(&cb, b->uid, sizeof(HostBrickletMessage), b->callback_fid);
+				cb.counter = b->callbacks_acked;
+				host_bricklet_make_frame(b, &cb, sizeof(HostBrickletMessage), b->sequence_number | (b->sequence_number_seen << 4));
+				b->bytes_since_callback = 0;
+			}
+		}
+	}
+
+	b->bytes_since_callback++;
+	if(b->out_position < b->out_length) {
+		return b->out[b->out_position++];
+	}
+
+	return 0;
+}
+
+static void host_bricklet_handle_frame(HostBricklet *b) {
+	const uint8_t length = b->in[0];
+	uint8_t checksum = 0;
+	for(uint8_t i = 0; i < length - 1; i++) {
+		PEARSON(checksum, b->in[i]);
+	}
+
+	if(checksum != b->in[length - 1]) {
+		b->errors++;
+		return;
+	}
+
+	const uint8_t sequence_byte = b->in[1];
+	if(b->callback_in_flight && (sequence_byte >> 4) == b->sequence_number) {
+		b->callback_in_flight = false;
+		b->callbacks_acked++;
+	}
+
+	if(length == HOST_BRICKLET_FRAME_OVERHEAD) {
+		return;
+	}
+
+	// A request is acked again if it is sent again
+	b->ack_pending = true;
+	if((sequence_byte & 0x0F) == b->sequence_number_seen) {
+		return;
+	}
+	b->sequence_number_seen = sequence_byte & 0x0F;
+
+	const HostBrickletMessage *request = (const HostBrickletMessage*)&b->in[2];
+	if(length - HOST_BRICKLET_FRAME_OVERHEAD != sizeof(HostBrickletMessage) ||
+	   request->header.uid != b->uid ||
+	   request->header.fid != b->request_fid ||
+	   request->counter != b->requests) {
+		b->errors++;
+		return;
+	}
+
+	b->requests++;
+}
+
+void host_bricklet_in(HostBricklet *b, const uint8_t value) {
+	if(b->in_position == 0) {
+		if(value == 0) {
+			return;
+		}
+
+		if(value != HOST_BRICKLET_FRAME_OVERHEAD && (value < 8 + HOST_BRICKLET_FRAME_OVERHEAD || value > HOST_BRICKLET_FRAME_MAX_LENGTH)) {
+			b->errors++;
+			return;
+		}
+	}
+
+	b->in[b->in_position++] = value;
+	if(b->in_position == b->in[0]) {
+		host_bricklet_handle_frame(b);
+		b->in_position = 0;
+	}
+}
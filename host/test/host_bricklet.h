@@ -0,0 +1,72 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_bricklet.h: SPITFP model of a co-processor Bricklet for the tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef HOST_BRICKLET_H
+#define HOST_BRICKLET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bricklib/com/com_messages.h"
+
+#define HOST_BRICKLET_FRAME_OVERHEAD 3
+#define HOST_BRICKLET_FRAME_MAX_LENGTH (80 + HOST_BRICKLET_FRAME_OVERHEAD)
+
+// Requests and callbacks carry a counter, each has to arrive once and in order
+typedef struct {
+	MessageHeader header;
+	uint32_t counter;
+} __attribute__((__packed__)) HostBrickletMessage;
+
+// The Bricklet acks the requests of the Brick (fid request_fid) and sends
+// callback_num callbacks (fid callback_fid) after the first request. A
+// callback is sent again if the ack does not come. Wrong frames and
+// requests are counted in errors.
+typedef struct {
+	uint32_t uid;
+	uint8_t request_fid;
+	uint8_t callback_fid;
+	uint32_t callback_num;
+
+	uint8_t out[HOST_BRICKLET_FRAME_MAX_LENGTH];
+	uint8_t out_length;
+	uint8_t out_position;
+	uint8_t in[HOST_BRICKLET_FRAME_MAX_LENGTH];
+	uint8_t in_position;
+
+	uint8_t sequence_number;      // Of the callback that is not acked yet
+	uint8_t sequence_number_seen; // Last sequence number of the Brick
+	bool callback_in_flight;
+	bool ack_pending;
+	uint32_t bytes_since_callback;
+
+	uint32_t callbacks_acked;
+	uint32_t requests;
+	uint32_t errors;
+} HostBricklet;
+
+void host_bricklet_init(HostBricklet *b, const uint32_t uid, const uint8_t request_fid, const uint8_t callback_fid, const uint32_t callback_num);
+
+// SPI is full-duplex: the byte to send is needed before the received one is known
+uint8_t host_bricklet_out(HostBricklet *b);
+void host_bricklet_in(HostBricklet *b, const uint8_t value);
+
+#endif
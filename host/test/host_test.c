@@ -0,0 +1,85 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_test.c: Helpers for the tests and benchmarks of the host build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "host_test.h"
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+
+#define HOST_TEST_TASK_STACK_SIZE 1000
+
+static HostTestFunction host_test_function = NULL;
+
+static void host_test_task(void *parameters) {
+	host_test_function();
+	vTaskEndScheduler();
+
+	// Not reached, vTaskEndScheduler returns to host_test_run
+	while(true) {
+		taskYIELD();
+	}
+}
+
+int host_test_run(HostTestFunction test) {
+	// Results of the benchmarks are printed while the test runs
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	host_hal_init();
+
+	host_test_function = test;
+	xTaskCreate(host_test_task,
+	            (signed char *)"test",
+	            HOST_TEST_TASK_STACK_SIZE,
+	            NULL,
+	            1,
+	            (xTaskHandle *)NULL);
+
+	vTaskStartScheduler();
+
+	return 0;
+}
+
+bool host_test_wait_for(HostTestCondition condition, void *context, const uint32_t timeout_ms) {
+	const uint64_t end = host_time_ns() + timeout_ms*1000000ULL;
+	while(!condition(context)) {
+		if(host_time_ns() > end) {
+			return false;
+		}
+		taskYIELD();
+	}
+
+	return true;
+}
+
+static int host_test_compare(const void *a, const void *b) {
+	const uint32_t va = *(const uint32_t*)a;
+	const uint32_t vb = *(const uint32_t*)b;
+	return (va > vb) - (va < vb);
+}
+
+uint32_t host_test_percentile(uint32_t *values, const uint32_t length, const uint8_t percentile) {
+	if(length == 0) {
+		return 0;
+	}
+
+	qsort(values, length, sizeof(uint32_t), host_test_compare);
+	return values[(uint64_t)(length - 1)*percentile/100];
+}
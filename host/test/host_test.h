@@ -0,0 +1,52 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * host_test.h: Helpers for the tests and benchmarks of the host build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HOST_TEST_CHECK(condition) do { \
+	if(!(condition)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+		exit(1); \
+	} \
+} while(0)
+
+typedef void (*HostTestFunction)(void);
+typedef bool (*HostTestCondition)(void *context);
+
+// Initializes the mock peripherals and runs the test function in a task
+// (with the other tasks that it creates). Returns when the test function
+// returned, the exit code of the test is 0 if no check failed.
+int host_test_run(HostTestFunction test);
+
+// Lets the other tasks and the interrupts run until the condition is true.
+// Returns false if it was not true within timeout_ms.
+bool host_test_wait_for(HostTestCondition condition, void *context, const uint32_t timeout_ms);
+
+// Percentile (0-100) of the values, the array is sorted in place
+uint32_t host_test_percentile(uint32_t *values, const uint32_t length, const uint8_t percentile);
+
+#endif
@@ -0,0 +1,250 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_co_mcu_parallel.c: Co-MCU Bricklets on bit-banged ports polled together
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Ports B, C and D have CLK on PIOB and MOSI/MISO on PIOA (config.h), the
+// tick task polls them as one group. Each port has a Bricklet model
+// (host_bricklet.c) behind a bit-level SPI slave that follows the pins:
+// MISO changes with the falling edge of CLK, MOSI is sampled with the
+// rising edge (mode 3, MSB first). Requests go to all ports, every request
+// and callback has to arrive once and in order.
+//
+// The PIO model applies the writes since the last step at once, PIOA
+// before PIOB and PIOC. The firmware changes MOSI only with a falling
+// edge, so the slave samples the MOSI level of the last edge. CLK is only
+// driven while the port is selected and always for whole bytes, the slave
+// counts the bits and does not need the slave select (which can be on
+// PIOA or PIOC, before or after CLK).
+//
+// The time between two CLK edges is measured in host time. It shows that
+// no half bit is shorter than the sleep of the firmware, not the cycle
+// timing on the MCU.
+
+#include "host_test.h"
+#include "host_bricklet.h"
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/bricklet/bricklet_co_mcu.h"
+#include "bricklib/bricklet/bricklet_config.h"
+#include "bricklib/bricklet/bricklet_init.h"
+#include "bricklib/utility/util_definitions.h"
+
+#define TEST_PORT_FIRST 1
+#define TEST_PORT_NUM 3
+#define TEST_BRICKLET_UID 0x11223340
+#define TEST_REQUEST_FID 42
+#define TEST_CALLBACK_FID 43
+#define TEST_REQUEST_NUM 50
+#define TEST_CALLBACK_NUM 50
+#define TEST_TIMEOUT 20000 // in ms
+
+// Shortest half bit that the firmware uses (SLEEP_HALF_BIT_NS at the maximum baudrate)
+#define TEST_HALF_BIT_MIN_NS ((1000*1000*1000/2)/CO_MCU_MAXIMUM_BAUDRATE - 200)
+
+typedef struct {
+	HostBricklet bricklet;
+	const Pin *clk;
+	const Pin *mosi;
+	const Pin *miso;
+
+	uint8_t bit;
+	bool mosi_level;
+	uint8_t value_out;
+	uint8_t value_in;
+	uint64_t edge_time;
+	uint64_t half_bit_min_ns;
+	uint32_t callbacks_received;
+} TestPort;
+
+extern Com com_list[];
+extern ComInfo com_info;
+extern BrickletSettings bs[BRICKLET_NUM];
+extern uint32_t bc[BRICKLET_NUM][BRICKLET_CONTEXT_MAX_SIZE/4];
+extern uint8_t bricklet_attached[BRICKLET_NUM];
+
+static TestPort test_port[TEST_PORT_NUM];
+static uint8_t test_clocked_together_max = 0;
+static bool test_requests_done = false;
+
+static void test_port_edge(TestPort *port, const bool rising) {
+	const uint64_t now = host_time_ns();
+	if(port->edge_time != 0) {
+		const uint64_t half_bit = now - port->edge_time;
+		if(port->half_bit_min_ns == 0 || half_bit < port->half_bit_min_ns) {
+			port->half_bit_min_ns = half_bit;
+		}
+	}
+	port->edge_time = now;
+
+	if(!rising) {
+		if(port->bit == 0) {
+			port->value_out = host_bricklet_out(&port->bricklet);
+			port->value_in = 0;
+		}
+		host_pio_set_input(port->miso->pio, port->miso->mask, (port->value_out >> (7 - port->bit)) & 1);
+		return;
+	}
+
+	if(port->mosi_level) {
+		port->value_in |= 1 << (7 - port->bit);
+	}
+
+	port->bit++;
+	if(port->bit == 8) {
+		host_bricklet_in(&port->bricklet, port->value_in);
+		port->bit = 0;
+
+		// The gap between two bytes is not a half bit
+		port->edge_time = 0;
+	}
+}
+
+static void test_pio_listener(void *context, Pio *pio, const uint32_t set, const uint32_t clear) {
+	uint8_t clocked = 0;
+
+	for(uint8_t i = 0; i < TEST_PORT_NUM; i++) {
+		TestPort *port = &test_port[i];
+		if(pio != port->clk->pio || !((set | clear) & port->clk->mask)) {
+			continue;
+		}
+
+		// Without a sleep after the last bit of a byte, the rising edge and
+		// the falling edge of the next byte can come with the same step
+		if(set & port->clk->mask) {
+			test_port_edge(port, true);
+		}
+
+		if(clear & port->clk->mask) {
+			test_port_edge(port, false);
+			clocked++;
+		}
+
+		port->mosi_level = port->mosi->pio->PIO_ODSR & port->mosi->mask;
+	}
+
+	test_clocked_together_max = MAX(test_clocked_together_max, clocked);
+}
+
+static uint16_t test_usb_send(const void *data, const uint16_t length, uint32_t *options) {
+	const HostBrickletMessage *cb = data;
+	HOST_TEST_CHECK(length == sizeof(HostBrickletMessage));
+	HOST_TEST_CHECK(cb->header.fid == TEST_CALLBACK_FID);
+
+	const uint32_t i = cb->header.uid - TEST_BRICKLET_UID;
+	HOST_TEST_CHECK(i < TEST_PORT_NUM);
+	HOST_TEST_CHECK(cb->counter == test_port[i].callbacks_received);
+	test_port[i].callbacks_received++;
+
+	return length;
+}
+
+static void test_tick_task(void *parameters) {
+	uint8_t ports[TEST_PORT_NUM];
+	for(uint8_t i = 0; i < TEST_PORT_NUM; i++) {
+		ports[i] = TEST_PORT_FIRST + i;
+	}
+
+	while(true) {
+		bricklet_co_mcu_poll_all(ports, TEST_PORT_NUM);
+		taskYIELD();
+	}
+}
+
+static void test_request_task(void *parameters) {
+	for(uint32_t n = 0; n < TEST_REQUEST_NUM; n++) {
+		for(uint8_t i = 0; i < TEST_PORT_NUM; i++) {
+			HostBrickletMessage request = MESSAGE_EMPTY_INITIALIZER;
+			com_make_default_header(&request, TEST_BRICKLET_UID + i, sizeof(HostBrickletMessage), TEST_REQUEST_FID);
+			request.counter = n;
+			bricklet_co_mcu_send(TEST_PORT_FIRST + i, (uint8_t*)&request, sizeof(HostBrickletMessage));
+		}
+	}
+
+	test_requests_done = true;
+	while(true) {
+		taskYIELD();
+	}
+}
+
+static bool test_done(void *context) {
+	if(!test_requests_done) {
+		return false;
+	}
+
+	for(uint8_t i = 0; i < TEST_PORT_NUM; i++) {
+		if(test_port[i].bricklet.requests != TEST_REQUEST_NUM ||
+		   test_port[i].callbacks_received != TEST_CALLBACK_NUM) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void test_co_mcu_parallel(void) {
+	com_info.current = COM_USB;
+	com_list[COM_USB].send   = test_usb_send;
+	com_list[COM_USB].send_v = NULL;
+
+	for(uint8_t i = 0; i < TEST_PORT_NUM; i++) {
+		const uint8_t port = TEST_PORT_FIRST + i;
+		TestPort *p = &test_port[i];
+
+		host_bricklet_init(&p->bricklet, TEST_BRICKLET_UID + i, TEST_REQUEST_FID, TEST_CALLBACK_FID, TEST_CALLBACK_NUM);
+		p->clk  = &bs[port].pin2_da;
+		p->mosi = &bs[port].pin3_pwm;
+		p->miso = &bs[port].pin4_io;
+
+		bricklet_attached[port] = BRICKLET_INIT_CO_MCU;
+		bricklet_co_mcu_init(port);
+	}
+
+	// The init drives CLK high, that is not the first edge of a byte
+	host_hal_poll();
+	host_pio_add_listener(test_pio_listener, NULL);
+
+	xTaskCreate(test_tick_task, (signed char *)"tick", 1000, NULL, 1, (xTaskHandle *)NULL);
+	xTaskCreate(test_request_task, (signed char *)"request", 1000, NULL, 1, (xTaskHandle *)NULL);
+
+	HOST_TEST_CHECK(host_test_wait_for(test_done, NULL, TEST_TIMEOUT));
+	HOST_TEST_CHECK(test_clocked_together_max == TEST_PORT_NUM);
+
+	for(uint8_t i = 0; i < TEST_PORT_NUM; i++) {
+		const CoMCUData *data = CO_MCU_DATA(TEST_PORT_FIRST + i);
+		HOST_TEST_CHECK(test_port[i].bricklet.errors == 0);
+		HOST_TEST_CHECK(data->error_count.error_count_ack_checksum == 0);
+		HOST_TEST_CHECK(data->error_count.error_count_message_checksum == 0);
+		HOST_TEST_CHECK(data->error_count.error_count_frame == 0);
+		HOST_TEST_CHECK(test_port[i].half_bit_min_ns >= TEST_HALF_BIT_MIN_NS);
+
+		printf("test_co_mcu_parallel: port %c: %lu requests, %lu callbacks, shortest half bit %lu ns\n",
+		       'a' + TEST_PORT_FIRST + i,
+		       (unsigned long)test_port[i].bricklet.requests,
+		       (unsigned long)test_port[i].callbacks_received,
+		       (unsigned long)test_port[i].half_bit_min_ns);
+	}
+}
+
+int main(void) {
+	return host_test_run(test_co_mcu_parallel);
+}
@@ -0,0 +1,144 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_co_mcu_usart.c: Co-MCU Bricklet on a USART port polled by two tasks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Port A transfers with USART0 (CO_MCU_USART_A in config.h). The tick task
+// polls the port while a second task sends requests with
+// bricklet_co_mcu_send, which polls the port too. The Bricklet model
+// (host_bricklet.c) acks the requests and sends a burst of callbacks. Every
+// request and every callback has to arrive exactly once and in order,
+// without checksum errors on either side.
+
+#include "host_test.h"
+#include "host_bricklet.h"
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/bricklet/bricklet_co_mcu.h"
+#include "bricklib/bricklet/bricklet_init.h"
+
+#define TEST_PORT 0
+#define TEST_SELECT_MASK PIO_PC26 // SPI_SS of port A is BRICKLET_A_PIN_1_AD
+#define TEST_BRICKLET_UID 0x11223344
+#define TEST_REQUEST_FID 42
+#define TEST_CALLBACK_FID 43
+#define TEST_REQUEST_NUM 200
+#define TEST_CALLBACK_NUM 200
+#define TEST_TIMEOUT 20000 // in ms
+
+typedef struct {
+	HostBricklet bricklet;
+	uint32_t transfers;
+} TestBricklet;
+
+extern Com com_list[];
+extern ComInfo com_info;
+extern uint32_t bc[BRICKLET_NUM][BRICKLET_CONTEXT_MAX_SIZE/4];
+extern uint8_t bricklet_attached[BRICKLET_NUM];
+
+static TestBricklet test_bricklet;
+static uint32_t test_callbacks_received = 0;
+static bool test_requests_done = false;
+
+static void test_bricklet_transfer(void *context, const uint8_t *mosi, uint8_t *miso, const uint16_t length) {
+	TestBricklet *b = context;
+
+	// A second poll of the port would deselect the Bricklet while
+	// the first one still transfers
+	HOST_TEST_CHECK(!(PIOC->PIO_ODSR & TEST_SELECT_MASK));
+
+	b->transfers++;
+	for(uint16_t i = 0; i < length; i++) {
+		miso[i] = host_bricklet_out(&b->bricklet);
+		host_bricklet_in(&b->bricklet, mosi[i]);
+	}
+}
+
+static uint16_t test_usb_send(const void *data, const uint16_t length, uint32_t *options) {
+	const HostBrickletMessage *cb = data;
+	HOST_TEST_CHECK(length == sizeof(HostBrickletMessage));
+	HOST_TEST_CHECK(cb->header.fid == TEST_CALLBACK_FID);
+	HOST_TEST_CHECK(cb->counter == test_callbacks_received);
+	test_callbacks_received++;
+
+	return length;
+}
+
+static void test_tick_task(void *parameters) {
+	const uint8_t port = TEST_PORT;
+	while(true) {
+		bricklet_co_mcu_poll_all(&port, 1);
+		taskYIELD();
+	}
+}
+
+static void test_request_task(void *parameters) {
+	for(uint32_t i = 0; i < TEST_REQUEST_NUM; i++) {
+		HostBrickletMessage request = MESSAGE_EMPTY_INITIALIZER;
+		com_make_default_header(&request, TEST_BRICKLET_UID, sizeof(HostBrickletMessage), TEST_REQUEST_FID);
+		request.counter = i;
+		bricklet_co_mcu_send(TEST_PORT, (uint8_t*)&request, sizeof(HostBrickletMessage));
+	}
+
+	test_requests_done = true;
+	while(true) {
+		taskYIELD();
+	}
+}
+
+static bool test_done(void *context) {
+	return test_requests_done &&
+	       test_bricklet.bricklet.requests == TEST_REQUEST_NUM &&
+	       test_callbacks_received == TEST_CALLBACK_NUM;
+}
+
+static void test_co_mcu_usart(void) {
+	com_info.current = COM_USB;
+	com_list[COM_USB].send   = test_usb_send;
+	com_list[COM_USB].send_v = NULL;
+
+	host_bricklet_init(&test_bricklet.bricklet, TEST_BRICKLET_UID, TEST_REQUEST_FID, TEST_CALLBACK_FID, TEST_CALLBACK_NUM);
+	host_usart_set_device(USART0, test_bricklet_transfer, &test_bricklet);
+
+	bricklet_attached[TEST_PORT] = BRICKLET_INIT_CO_MCU;
+	bricklet_co_mcu_init(TEST_PORT);
+
+	xTaskCreate(test_tick_task, (signed char *)"tick", 1000, NULL, 1, (xTaskHandle *)NULL);
+	xTaskCreate(test_request_task, (signed char *)"request", 1000, NULL, 1, (xTaskHandle *)NULL);
+
+	HOST_TEST_CHECK(host_test_wait_for(test_done, NULL, TEST_TIMEOUT));
+
+	const CoMCUData *data = CO_MCU_DATA(TEST_PORT);
+	HOST_TEST_CHECK(test_bricklet.bricklet.errors == 0);
+	HOST_TEST_CHECK(data->error_count.error_count_ack_checksum == 0);
+	HOST_TEST_CHECK(data->error_count.error_count_message_checksum == 0);
+	HOST_TEST_CHECK(data->error_count.error_count_frame == 0);
+
+	printf("test_co_mcu_usart: %lu requests, %lu callbacks in %lu USART transfers\n",
+	       (unsigned long)test_bricklet.bricklet.requests,
+	       (unsigned long)test_callbacks_received,
+	       (unsigned long)test_bricklet.transfers);
+}
+
+int main(void) {
+	return host_test_run(test_co_mcu_usart);
+}
@@ -0,0 +1,102 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_com_subscription.c: Reply targets of forwarded responses and callbacks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// USB and SPI stack are replaced by in-memory transports. Callbacks go to
+// both after both delivered a request, a transport that does not take a
+// message in time is unsubscribed until its next request. Responses go
+// to the transport of the request.
+
+#include "host_test.h"
+
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/com_messages.h"
+
+#define TEST_UID 0x12345678
+#define TEST_BRICKLET_UID 0x11223344
+
+extern Com com_list[];
+extern ComInfo com_info;
+
+static bool test_usb_busy = false;
+
+static uint16_t test_usb_send(const void *data, const uint16_t length, uint32_t *options) {
+	return test_usb_busy ? 0 : length;
+}
+
+static uint16_t test_spi_stack_send(const void *data, const uint16_t length, uint32_t *options) {
+	return length;
+}
+
+static void test_request(const ComType com, const uint8_t sequence_num) {
+	GetIdentity gi = MESSAGE_EMPTY_INITIALIZER;
+	com_make_default_header(&gi, TEST_UID, sizeof(GetIdentity), FID_GET_IDENTITY);
+	gi.header.sequence_num = sequence_num;
+	HOST_TEST_CHECK(com_route_message_brick((const char*)&gi, sizeof(GetIdentity), com));
+}
+
+static uint8_t test_targets(const uint8_t sequence_num) {
+	MessageHeader header = {0};
+	header.uid          = TEST_BRICKLET_UID;
+	header.fid          = 42;
+	header.sequence_num = sequence_num;
+	return com_get_reply_targets(&header);
+}
+
+static void test_com_subscription(void) {
+	com_info.uid = TEST_UID;
+	com_list[COM_USB].send         = test_usb_send;
+	com_list[COM_USB].send_v       = NULL;
+	com_list[COM_SPI_STACK].send   = test_spi_stack_send;
+	com_list[COM_SPI_STACK].send_v = NULL;
+
+	// Callbacks go to all transports that delivered a request
+	test_request(COM_USB, 1);
+	test_request(COM_SPI_STACK, 1);
+	HOST_TEST_CHECK(test_targets(0) == ((1 << COM_USB) | (1 << COM_SPI_STACK)));
+
+	// A response goes to the transport of the request, only once
+	MessageHeader request = {0};
+	request.uid          = TEST_BRICKLET_UID;
+	request.fid          = 42;
+	request.sequence_num = 5;
+	com_request_origin_add(&request, COM_USB);
+	HOST_TEST_CHECK(test_targets(5) == (1 << COM_USB));
+	HOST_TEST_CHECK(test_targets(5) == (1 << com_info.current));
+
+	// USB does not take the callback in time, it is unsubscribed
+	test_usb_busy = true;
+	MessageHeader callback = {0};
+	com_make_default_header(&callback, TEST_BRICKLET_UID, sizeof(MessageHeader), 42);
+	const uint32_t timeout_count = com_timeout_count[COM_USB];
+	HOST_TEST_CHECK(send_blocking_with_timeout(&callback, sizeof(MessageHeader), COM_USB) == 0);
+	HOST_TEST_CHECK(com_timeout_count[COM_USB] == timeout_count + 1);
+	HOST_TEST_CHECK(test_targets(0) == (1 << COM_SPI_STACK));
+
+	// Until it sends the next request
+	test_usb_busy = false;
+	test_request(COM_USB, 2);
+	HOST_TEST_CHECK(test_targets(0) == ((1 << COM_USB) | (1 << COM_SPI_STACK)));
+}
+
+int main(void) {
+	return host_test_run(test_com_subscription);
+}
@@ -0,0 +1,118 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_com_tx_queue.c: TX queue with sends that complete while it is drained
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The TX queue with a transport model that completes its previous send
+// in the moment it reports to be busy. This is the interrupt that fires
+// while the transport enables interrupts again on its way out of send, it
+// drains the queue while the sending task owns it. Every message has to be
+// sent in order, and nothing may be left in the queue after the last send
+// returned (there is no send completion left that would drain it).
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+
+#define TEST_MESSAGE_NUM 1000
+#define TEST_MESSAGE_FID 42
+
+typedef struct {
+	MessageHeader header;
+	uint32_t counter;
+} __attribute__((__packed__)) TestMessage;
+
+extern Com com_list[];
+
+static uint8_t test_queue_buffer[COM_TX_QUEUE_SIZE];
+static ComTXQueue test_queue;
+
+static bool test_transport_busy = false;
+static TestMessage test_transport_in_flight;
+static uint32_t test_transport_delivered = 0;
+static uint32_t test_transport_nested_drains = 0;
+
+static void test_transport_complete(void) {
+	HOST_TEST_CHECK(test_transport_in_flight.counter == test_transport_delivered);
+	test_transport_delivered++;
+	test_transport_busy = false;
+}
+
+static uint16_t test_transport_send_v(const ComIOVec *iov, const uint8_t iov_num, uint32_t *options) {
+	if(test_transport_busy) {
+		// Send completion interrupt
+		test_transport_complete();
+		test_transport_nested_drains++;
+		com_tx_queue_drain(COM_NONE);
+		return 0;
+	}
+
+	const uint16_t length = com_iovec_gather(&test_transport_in_flight, sizeof(TestMessage), iov, iov_num);
+	HOST_TEST_CHECK(length == sizeof(TestMessage));
+	HOST_TEST_CHECK(test_transport_in_flight.header.fid == TEST_MESSAGE_FID);
+	test_transport_busy = true;
+
+	return length;
+}
+
+static uint16_t test_transport_send(const void *data, const uint16_t length, uint32_t *options) {
+	const ComIOVec iov = {data, length};
+	return test_transport_send_v(&iov, 1, options);
+}
+
+static void test_com_tx_queue(void) {
+	com_list[COM_NONE].send   = test_transport_send;
+	com_list[COM_NONE].send_v = test_transport_send_v;
+	com_tx_queue_init(COM_NONE, &test_queue, test_queue_buffer, COM_TX_QUEUE_SIZE);
+
+	for(uint32_t i = 0; i < TEST_MESSAGE_NUM; i++) {
+		TestMessage message = MESSAGE_EMPTY_INITIALIZER;
+		com_make_default_header(&message, 1, sizeof(TestMessage), TEST_MESSAGE_FID);
+		message.counter = i;
+
+		if(i % 2 == 0) {
+			send_blocking(&message, sizeof(TestMessage), COM_NONE);
+		} else {
+			const ComIOVec iov = {&message, sizeof(TestMessage)};
+			HOST_TEST_CHECK(send_blocking_with_timeout_v(&iov, 1, COM_NONE, NULL) == sizeof(TestMessage));
+		}
+	}
+
+	// Everything but the message on the wire is sent
+	HOST_TEST_CHECK(ringbuffer_is_empty(&test_queue.rb));
+	HOST_TEST_CHECK(test_queue.messages == 0);
+	HOST_TEST_CHECK(!test_queue.draining);
+	HOST_TEST_CHECK(test_transport_busy);
+	test_transport_complete();
+
+	HOST_TEST_CHECK(test_transport_delivered == TEST_MESSAGE_NUM);
+	HOST_TEST_CHECK(test_queue.drop_count == 0);
+	HOST_TEST_CHECK(test_transport_nested_drains > 0);
+
+	printf("test_com_tx_queue: %d messages, %lu drains while the queue was owned\n",
+	       TEST_MESSAGE_NUM,
+	       (unsigned long)test_transport_nested_drains);
+}
+
+int main(void) {
+	return host_test_run(test_com_tx_queue);
+}
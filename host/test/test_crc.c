@@ -0,0 +1,125 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_crc.c: CRC tables, buffer chaining and asynchronous API
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The CRCCU is not modeled (CRC_USE_CRCCU=0), so this checks the tables and
+// the software API that the CRCCU results are compared against in crc_init.
+// The tables are compared with a bitwise calculation, the CRCs of the check
+// string "123456789" with the standard values (CRC-16/CCITT-FALSE 0x29B1,
+// CRC-32 0xCBF43926). The check string is also split into up to three
+// buffers at every position, including empty ones, the CRC has to stay the
+// same.
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/drivers/crc/crc.h"
+
+#define TEST_CRC16_CHECK 0x29B1
+#define TEST_CRC32_CHECK 0xCBF43926
+
+static const uint8_t test_check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+
+static uint32_t test_callback_crc = 0;
+static uint32_t test_callback_count = 0;
+
+static void test_tables(void) {
+	for(uint16_t i = 0; i < 256; i++) {
+		uint16_t crc16 = i << 8;
+		uint32_t crc32 = i;
+		for(uint8_t bit = 0; bit < 8; bit++) {
+			crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ 0x1021 : crc16 << 1;
+			crc32 = (crc32 & 1) ? (crc32 >> 1) ^ 0xEDB88320 : crc32 >> 1;
+		}
+
+		HOST_TEST_CHECK(crc16_ccitt_table[i] == crc16);
+		HOST_TEST_CHECK(crc32_table[i] == crc32);
+	}
+}
+
+static void test_check_values(void) {
+	HOST_TEST_CHECK(crc16_ccitt_software(test_check, sizeof(test_check), CRC16_CCITT_INIT) == TEST_CRC16_CHECK);
+	HOST_TEST_CHECK(crc32_software(test_check, sizeof(test_check), CRC32_INIT) == TEST_CRC32_CHECK);
+
+	const CRCBuffer buffer = {test_check, sizeof(test_check)};
+	HOST_TEST_CHECK(crc_compute_software(CRC_TYPE_CRC16_CCITT, &buffer, 1) == TEST_CRC16_CHECK);
+	HOST_TEST_CHECK(crc_compute_software(CRC_TYPE_CRC32, &buffer, 1) == TEST_CRC32_CHECK);
+}
+
+static void test_chaining(void) {
+	for(uint8_t first = 0; first <= sizeof(test_check); first++) {
+		// Calls of the software functions continue the CRC
+		const uint16_t crc16 = crc16_ccitt_software(test_check, first, CRC16_CCITT_INIT);
+		HOST_TEST_CHECK(crc16_ccitt_software(test_check + first, sizeof(test_check) - first, crc16) == TEST_CRC16_CHECK);
+
+		const uint32_t crc32 = crc32_software(test_check, first, CRC32_INIT);
+		HOST_TEST_CHECK(crc32_software(test_check + first, sizeof(test_check) - first, crc32) == TEST_CRC32_CHECK);
+
+		for(uint8_t second = first; second <= sizeof(test_check); second++) {
+			const CRCBuffer buffers[3] = {
+				{test_check, first},
+				{test_check + first, second - first},
+				{test_check + second, sizeof(test_check) - second}
+			};
+
+			HOST_TEST_CHECK(crc_compute_software(CRC_TYPE_CRC16_CCITT, buffers, 3) == TEST_CRC16_CHECK);
+			HOST_TEST_CHECK(crc_compute_software(CRC_TYPE_CRC32, buffers, 3) == TEST_CRC32_CHECK);
+		}
+	}
+}
+
+static void test_callback(const uint32_t crc, void *context) {
+	HOST_TEST_CHECK(context == &test_callback_count);
+	test_callback_crc = crc;
+	test_callback_count++;
+}
+
+static void test_async(void) {
+	const CRCBuffer buffers[2] = {{test_check, 4}, {test_check + 4, sizeof(test_check) - 4}};
+
+	HOST_TEST_CHECK(crc_async_start(CRC_TYPE_CRC16_CCITT, buffers, 2, test_callback, &test_callback_count));
+	HOST_TEST_CHECK(crc_async_wait() == TEST_CRC16_CHECK);
+	HOST_TEST_CHECK(test_callback_count == 1);
+	HOST_TEST_CHECK(test_callback_crc == TEST_CRC16_CHECK);
+
+	HOST_TEST_CHECK(crc_async_start(CRC_TYPE_CRC32, buffers, 2, test_callback, &test_callback_count));
+	HOST_TEST_CHECK(crc_async_wait() == TEST_CRC32_CHECK);
+	HOST_TEST_CHECK(crc_async_result() == TEST_CRC32_CHECK);
+	HOST_TEST_CHECK(test_callback_count == 2);
+	HOST_TEST_CHECK(test_callback_crc == TEST_CRC32_CHECK);
+	HOST_TEST_CHECK(!crc_async_is_busy());
+
+	// There is no table for Castagnoli
+	HOST_TEST_CHECK(!crc_async_start(CRCCU_MR_PTYPE_CASTAGNOLI, buffers, 2, test_callback, &test_callback_count));
+	HOST_TEST_CHECK(crc_compute_software(CRCCU_MR_PTYPE_CASTAGNOLI, buffers, 2) == 0);
+	HOST_TEST_CHECK(test_callback_count == 2);
+}
+
+static void test_crc(void) {
+	test_tables();
+	test_check_values();
+	test_chaining();
+	test_async();
+}
+
+int main(void) {
+	return host_test_run(test_crc);
+}
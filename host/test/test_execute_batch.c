@@ -0,0 +1,173 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_execute_batch.c: ExecuteBatch on several transports at the same time
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// USB and SPI stack are replaced by in-memory transports. A batch from USB
+// contains requests for the Brick and one for a device in the stack. The
+// request for the stack is not forwarded, it is answered with an error in
+// the ExecuteBatchReturn. Two responses do not fit anymore and are send on
+// their own. While the first one is send, the SPI stack runs a batch of its
+// own (as its message loop could while the USB one yields). Both
+// ExecuteBatchReturn have to contain their own responses. A batch without
+// return_expected gets no ExecuteBatchReturn.
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/com_messages.h"
+#include "routing.h"
+
+#define TEST_UID 0x12345678
+#define TEST_STACK_UID 0x11223344
+
+extern Com com_list[];
+extern ComInfo com_info;
+
+typedef struct {
+	uint8_t data[MESSAGE_MAX_LENGTH];
+	uint16_t length;
+	uint32_t count;
+} TestTransport;
+
+static TestTransport test_usb;
+static TestTransport test_spi_stack;
+static uint32_t test_usb_single_count = 0;
+static bool test_spi_stack_batch_done = false;
+
+static void test_make_batch(ExecuteBatch *batch, const uint32_t *uids, const uint8_t num, const uint8_t sequence_num, const bool return_expected) {
+	memset(batch, 0, sizeof(ExecuteBatch));
+	com_make_default_header(batch, TEST_UID, sizeof(MessageHeader) + num*sizeof(GetIdentity), FID_EXECUTE_BATCH);
+	batch->header.sequence_num    = sequence_num;
+	batch->header.return_expected = return_expected;
+
+	for(uint8_t i = 0; i < num; i++) {
+		GetIdentity *gi = (GetIdentity*)&batch->requests[i*sizeof(GetIdentity)];
+		com_make_default_header(gi, uids[i], sizeof(GetIdentity), FID_GET_IDENTITY);
+		gi->header.sequence_num = i + 1;
+	}
+}
+
+static void test_record(TestTransport *transport, const void *data, const uint16_t length) {
+	HOST_TEST_CHECK(length <= MESSAGE_MAX_LENGTH);
+	memcpy(transport->data, data, length);
+	transport->length = length;
+	transport->count++;
+}
+
+static uint16_t test_usb_send(const void *data, const uint16_t length, uint32_t *options) {
+	const MessageHeader *header = data;
+	if(header->fid == FID_EXECUTE_BATCH) {
+		test_record(&test_usb, data, length);
+		return length;
+	}
+
+	// The responses that did not fit into the USB batch anymore
+	HOST_TEST_CHECK(header->fid == FID_GET_IDENTITY);
+	HOST_TEST_CHECK(header->uid == TEST_UID);
+	HOST_TEST_CHECK(com_batch_is_active(COM_USB));
+	HOST_TEST_CHECK(!com_batch_is_active(COM_SPI_STACK));
+	test_usb_single_count++;
+
+	if(!test_spi_stack_batch_done) {
+		test_spi_stack_batch_done = true;
+
+		ExecuteBatch batch;
+		const uint32_t uids[] = {TEST_UID};
+		test_make_batch(&batch, uids, 1, 7, true);
+		com_route_message_brick((const char*)&batch, batch.header.length, COM_SPI_STACK);
+
+		HOST_TEST_CHECK(com_batch_is_active(COM_USB));
+		HOST_TEST_CHECK(!com_batch_is_active(COM_SPI_STACK));
+	}
+
+	return length;
+}
+
+static uint16_t test_spi_stack_send(const void *data, const uint16_t length, uint32_t *options) {
+	// Requests of a batch are never forwarded to the stack
+	HOST_TEST_CHECK(((const MessageHeader*)data)->fid == FID_EXECUTE_BATCH);
+	test_record(&test_spi_stack, data, length);
+
+	return length;
+}
+
+static void test_check_identity(const GetIdentityReturn *gir, const uint8_t sequence_num) {
+	HOST_TEST_CHECK(gir->header.uid == TEST_UID);
+	HOST_TEST_CHECK(gir->header.fid == FID_GET_IDENTITY);
+	HOST_TEST_CHECK(gir->header.sequence_num == sequence_num);
+	HOST_TEST_CHECK(gir->header.length == sizeof(GetIdentityReturn));
+	HOST_TEST_CHECK(gir->header.error == MESSAGE_ERROR_CODE_OK);
+	HOST_TEST_CHECK(gir->device_identifier == BRICK_DEVICE_IDENTIFIER);
+}
+
+static void test_execute_batch(void) {
+	com_info.uid = TEST_UID;
+	com_info.last_stack_address = 1;
+	com_list[COM_USB].send         = test_usb_send;
+	com_list[COM_USB].send_v       = NULL;
+	com_list[COM_SPI_STACK].send   = test_spi_stack_send;
+	com_list[COM_SPI_STACK].send_v = NULL;
+
+	const RouteTo route_to = {ROUTING_STACK, 1};
+	routing_add_route(TEST_STACK_UID, route_to);
+
+	// Own identity, request for the stack (error), two own identities
+	// that don't fit into the 72 byte payload anymore
+	ExecuteBatch batch;
+	const uint32_t uids[] = {TEST_UID, TEST_STACK_UID, TEST_UID, TEST_UID};
+	test_make_batch(&batch, uids, 4, 3, true);
+	com_route_message_from_pc((const char*)&batch, batch.header.length, COM_USB);
+
+	HOST_TEST_CHECK(test_spi_stack_batch_done);
+	HOST_TEST_CHECK(test_usb_single_count == 2);
+	HOST_TEST_CHECK(!com_batch_is_active(COM_USB));
+	HOST_TEST_CHECK(!com_batch_is_active(COM_SPI_STACK));
+
+	HOST_TEST_CHECK(test_spi_stack.count == 1);
+	const ExecuteBatchReturn *ebr = (const ExecuteBatchReturn*)test_spi_stack.data;
+	HOST_TEST_CHECK(ebr->header.sequence_num == 7);
+	HOST_TEST_CHECK(ebr->header.length == sizeof(MessageHeader) + sizeof(GetIdentityReturn));
+	test_check_identity((const GetIdentityReturn*)ebr->responses, 1);
+
+	HOST_TEST_CHECK(test_usb.count == 1);
+	ebr = (const ExecuteBatchReturn*)test_usb.data;
+	HOST_TEST_CHECK(ebr->header.sequence_num == 3);
+	HOST_TEST_CHECK(ebr->header.length == sizeof(MessageHeader) + sizeof(GetIdentityReturn) + sizeof(MessageHeader));
+	test_check_identity((const GetIdentityReturn*)ebr->responses, 1);
+
+	const MessageHeader *error = (const MessageHeader*)&ebr->responses[sizeof(GetIdentityReturn)];
+	HOST_TEST_CHECK(error->uid == TEST_STACK_UID);
+	HOST_TEST_CHECK(error->fid == FID_GET_IDENTITY);
+	HOST_TEST_CHECK(error->sequence_num == 2);
+	HOST_TEST_CHECK(error->length == sizeof(MessageHeader));
+	HOST_TEST_CHECK(error->error == MESSAGE_ERROR_CODE_NOT_SUPPORTED);
+
+	// Without return_expected there is no ExecuteBatchReturn
+	test_make_batch(&batch, uids, 1, 4, false);
+	com_route_message_from_pc((const char*)&batch, batch.header.length, COM_USB);
+	HOST_TEST_CHECK(test_usb.count == 1);
+}
+
+int main(void) {
+	return host_test_run(test_execute_batch);
+}
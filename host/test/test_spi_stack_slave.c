@@ -0,0 +1,145 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_spi_stack_slave.c: SPI stack slave with a master model that loses acks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// The Brick is slave of the stack and sends a burst of callbacks. The test
+// is the master, it announces CRC16 support and pretends that every third
+// packet with payload was broken (the slave sequence number is not acked).
+// Each callback has to arrive exactly once and in order.
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/spi/spi_stack/spi_stack_common_dma.h"
+#include "bricklib/com/spi/spi_stack/spi_stack_slave_dma.h"
+
+#define TEST_UID 0x12345678
+#define TEST_CALLBACK_FID 42
+#define TEST_CALLBACK_NUM 300
+#define TEST_DROP_INTERVAL 3
+#define TEST_TRANSFER_MAX 10000
+
+typedef struct {
+	MessageHeader header;
+	uint32_t counter;
+} __attribute__((__packed__)) TestCallback;
+
+extern uint8_t master_mode;
+extern ComInfo com_info;
+
+static bool test_callbacks_done = false;
+
+static void test_callback_task(void *parameters) {
+	for(uint32_t i = 0; i < TEST_CALLBACK_NUM; i++) {
+		TestCallback cb = MESSAGE_EMPTY_INITIALIZER;
+		com_make_default_header(&cb, TEST_UID, sizeof(TestCallback), TEST_CALLBACK_FID);
+		cb.counter = i;
+
+		HOST_TEST_CHECK(send_blocking_with_timeout(&cb, sizeof(TestCallback), COM_SPI_STACK) == sizeof(TestCallback));
+	}
+
+	test_callbacks_done = true;
+	while(true) {
+		taskYIELD();
+	}
+}
+
+static void test_spi_stack_slave(void) {
+	master_mode = MASTER_MODE_SLAVE;
+	com_info.uid = TEST_UID;
+	spi_stack_slave_init();
+
+	xTaskCreate(test_callback_task,
+	            (signed char *)"cb",
+	            1000,
+	            NULL,
+	            1,
+	            (xTaskHandle *)NULL);
+
+	uint8_t mosi[SPI_STACK_MAX_MESSAGE_LENGTH];
+	uint8_t miso[SPI_STACK_MAX_MESSAGE_LENGTH];
+	uint8_t payload[SPI_STACK_MAX_MESSAGE_LENGTH];
+
+	// The master acks the slave sequence number that it saw last
+	uint8_t slave_seq_seen = 0;
+	uint32_t counter_expected = 0;
+	uint32_t packets_crc16 = 0;
+	uint32_t packets_pearson = 0;
+	uint32_t packets_dropped = 0;
+	uint32_t packets_with_payload = 0;
+
+	for(uint32_t transfer = 0; counter_expected < TEST_CALLBACK_NUM; transfer++) {
+		HOST_TEST_CHECK(transfer < TEST_TRANSFER_MAX);
+
+		spi_stack_make_packet(mosi, NULL, 0, 0, SPI_STACK_INFO_MULTI_MESSAGE | SPI_STACK_INFO_CRC16 | slave_seq_seen | 1, false);
+		memset(miso, 0, SPI_STACK_MAX_MESSAGE_LENGTH);
+		host_spi_slave_transfer(mosi, miso, SPI_STACK_MAX_MESSAGE_LENGTH);
+
+		uint8_t payload_length = 0;
+		uint8_t info = 0;
+		HOST_TEST_CHECK(spi_stack_check_packet(miso, SPI_STACK_MAX_MESSAGE_LENGTH, payload, &payload_length, &info) == SPI_STACK_PACKET_OK);
+
+		if(payload_length > 0) {
+			packets_with_payload++;
+			if(miso[SPI_STACK_PREAMBLE] == SPI_STACK_PREAMBLE_VALUE_CRC16) {
+				packets_crc16++;
+			} else {
+				packets_pearson++;
+			}
+
+			const uint8_t slave_seq = info & SPI_STACK_INFO_SEQUENCE_SLAVE_MASK;
+			if(packets_with_payload % TEST_DROP_INTERVAL == 0) {
+				// Broken on the wire, the slave has to send it again
+				packets_dropped++;
+			} else if(slave_seq != slave_seq_seen) {
+				slave_seq_seen = slave_seq;
+
+				for(uint8_t offset = 0; offset < payload_length; offset += sizeof(TestCallback)) {
+					const TestCallback *cb = (const TestCallback*)(payload + offset);
+					HOST_TEST_CHECK(cb->header.length == sizeof(TestCallback));
+					HOST_TEST_CHECK(cb->header.fid == TEST_CALLBACK_FID);
+					HOST_TEST_CHECK(cb->counter == counter_expected);
+					counter_expected++;
+				}
+			}
+		}
+
+		// Let the callback task fill the send buffer
+		taskYIELD();
+	}
+
+	HOST_TEST_CHECK(test_callbacks_done);
+	HOST_TEST_CHECK(packets_dropped > 0);
+	HOST_TEST_CHECK(packets_pearson == 0);
+
+	printf("test_spi_stack_slave: %lu callbacks in %lu CRC16 packets, %lu acks dropped\n",
+	       (unsigned long)counter_expected,
+	       (unsigned long)packets_crc16,
+	       (unsigned long)packets_dropped);
+}
+
+int main(void) {
+	return host_test_run(test_spi_stack_slave);
+}
@@ -0,0 +1,103 @@
+/* bricklib
+ * Copyright (C) 2020 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * test_usb.c: Requests from the PC over the USB model of the host build
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "host_test.h"
+
+#include <string.h>
+
+#include "bricklib/free_rtos/include/FreeRTOS.h"
+#include "bricklib/free_rtos/include/task.h"
+#include "bricklib/com/com.h"
+#include "bricklib/com/com_common.h"
+#include "bricklib/com/com_messages.h"
+#include "bricklib/com/usb/usb.h"
+#include "bricklib/drivers/uid/uid.h"
+
+#define TEST_UID 0x12345678
+
+extern ComInfo com_info;
+
+static bool test_usb_available(void *context) {
+	return host_udp_read_available() >= *((uint16_t*)context);
+}
+
+static void test_usb_read(void *data, uint16_t length) {
+	HOST_TEST_CHECK(host_test_wait_for(test_usb_available, &length, 1000));
+	HOST_TEST_CHECK(host_udp_read(data, length) == length);
+}
+
+static void test_usb(void) {
+	com_info.uid = TEST_UID;
+	HOST_TEST_CHECK(usb_init());
+
+	xTaskCreate(usb_message_loop,
+	            (signed char *)"usb_ml",
+	            2500,
+	            NULL,
+	            1,
+	            (xTaskHandle *)NULL);
+
+	// GetIdentity of the Brick itself
+	GetIdentity gi = MESSAGE_EMPTY_INITIALIZER;
+	gi.header.uid             = TEST_UID;
+	gi.header.length          = sizeof(GetIdentity);
+	gi.header.fid             = FID_GET_IDENTITY;
+	gi.header.return_expected = 1;
+	gi.header.sequence_num    = 1;
+	HOST_TEST_CHECK(host_udp_write(&gi, sizeof(GetIdentity)));
+
+	GetIdentityReturn gir;
+	test_usb_read(&gir, sizeof(GetIdentityReturn));
+	HOST_TEST_CHECK(gir.header.uid == TEST_UID);
+	HOST_TEST_CHECK(gir.header.fid == FID_GET_IDENTITY);
+	HOST_TEST_CHECK(gir.header.length == sizeof(GetIdentityReturn));
+	HOST_TEST_CHECK(gir.header.sequence_num == 1);
+	HOST_TEST_CHECK(gir.header.error == MESSAGE_ERROR_CODE_OK);
+	HOST_TEST_CHECK(gir.position == '0');
+	HOST_TEST_CHECK(gir.device_identifier == BRICK_DEVICE_IDENTIFIER);
+
+	char uid_str[UID_STR_MAX_LENGTH] = {'\0'};
+	uid_to_serial_number(TEST_UID, uid_str);
+	HOST_TEST_CHECK(strncmp(gir.uid, uid_str, UID_STR_MAX_LENGTH) == 0);
+
+	// A request with the wrong length is answered with an error
+	gi.header.length       = sizeof(GetIdentity) + 1;
+	gi.header.sequence_num = 2;
+	char request[sizeof(GetIdentity) + 1] = {0};
+	memcpy(request, &gi, sizeof(GetIdentity));
+	HOST_TEST_CHECK(host_udp_write(request, sizeof(request)));
+
+	MessageHeader error;
+	test_usb_read(&error, sizeof(MessageHeader));
+	HOST_TEST_CHECK(error.fid == FID_GET_IDENTITY);
+	HOST_TEST_CHECK(error.sequence_num == 2);
+	HOST_TEST_CHECK(error.error == MESSAGE_ERROR_CODE_INVALID_PARAMETER);
+
+	// Drop the rest of the error response (zeroed payload)
+	uint8_t rest[sizeof(GetIdentityReturn)];
+	test_usb_read(rest, error.length - sizeof(MessageHeader));
+
+	printf("test_usb: %lu IN packets\n", (unsigned long)host_udp_get_in_packet_count());
+}
+
+int main(void) {
+	return host_test_run(test_usb);
+}
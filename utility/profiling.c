@@ -26,15 +26,109 @@
 
 #ifdef PROFILING
 #include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
 #include <FreeRTOS.h>
 #include <task.h>
 
 #include "bricklib/drivers/tc/tc.h"
 #include "bricklib/logging/logging.h"
+#include "bricklib/utility/util_definitions.h"
+#include "bricklib/utility/system_timer.h"
 
 volatile unsigned long ulHighFrequencyTimerTicks = 0UL;
 
+void profiling_cycles_init(void) {
+	// Enable trace unit and DWT cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void profiling_cycles_reset(ProfilingCycles *pc) {
+	pc->count      = 0;
+	pc->cycles_min = 0xFFFFFFFF;
+	pc->cycles_max = 0;
+	pc->cycles_sum = 0;
+	memset(pc->histogram, 0, sizeof(pc->histogram));
+}
+
+static uint8_t profiling_cycles_bucket(const uint32_t cycles) {
+	if(cycles < 2) {
+		return cycles;
+	}
+
+	// Bucket is given by the most significant bit and the bit below it
+	const uint8_t msb = 31 - __builtin_clz(cycles);
+	return (msb << 1) | ((cycles >> (msb - 1)) & 1);
+}
+
+static uint32_t profiling_cycles_bucket_upper_bound(const uint8_t bucket) {
+	if(bucket < 2) {
+		return bucket;
+	}
+
+	const uint8_t msb = bucket >> 1;
+	const uint64_t upper = ((uint64_t)(2 | (bucket & 1)) << (msb - 1)) + (1 << (msb - 1)) - 1;
+	return upper > 0xFFFFFFFF ? 0xFFFFFFFF : upper;
+}
+
+void profiling_cycles_add(ProfilingCycles *pc, const uint32_t cycles) {
+	pc->count++;
+	pc->cycles_sum += cycles;
+	if(cycles < pc->cycles_min) {
+		pc->cycles_min = cycles;
+	}
+	if(cycles > pc->cycles_max) {
+		pc->cycles_max = cycles;
+	}
+
+	pc->histogram[profiling_cycles_bucket(cycles)]++;
+}
+
+uint32_t profiling_cycles_percentile(ProfilingCycles *pc, const uint8_t percent) {
+	const uint32_t rank = (uint32_t)(((uint64_t)pc->count*percent + 99)/100);
+	uint32_t seen = 0;
+
+	for(uint8_t i = 0; i < PROFILING_CYCLES_HISTOGRAM_SIZE; i++) {
+		seen += pc->histogram[i];
+		if(seen >= rank) {
+			return MIN(profiling_cycles_bucket_upper_bound(i), pc->cycles_max);
+		}
+	}
+
+	return pc->cycles_max;
+}
+
+// Events per second, counted since start (system_timer_get_ms)
+uint32_t profiling_per_second(const uint32_t count, const uint32_t start) {
+	const uint32_t elapsed = system_timer_get_ms() - start;
+	if(elapsed == 0) {
+		return count;
+	}
+
+	return (uint32_t)(((uint64_t)count)*1000/elapsed);
+}
+
+void profiling_cycles_print(const char *name, ProfilingCycles *pc) {
+	if(pc->count == 0) {
+		logi("%s: no samples\n\r", name);
+		return;
+	}
+
+	logi("%s: n %"PRIu32", min %"PRIu32", avg %"PRIu32", p50 %"PRIu32", p99 %"PRIu32", max %"PRIu32" cycles\n\r",
+	     name,
+	     pc->count,
+	     pc->cycles_min,
+	     (uint32_t)(pc->cycles_sum/pc->count),
+	     profiling_cycles_percentile(pc, 50),
+	     profiling_cycles_percentile(pc, 99),
+	     pc->cycles_max);
+}
+
 void profiling_init(void) {
+	profiling_cycles_init();
+
     // Enable peripheral clock.
     PMC->PMC_PCER0 = 1 << ID_TC0;
 
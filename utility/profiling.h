@@ -32,6 +32,31 @@ extern volatile unsigned long ulHighFrequencyTimerTicks;
 #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() ( ulHighFrequencyTimerTicks = 0UL )
 #define portGET_RUN_TIME_COUNTER_VALUE()	ulHighFrequencyTimerTicks
 
+// Cycle accurate measurement of hot paths with the DWT cycle counter.
+// The counter runs with BOARD_MCK and wraps after ~67s at 64MHz, the
+// unsigned subtraction in PROFILING_CYCLES_SINCE handles the wrap-around.
+#define PROFILING_CYCLES_GET()           (DWT->CYCCNT)
+#define PROFILING_CYCLES_SINCE(start)    ((uint32_t)(DWT->CYCCNT - (start)))
+#define PROFILING_CYCLES_TO_NS(cycles)   ((uint32_t)(((uint64_t)(cycles)*1000000000ULL)/BOARD_MCK))
+
+// Histogram with two buckets per power of two (~40% resolution),
+// used to estimate percentiles without storing the samples
+#define PROFILING_CYCLES_HISTOGRAM_SIZE 64
+
+typedef struct {
+	uint32_t count;
+	uint32_t cycles_min;
+	uint32_t cycles_max;
+	uint64_t cycles_sum;
+	uint32_t histogram[PROFILING_CYCLES_HISTOGRAM_SIZE];
+} ProfilingCycles;
+
 void profiling_init(void);
+void profiling_cycles_init(void);
+void profiling_cycles_reset(ProfilingCycles *pc);
+void profiling_cycles_add(ProfilingCycles *pc, const uint32_t cycles);
+uint32_t profiling_cycles_percentile(ProfilingCycles *pc, const uint8_t percent);
+void profiling_cycles_print(const char *name, ProfilingCycles *pc);
+uint32_t profiling_per_second(const uint32_t count, const uint32_t start);
 #endif
 #endif
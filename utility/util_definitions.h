@@ -27,6 +27,8 @@
 #define TASK_DELAY_MS(ms) vTaskDelay(ms/portTICK_RATE_MS)
 #define TASK_DELAY_UNTIL_MS(last, ms) vTaskDelayUntil(last, ms/portTICK_RATE_MS)
 
+// The host build (see host/hal/host_hal.h) has its own busy waits
+#ifndef SLEEP_NS
 // SLEEP_NS is not perfect, exact values are:
 // "PUSH {R0}\n" -> 2 cycles
 // "MOV R0, %0\n" -> 1 cycles
@@ -74,6 +76,7 @@
 			:: "r" (i) \
 		); \
 	} while(0)
+#endif
 
 #ifndef ABS
 	#define ABS(a) (((a) < 0) ? (-(a)) : (a))